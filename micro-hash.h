@@ -29,11 +29,30 @@
 //   - micro_hash_int32_rob
 //   - micro_hash_int64_wang
 //   - micro_hash_int6432_wang
+//   - micro_hash_int64_crc32c
+//   - micro_hash_int32_wang_batch
+//   - micro_hash_int32_wang2_batch
+//   - micro_hash_int32_rob_batch
+//   - micro_hash_int64_wang_batch
+//   - micro_hash_int6432_wang_batch
 //   - micro_hash_bytes_curl
+//   - micro_hash_bytes_curl_wide
 //   - micro_hash_bytes_jenkins
+//   - micro_hash_bytes_xxh64
+//   - micro_hash_bytes_crc32c
+//   - micro_hash_bytes_aes
+//   - micro_hash_bytes_curl_init / _update / _final
+//   - micro_hash_bytes_jenkins_init / _update / _final
+//   - micro_hash_bytes_xxh64_init / _update / _final
+//   - micro_hash_bytes_curl_iov
+//   - micro_hash_bytes_jenkins_iov
+//   - micro_hash_bytes_xxh64_iov
 //   - micro_hash_str_stb
+//   - micro_hash_str_stb_n
 //   - micro_hash_str_djb2
+//   - micro_hash_str_djb2_n
 //   - micro_hash_str_sdbm
+//   - micro_hash_str_sdbm_n
 //
 // Check out the signatures to see the type that they accept and
 // generate.
@@ -42,14 +61,17 @@
 // Benchmarks
 // ----------
 //
-// There are some benchmarks under the `tests/` directory, for now
-// only the functions that work with integers are tested.
+// There are some benchmarks under the `tests/` directory. The integer
+// functions are tested over random integers, the bytes and string
+// functions over corpora of random bytes, English words, URLs, UUIDs
+// and sequential numbers (`--suite corpus_tests`).
 //
 // If you run `make check`, you should get similar results:
 //
 // /----------------------------------------------------------
 // |      hash function      |  collisions  |  non-uniformity |
 // | ----------------------- | ------------ | --------------- |
+// | micro_hash_int64_crc32c | 0            | 38.916015625000 |
 // | micro_hash_int32_rob    | 0            | 39.740234375000 |
 // | micro_hash_int32_wang2  | 0            | 39.412597656250 |
 // | micro_hash_int6432_wang | 11580        | 39.166503906250 |
@@ -87,6 +109,13 @@
 //
 // Then use whatever hash function you fancy most.
 //
+// You can tune the library by #defining certain values. See the
+// "Config" comments under "Configuration" below.
+//
+// The functions with SIMD kernels pick the best one for the CPU at
+// run time. Use micro_hash_set_backend to choose another one, and
+// `make check-backends` to test every backend on the same host.
+//
 // Some more hash functions:
 // - https://en.wikipedia.org/wiki/List_of_hash_functions
 //
@@ -111,8 +140,61 @@
 #define MICRO_HASH_MAJOR 0
 #define MICRO_HASH_MINOR 1
 
+//
+// Configuration
+//
+
+// Config: Disable the SIMD kernels of the batch functions by
+//         defining MICRO_HASH_NO_SIMD
+//
+// Note: The SIMD kernels are compiled only on x86 with GCC or
+// Clang, other targets always use the scalar kernels.
+#if 0
+  #define MICRO_HASH_NO_SIMD
+#endif
+
+// Config: Use a specific backend instead of the best one supported
+//         by the CPU by defining MICRO_HASH_FORCE_BACKEND to one of
+//         the values of MicroHashBackend
+//
+// Note: If the CPU does not support it, the best supported backend
+// is used instead.
+#if 0
+  #define MICRO_HASH_FORCE_BACKEND MICRO_HASH_BACKEND_SCALAR
+#endif
+
+// Config: Output size in bytes from which the 64-bit batch functions
+//         write their results with non-temporal stores, bypassing
+//         the cache
+//
+// Note: Set it around the size of the last level cache, outputs
+// bigger than that would only evict useful lines. Define it to 0 to
+// never use non-temporal stores.
+#ifndef MICRO_HASH_STREAM_THRESHOLD
+  #define MICRO_HASH_STREAM_THRESHOLD (32 * 1024 * 1024)
+#endif
+
+#if !defined(MICRO_HASH_NO_SIMD) && defined(__GNUC__) \
+  && (defined(__x86_64__) || defined(__i386__))
+  #define MICRO_HASH_X86
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+  #define MICRO_HASH_IOV
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#ifdef MICRO_HASH_IOV
+  #include <sys/uio.h>
+#endif
+
+#if defined(MICRO_HASH_IMPLEMENTATION) && defined(MICRO_HASH_X86)
+  #include <cpuid.h>
+  #include <immintrin.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -145,6 +227,92 @@ uint64_t micro_hash_int64_wang(uint64_t key);
 // Credits: Thomas Wang
 uint32_t micro_hash_int6432_wang(uint64_t key);
 
+// CRC-32C (Castagnoli) of the 8 bytes of the key in little endian
+// order, same as micro_hash_bytes_crc32c(&key, 8) on little endian
+// machines
+uint32_t micro_hash_int64_crc32c(uint64_t key);
+
+// Batch
+// -----
+//
+// Hash the n keys in `in` and write the results in `out`. The results
+// are the same as calling the integer function on each key, but the
+// keys are hashed 4 to 16 at a time with SIMD instructions.
+//
+// The kernel is chosen at run time by the backend, see "Dispatch".
+
+void micro_hash_int32_wang_batch(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int32_wang2_batch(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int32_rob_batch(const uint32_t *in, uint32_t *out, size_t n);
+
+// Outputs of at least MICRO_HASH_STREAM_THRESHOLD bytes are written
+// with non-temporal stores.
+void micro_hash_int64_wang_batch(const uint64_t *in, uint64_t *out, size_t n);
+void micro_hash_int6432_wang_batch(const uint64_t *in, uint32_t *out, size_t n);
+
+// Batch kernels for each instruction set. The AVX2 and AVX-512
+// kernels are declared only when MICRO_HASH_X86 is defined, and must
+// be called only if the CPU supports them.
+
+void micro_hash_int32_wang_batch_scalar(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int32_wang2_batch_scalar(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int32_rob_batch_scalar(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int64_wang_batch_scalar(const uint64_t *in, uint64_t *out, size_t n);
+void micro_hash_int6432_wang_batch_scalar(const uint64_t *in, uint32_t *out, size_t n);
+
+#ifdef MICRO_HASH_X86
+void micro_hash_int32_wang_batch_avx2(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int32_wang2_batch_avx2(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int32_rob_batch_avx2(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int64_wang_batch_avx2(const uint64_t *in, uint64_t *out, size_t n);
+void micro_hash_int6432_wang_batch_avx2(const uint64_t *in, uint32_t *out, size_t n);
+
+void micro_hash_int32_wang_batch_avx512(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int32_wang2_batch_avx512(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int32_rob_batch_avx512(const uint32_t *in, uint32_t *out, size_t n);
+void micro_hash_int64_wang_batch_avx512(const uint64_t *in, uint64_t *out, size_t n);
+void micro_hash_int6432_wang_batch_avx512(const uint64_t *in, uint32_t *out, size_t n);
+#endif // MICRO_HASH_X86
+
+// Dispatch
+// --------
+//
+// The functions with more than one kernel call it through a function
+// pointer. On first use, the CPU is checked with CPUID (and XGETBV,
+// to make sure that the OS saves the vector registers) and the
+// pointers are bound to the kernels of the best backend available.
+//
+// Binding is not synchronized: call micro_hash_get_backend() once
+// before starting threads if they may race on the first call, and do
+// not call micro_hash_set_backend while other threads hash.
+//
+// Each backend includes the ones before it in MicroHashBackend. The
+// AES-NI kernels are bound from MICRO_HASH_BACKEND_SSE42 up, if the
+// CPU also has the AES extension.
+
+typedef enum {
+  MICRO_HASH_BACKEND_SCALAR = 0,
+  MICRO_HASH_BACKEND_SSE42,
+  MICRO_HASH_BACKEND_AVX2,
+  MICRO_HASH_BACKEND_AVX512,
+  MICRO_HASH_BACKEND_COUNT,
+} MicroHashBackend;
+
+// Get the backend in use, binding the best one on the first call
+MicroHashBackend micro_hash_get_backend(void);
+
+// Bind the kernels of a backend, used to benchmark the backends
+// against each other
+//
+// Returns: 0 on success, or -1 if the CPU does not support the backend
+int micro_hash_set_backend(MicroHashBackend backend);
+
+// Returns: whether the CPU supports the backend
+int micro_hash_backend_supported(MicroHashBackend backend);
+
+// Returns: the name of the backend, like "avx2"
+const char *micro_hash_backend_name(MicroHashBackend backend);
+
 // Bytes
 // -----
 //
@@ -153,16 +321,152 @@ uint32_t micro_hash_int6432_wang(uint64_t key);
 // curl/lib/hash.c
 size_t micro_hash_bytes_curl(void *key, size_t key_length);
 
+// Same as micro_hash_bytes_curl, but reads the key 8 bytes at a
+// time with unaligned-safe loads and hashes the tail bytes
+// separately. The result is the same as micro_hash_bytes_curl.
+//
+// Note: each byte still depends on the previous hash value, so this
+// saves the per-byte loads and loop branches, not the multiply-xor
+// chain itself. It is only faster on keys of a few words, on longer
+// ones the byte loop of micro_hash_bytes_curl keeps up or wins.
+size_t micro_hash_bytes_curl_wide(const void *key, size_t key_length);
+
 // https://en.wikipedia.org/wiki/Jenkins_hash_function 
 uint32_t micro_hash_bytes_jenkins(uint8_t* key, size_t key_length);
 
+// Bulk hash for large buffers, same as XXH64
+//
+// The key is consumed in 32 bytes stripes by 4 independent 64-bit
+// accumulators, which are merged at the end. The lanes do not depend
+// on each other so the CPU can run them in parallel, which makes this
+// much faster than micro_hash_bytes_jenkins on multi-KiB keys.
+//
+// Credits: Yann Collet, https://github.com/Cyan4973/xxHash
+uint64_t micro_hash_bytes_xxh64(const void *key, size_t key_length,
+                                uint64_t seed);
+
+// CRC-32C (Castagnoli), the checksum of iSCSI and ext4
+//
+// The SSE4.2 kernel uses the crc32 instruction, 8 bytes at a time.
+// On large keys it splits the buffer in three parts and hashes them
+// in parallel to hide the 3 cycles latency of the instruction, then
+// merges the three CRCs. The scalar kernel is table driven
+// (slicing-by-8) and returns the same hashes.
+uint32_t micro_hash_bytes_crc32c(const void *key, size_t key_length);
+
+// CRC32C kernels for each instruction set. The SSE4.2 kernels are
+// declared only when MICRO_HASH_X86 is defined, and must be called
+// only if the CPU supports them.
+
+uint32_t micro_hash_bytes_crc32c_scalar(const void *key, size_t key_length);
+uint32_t micro_hash_int64_crc32c_scalar(uint64_t key);
+
+#ifdef MICRO_HASH_X86
+uint32_t micro_hash_bytes_crc32c_sse42(const void *key, size_t key_length);
+uint32_t micro_hash_int64_crc32c_sse42(uint64_t key);
+#endif // MICRO_HASH_X86
+
+// Bulk hash built on AES rounds, in the style of meowhash and ahash
+//
+// The key is consumed in 128 bytes stripes by 8 lanes of 16 bytes,
+// each stripe goes through one AESENC round per lane with the key
+// bytes as round key. The lanes are then folded together and the
+// length and seed are mixed in with 3 more rounds. Keys of up to 16
+// bytes skip the lanes and take a single round, with the key bytes
+// in its state, before those 3.
+//
+// The AES-NI kernel runs the rounds with the aesenc instruction, the
+// scalar kernel with a table driven software round and returns the
+// same hashes on every host, only much slower.
+uint64_t micro_hash_bytes_aes(const void *key, size_t key_length,
+                              uint64_t seed);
+
+// AES kernels for each instruction set. The AES-NI kernel is declared
+// only when MICRO_HASH_X86 is defined, and must be called only if the
+// CPU supports it.
+
+uint64_t micro_hash_bytes_aes_scalar(const void *key, size_t key_length,
+                                     uint64_t seed);
+
+#ifdef MICRO_HASH_X86
+uint64_t micro_hash_bytes_aes_aesni(const void *key, size_t key_length,
+                                    uint64_t seed);
+#endif // MICRO_HASH_X86
+
+// Streaming
+// ---------
+//
+// Hash a key that comes in pieces, without copying it in one buffer:
+// call _init once, _update with each piece in order, then _final.
+// The result is the same as the one-shot function on the whole key,
+// however it was split.
+//
+// The states do not keep pointers to the pieces. _final does not
+// modify the state, so more pieces can be added after it.
+
+typedef struct {
+  size_t hash;
+} MicroHashCurlState;
+
+void micro_hash_bytes_curl_init(MicroHashCurlState *state);
+void micro_hash_bytes_curl_update(MicroHashCurlState *state,
+                                  const void *data, size_t length);
+size_t micro_hash_bytes_curl_final(const MicroHashCurlState *state);
+
+typedef struct {
+  uint32_t hash;
+} MicroHashJenkinsState;
+
+void micro_hash_bytes_jenkins_init(MicroHashJenkinsState *state);
+void micro_hash_bytes_jenkins_update(MicroHashJenkinsState *state,
+                                     const void *data, size_t length);
+uint32_t micro_hash_bytes_jenkins_final(const MicroHashJenkinsState *state);
+
+// The bytes of a stripe that is not complete yet are kept in the
+// state until the next update fills it.
+typedef struct {
+  uint64_t acc[4];
+  uint64_t seed;
+  uint64_t total_length;
+  unsigned char buffer[32];
+  size_t buffered;
+} MicroHashXxh64State;
+
+void micro_hash_bytes_xxh64_init(MicroHashXxh64State *state, uint64_t seed);
+void micro_hash_bytes_xxh64_update(MicroHashXxh64State *state,
+                                   const void *data, size_t length);
+uint64_t micro_hash_bytes_xxh64_final(const MicroHashXxh64State *state);
+
+// Vectored
+// --------
+//
+// Hash the concatenation of the `iovcnt` buffers of `iov`, as filled
+// by readv(2). The result is the same as the one-shot function on the
+// concatenation. Unlike a loop of _update calls, the hash state stays
+// in local variables for the whole call.
+//
+// Declared only when MICRO_HASH_IOV is defined, on unix systems.
+
+#ifdef MICRO_HASH_IOV
+size_t micro_hash_bytes_curl_iov(const struct iovec *iov, int iovcnt);
+uint32_t micro_hash_bytes_jenkins_iov(const struct iovec *iov, int iovcnt);
+uint64_t micro_hash_bytes_xxh64_iov(const struct iovec *iov, int iovcnt,
+                                    uint64_t seed);
+#endif // MICRO_HASH_IOV
+
 // String
 // ------
 //
 // Hash a string
+//
+// The `_n` variants hash the first `length` bytes of `str` instead of
+// looking for the terminating NUL, and return the same value as the
+// original on a string of that length. They read the string 8 bytes
+// at a time, and do not need it to be NUL terminated.
 
 // stb/stb_ds.h
 size_t micro_hash_str_stb(char *str, size_t seed);
+size_t micro_hash_str_stb_n(const char *str, size_t length, size_t seed);
 
 // djb2 algorithm
 //
@@ -173,6 +477,10 @@ size_t micro_hash_str_stb(char *str, size_t seed);
 // constants, prime or not) has never been adequately explained.
 unsigned long micro_hash_str_djb2(unsigned char *str);
 
+// The 8 steps of a word are expanded to a polynomial in 33, so the
+// multiplications of the bytes do not depend on each other.
+unsigned long micro_hash_str_djb2_n(const unsigned char *str, size_t length);
+
 // sdbm
 //
 // This algorithm was created for sdbm (a public-domain
@@ -184,6 +492,9 @@ unsigned long micro_hash_str_djb2(unsigned char *str);
 // used in gawk.
 unsigned long micro_hash_str_sdbm(unsigned char *str);
 
+// Same as micro_hash_str_djb2_n, with 65599 instead of 33.
+unsigned long micro_hash_str_sdbm_n(const unsigned char *str, size_t length);
+
 //
 // Implementation
 //
@@ -247,83 +558,2245 @@ uint32_t micro_hash_int6432_wang(uint64_t key)
   return (int) key;
 }
 
-// Bytes
+// Batch
 
-size_t micro_hash_bytes_curl(void *key, size_t key_length)
+void micro_hash_int32_wang_batch_scalar(const uint32_t *in, uint32_t *out, size_t n)
 {
-  char *key_str = (char *) key;
-  char *end = key_str + key_length;
-  size_t h = 5381;
+  for (size_t i = 0; i < n; ++i)
+    out[i] = micro_hash_int32_wang(in[i]);
+}
 
-  while(key_str < end) {
-    size_t j = (size_t)*key_str++;
-    h += h << 5;
-    h ^= j;
+void micro_hash_int32_wang2_batch_scalar(const uint32_t *in, uint32_t *out, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    out[i] = micro_hash_int32_wang2(in[i]);
+}
+
+void micro_hash_int32_rob_batch_scalar(const uint32_t *in, uint32_t *out, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    out[i] = micro_hash_int32_rob(in[i]);
+}
+
+void micro_hash_int64_wang_batch_scalar(const uint64_t *in, uint64_t *out, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    out[i] = micro_hash_int64_wang(in[i]);
+}
+
+void micro_hash_int6432_wang_batch_scalar(const uint64_t *in, uint32_t *out, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    out[i] = micro_hash_int6432_wang(in[i]);
+}
+
+// Whether a batch writing `bytes` bytes of results should use
+// non-temporal stores
+#define _MICRO_HASH_STREAM(bytes) \
+  (MICRO_HASH_STREAM_THRESHOLD != 0 && (bytes) >= MICRO_HASH_STREAM_THRESHOLD)
+
+#ifdef MICRO_HASH_X86
+
+#define MICRO_HASH_TARGET(isa) __attribute__((target(isa)))
+
+// AVX2, 8 keys at a time
+
+MICRO_HASH_TARGET("avx2")
+void micro_hash_int32_wang_batch_avx2(const uint32_t *in, uint32_t *out, size_t n)
+{
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+    a = _mm256_xor_si256(_mm256_xor_si256(a, _mm256_set1_epi32(61)),
+                         _mm256_srli_epi32(a, 16));
+    a = _mm256_add_epi32(a, _mm256_slli_epi32(a, 3));
+    a = _mm256_xor_si256(a, _mm256_srli_epi32(a, 4));
+    a = _mm256_mullo_epi32(a, _mm256_set1_epi32(0x27d4eb2d));
+    a = _mm256_xor_si256(a, _mm256_srli_epi32(a, 15));
+    _mm256_storeu_si256((__m256i *)(out + i), a);
   }
+  for (; i < n; ++i)
+    out[i] = micro_hash_int32_wang(in[i]);
+}
 
-  return h;
+MICRO_HASH_TARGET("avx2")
+void micro_hash_int32_wang2_batch_avx2(const uint32_t *in, uint32_t *out, size_t n)
+{
+  const __m256i ones = _mm256_set1_epi32(-1);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i key = _mm256_loadu_si256((const __m256i *)(in + i));
+    key = _mm256_add_epi32(_mm256_xor_si256(key, ones),
+                           _mm256_slli_epi32(key, 15));
+    key = _mm256_xor_si256(key, _mm256_srli_epi32(key, 12));
+    key = _mm256_add_epi32(key, _mm256_slli_epi32(key, 2));
+    key = _mm256_xor_si256(key, _mm256_srli_epi32(key, 4));
+    // key * 2057, shifts are cheaper than vpmulld
+    key = _mm256_add_epi32(_mm256_add_epi32(key, _mm256_slli_epi32(key, 3)),
+                           _mm256_slli_epi32(key, 11));
+    key = _mm256_xor_si256(key, _mm256_srli_epi32(key, 16));
+    _mm256_storeu_si256((__m256i *)(out + i), key);
+  }
+  for (; i < n; ++i)
+    out[i] = micro_hash_int32_wang2(in[i]);
 }
 
-uint32_t micro_hash_bytes_jenkins(uint8_t* key, size_t length)
+MICRO_HASH_TARGET("avx2")
+void micro_hash_int32_rob_batch_avx2(const uint32_t *in, uint32_t *out, size_t n)
 {
   size_t i = 0;
-  uint32_t hash = 0;
-  while (i != length) {
-    hash += key[i++];
-    hash += hash << 10;
-    hash ^= hash >> 6;
+  for (; i + 8 <= n; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+    a = _mm256_add_epi32(_mm256_add_epi32(a, _mm256_set1_epi32(0x7ed55d16)),
+                         _mm256_slli_epi32(a, 12));
+    a = _mm256_xor_si256(_mm256_xor_si256(a, _mm256_set1_epi32((int)0xc761c23c)),
+                         _mm256_srli_epi32(a, 19));
+    a = _mm256_add_epi32(_mm256_add_epi32(a, _mm256_set1_epi32(0x165667b1)),
+                         _mm256_slli_epi32(a, 5));
+    a = _mm256_xor_si256(_mm256_add_epi32(a, _mm256_set1_epi32((int)0xd3a2646c)),
+                         _mm256_slli_epi32(a, 9));
+    a = _mm256_add_epi32(_mm256_add_epi32(a, _mm256_set1_epi32((int)0xfd7046c5)),
+                         _mm256_slli_epi32(a, 3));
+    a = _mm256_xor_si256(_mm256_xor_si256(a, _mm256_set1_epi32((int)0xb55a4f09)),
+                         _mm256_srli_epi32(a, 16));
+    _mm256_storeu_si256((__m256i *)(out + i), a);
   }
-  hash += hash << 3;
-  hash ^= hash >> 11;
-  hash += hash << 15;
-  return hash;
+  for (; i < n; ++i)
+    out[i] = micro_hash_int32_rob(in[i]);
 }
 
-// Strings
-  
-size_t micro_hash_str_stb(char *str, size_t seed)
+// AVX2, 4 keys at a time
+//
+// There is no 64-bit multiply in AVX2, the multiplications by
+// constants are written as shifts and adds like in the scalar code.
+
+MICRO_HASH_TARGET("avx2")
+static inline __m256i _micro_hash_int64_wang_avx2(__m256i key)
 {
-#define SIZE_T_BITS           ((sizeof (size_t)) * 8)
-#define ROTATE_LEFT(val, n)   (((val) << (n)) | ((val) >> (SIZE_T_BITS - (n))))
-#define ROTATE_RIGHT(val, n)  (((val) >> (n)) | ((val) << (SIZE_T_BITS - (n))))
+  const __m256i ones = _mm256_set1_epi64x(-1);
+  key = _mm256_add_epi64(_mm256_xor_si256(key, ones),
+                         _mm256_slli_epi64(key, 21));
+  key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 24));
+  key = _mm256_add_epi64(_mm256_add_epi64(key, _mm256_slli_epi64(key, 3)),
+                         _mm256_slli_epi64(key, 8));
+  key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 14));
+  key = _mm256_add_epi64(_mm256_add_epi64(key, _mm256_slli_epi64(key, 2)),
+                         _mm256_slli_epi64(key, 4));
+  key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 28));
+  key = _mm256_add_epi64(key, _mm256_slli_epi64(key, 31));
+  return key;
+}
 
-  size_t hash = seed;
-  while (*str)
-     hash = ROTATE_LEFT(hash, 9) + (unsigned char) *str++;
+// Returns: the low 32 bits of each hash
+MICRO_HASH_TARGET("avx2")
+static inline __m128i _micro_hash_int6432_wang_avx2(__m256i key)
+{
+  const __m256i ones = _mm256_set1_epi64x(-1);
+  key = _mm256_add_epi64(_mm256_xor_si256(key, ones),
+                         _mm256_slli_epi64(key, 18));
+  key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 31));
+  key = _mm256_add_epi64(_mm256_add_epi64(key, _mm256_slli_epi64(key, 2)),
+                         _mm256_slli_epi64(key, 4));
+  key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 11));
+  key = _mm256_add_epi64(key, _mm256_slli_epi64(key, 6));
+  key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 22));
+  key = _mm256_permutevar8x32_epi32(key, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+  return _mm256_castsi256_si128(key);
+}
 
-  // Thomas Wang 64-to-32 bit mix function, hopefully also works in 32 bits
-  hash ^= seed;
-  hash = (~hash) + (hash << 18);
-  hash ^= hash ^ ROTATE_RIGHT(hash,31);
-  hash = hash * 21;
-  hash ^= hash ^ ROTATE_RIGHT(hash,11);
-  hash += (hash << 6);
-  hash ^= ROTATE_RIGHT(hash,22);
-  return hash+seed;
-  
-#undef ROTATE_LEFT
-#undef ROTATE_RIGHT
-#undef SIZE_T_BITS
+MICRO_HASH_TARGET("avx2")
+void micro_hash_int64_wang_batch_avx2(const uint64_t *in, uint64_t *out, size_t n)
+{
+  size_t i = 0;
+  if (_MICRO_HASH_STREAM(n * sizeof(*out))) {
+    for (; i < n && ((uintptr_t)(out + i) & 31) != 0; ++i)
+      out[i] = micro_hash_int64_wang(in[i]);
+    for (; i + 4 <= n; i += 4) {
+      __m256i key = _mm256_loadu_si256((const __m256i *)(in + i));
+      _mm256_stream_si256((__m256i *)(out + i), _micro_hash_int64_wang_avx2(key));
+    }
+    _mm_sfence();
+  } else {
+    for (; i + 4 <= n; i += 4) {
+      __m256i key = _mm256_loadu_si256((const __m256i *)(in + i));
+      _mm256_storeu_si256((__m256i *)(out + i), _micro_hash_int64_wang_avx2(key));
+    }
+  }
+  for (; i < n; ++i)
+    out[i] = micro_hash_int64_wang(in[i]);
 }
 
-unsigned long micro_hash_str_djb2(unsigned char *str)
+MICRO_HASH_TARGET("avx2")
+void micro_hash_int6432_wang_batch_avx2(const uint64_t *in, uint32_t *out, size_t n)
 {
-  unsigned long hash = 5381;
-  int c;
-  
-  while ((c = *str++))
-    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+  size_t i = 0;
+  if (_MICRO_HASH_STREAM(n * sizeof(*out))) {
+    for (; i < n && ((uintptr_t)(out + i) & 15) != 0; ++i)
+      out[i] = micro_hash_int6432_wang(in[i]);
+    for (; i + 4 <= n; i += 4) {
+      __m256i key = _mm256_loadu_si256((const __m256i *)(in + i));
+      _mm_stream_si128((__m128i *)(out + i), _micro_hash_int6432_wang_avx2(key));
+    }
+    _mm_sfence();
+  } else {
+    for (; i + 4 <= n; i += 4) {
+      __m256i key = _mm256_loadu_si256((const __m256i *)(in + i));
+      _mm_storeu_si128((__m128i *)(out + i), _micro_hash_int6432_wang_avx2(key));
+    }
+  }
+  for (; i < n; ++i)
+    out[i] = micro_hash_int6432_wang(in[i]);
+}
+
+// AVX-512, 16 keys at a time. The tail is handled with masked loads
+// and stores instead of a scalar loop.
+//
+// Note: GCC 12 warns about uninitialized variables inside its own
+// AVX-512 headers when compiling C++ (GCC bug 105593).
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic push
+  #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+MICRO_HASH_TARGET("avx512f")
+void micro_hash_int32_wang_batch_avx512(const uint32_t *in, uint32_t *out, size_t n)
+{
+  for (size_t i = 0; i < n; i += 16) {
+    __mmask16 m = (n - i >= 16) ? 0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+    __m512i a = _mm512_maskz_loadu_epi32(m, in + i);
+    a = _mm512_xor_si512(_mm512_xor_si512(a, _mm512_set1_epi32(61)),
+                         _mm512_srli_epi32(a, 16));
+    a = _mm512_add_epi32(a, _mm512_slli_epi32(a, 3));
+    a = _mm512_xor_si512(a, _mm512_srli_epi32(a, 4));
+    a = _mm512_mullo_epi32(a, _mm512_set1_epi32(0x27d4eb2d));
+    a = _mm512_xor_si512(a, _mm512_srli_epi32(a, 15));
+    _mm512_mask_storeu_epi32(out + i, m, a);
+  }
+}
+
+MICRO_HASH_TARGET("avx512f")
+void micro_hash_int32_wang2_batch_avx512(const uint32_t *in, uint32_t *out, size_t n)
+{
+  const __m512i ones = _mm512_set1_epi32(-1);
+  for (size_t i = 0; i < n; i += 16) {
+    __mmask16 m = (n - i >= 16) ? 0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+    __m512i key = _mm512_maskz_loadu_epi32(m, in + i);
+    key = _mm512_add_epi32(_mm512_xor_si512(key, ones),
+                           _mm512_slli_epi32(key, 15));
+    key = _mm512_xor_si512(key, _mm512_srli_epi32(key, 12));
+    key = _mm512_add_epi32(key, _mm512_slli_epi32(key, 2));
+    key = _mm512_xor_si512(key, _mm512_srli_epi32(key, 4));
+    key = _mm512_add_epi32(_mm512_add_epi32(key, _mm512_slli_epi32(key, 3)),
+                           _mm512_slli_epi32(key, 11));
+    key = _mm512_xor_si512(key, _mm512_srli_epi32(key, 16));
+    _mm512_mask_storeu_epi32(out + i, m, key);
+  }
+}
+
+MICRO_HASH_TARGET("avx512f")
+void micro_hash_int32_rob_batch_avx512(const uint32_t *in, uint32_t *out, size_t n)
+{
+  for (size_t i = 0; i < n; i += 16) {
+    __mmask16 m = (n - i >= 16) ? 0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+    __m512i a = _mm512_maskz_loadu_epi32(m, in + i);
+    a = _mm512_add_epi32(_mm512_add_epi32(a, _mm512_set1_epi32(0x7ed55d16)),
+                         _mm512_slli_epi32(a, 12));
+    a = _mm512_xor_si512(_mm512_xor_si512(a, _mm512_set1_epi32((int)0xc761c23c)),
+                         _mm512_srli_epi32(a, 19));
+    a = _mm512_add_epi32(_mm512_add_epi32(a, _mm512_set1_epi32(0x165667b1)),
+                         _mm512_slli_epi32(a, 5));
+    a = _mm512_xor_si512(_mm512_add_epi32(a, _mm512_set1_epi32((int)0xd3a2646c)),
+                         _mm512_slli_epi32(a, 9));
+    a = _mm512_add_epi32(_mm512_add_epi32(a, _mm512_set1_epi32((int)0xfd7046c5)),
+                         _mm512_slli_epi32(a, 3));
+    a = _mm512_xor_si512(_mm512_xor_si512(a, _mm512_set1_epi32((int)0xb55a4f09)),
+                         _mm512_srli_epi32(a, 16));
+    _mm512_mask_storeu_epi32(out + i, m, a);
+  }
+}
+
+// AVX-512, 8 keys at a time
+
+MICRO_HASH_TARGET("avx512f")
+static inline __m512i _micro_hash_int64_wang_avx512(__m512i key)
+{
+  const __m512i ones = _mm512_set1_epi64(-1);
+  key = _mm512_add_epi64(_mm512_xor_si512(key, ones),
+                         _mm512_slli_epi64(key, 21));
+  key = _mm512_xor_si512(key, _mm512_srli_epi64(key, 24));
+  key = _mm512_add_epi64(_mm512_add_epi64(key, _mm512_slli_epi64(key, 3)),
+                         _mm512_slli_epi64(key, 8));
+  key = _mm512_xor_si512(key, _mm512_srli_epi64(key, 14));
+  key = _mm512_add_epi64(_mm512_add_epi64(key, _mm512_slli_epi64(key, 2)),
+                         _mm512_slli_epi64(key, 4));
+  key = _mm512_xor_si512(key, _mm512_srli_epi64(key, 28));
+  key = _mm512_add_epi64(key, _mm512_slli_epi64(key, 31));
+  return key;
+}
+
+// Returns: the full 64-bit hashes, the caller keeps the low 32 bits
+MICRO_HASH_TARGET("avx512f")
+static inline __m512i _micro_hash_int6432_wang_avx512(__m512i key)
+{
+  const __m512i ones = _mm512_set1_epi64(-1);
+  key = _mm512_add_epi64(_mm512_xor_si512(key, ones),
+                         _mm512_slli_epi64(key, 18));
+  key = _mm512_xor_si512(key, _mm512_srli_epi64(key, 31));
+  key = _mm512_add_epi64(_mm512_add_epi64(key, _mm512_slli_epi64(key, 2)),
+                         _mm512_slli_epi64(key, 4));
+  key = _mm512_xor_si512(key, _mm512_srli_epi64(key, 11));
+  key = _mm512_add_epi64(key, _mm512_slli_epi64(key, 6));
+  key = _mm512_xor_si512(key, _mm512_srli_epi64(key, 22));
+  return key;
+}
+
+MICRO_HASH_TARGET("avx512f")
+void micro_hash_int64_wang_batch_avx512(const uint64_t *in, uint64_t *out, size_t n)
+{
+  size_t i = 0;
+  if (_MICRO_HASH_STREAM(n * sizeof(*out))) {
+    for (; i < n && ((uintptr_t)(out + i) & 63) != 0; ++i)
+      out[i] = micro_hash_int64_wang(in[i]);
+    for (; i + 8 <= n; i += 8) {
+      __m512i key = _mm512_loadu_si512(in + i);
+      _mm512_stream_si512((__m512i *)(out + i), _micro_hash_int64_wang_avx512(key));
+    }
+    _mm_sfence();
+  }
+  for (; i < n; i += 8) {
+    __mmask8 m = (n - i >= 8) ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+    __m512i key = _mm512_maskz_loadu_epi64(m, in + i);
+    _mm512_mask_storeu_epi64(out + i, m, _micro_hash_int64_wang_avx512(key));
+  }
+}
+
+MICRO_HASH_TARGET("avx512f")
+void micro_hash_int6432_wang_batch_avx512(const uint64_t *in, uint32_t *out, size_t n)
+{
+  size_t i = 0;
+  if (_MICRO_HASH_STREAM(n * sizeof(*out))) {
+    for (; i < n && ((uintptr_t)(out + i) & 31) != 0; ++i)
+      out[i] = micro_hash_int6432_wang(in[i]);
+    for (; i + 8 <= n; i += 8) {
+      __m512i key = _mm512_loadu_si512(in + i);
+      __m256i hash = _mm512_cvtepi64_epi32(_micro_hash_int6432_wang_avx512(key));
+      _mm256_stream_si256((__m256i *)(out + i), hash);
+    }
+    _mm_sfence();
+  }
+  for (; i < n; i += 8) {
+    __mmask8 m = (n - i >= 8) ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+    __m512i key = _mm512_maskz_loadu_epi64(m, in + i);
+    _mm512_mask_cvtepi64_storeu_epi32(out + i, m, _micro_hash_int6432_wang_avx512(key));
+  }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic pop
+#endif
+
+#endif // MICRO_HASH_X86
+
+// Dispatch
+
+typedef void (*_micro_hash_batch32_fn)(const uint32_t *in, uint32_t *out, size_t n);
+typedef void (*_micro_hash_batch64_fn)(const uint64_t *in, uint64_t *out, size_t n);
+typedef void (*_micro_hash_batch6432_fn)(const uint64_t *in, uint32_t *out, size_t n);
+typedef uint32_t (*_micro_hash_bytes32_fn)(const void *key, size_t key_length);
+typedef uint32_t (*_micro_hash_int6432_fn)(uint64_t key);
+typedef uint64_t (*_micro_hash_bytes64_fn)(const void *key, size_t key_length,
+                                           uint64_t seed);
+
+// Function pointers of each hash family, bound to the kernels of the
+// current backend
+typedef struct {
+  _micro_hash_batch32_fn int32_wang_batch;
+  _micro_hash_batch32_fn int32_wang2_batch;
+  _micro_hash_batch32_fn int32_rob_batch;
+  _micro_hash_batch64_fn int64_wang_batch;
+  _micro_hash_batch6432_fn int6432_wang_batch;
+  _micro_hash_bytes32_fn bytes_crc32c;
+  _micro_hash_int6432_fn int64_crc32c;
+  _micro_hash_bytes64_fn bytes_aes;
+} _MicroHashDispatch;
+
+static void _micro_hash_int32_wang_batch_resolve(const uint32_t *in, uint32_t *out, size_t n);
+static void _micro_hash_int32_wang2_batch_resolve(const uint32_t *in, uint32_t *out, size_t n);
+static void _micro_hash_int32_rob_batch_resolve(const uint32_t *in, uint32_t *out, size_t n);
+static void _micro_hash_int64_wang_batch_resolve(const uint64_t *in, uint64_t *out, size_t n);
+static void _micro_hash_int6432_wang_batch_resolve(const uint64_t *in, uint32_t *out, size_t n);
+static uint32_t _micro_hash_bytes_crc32c_resolve(const void *key, size_t key_length);
+static uint32_t _micro_hash_int64_crc32c_resolve(uint64_t key);
+static uint64_t _micro_hash_bytes_aes_resolve(const void *key, size_t key_length,
+                                              uint64_t seed);
+
+// Until a backend is bound, the pointers go to resolvers that bind
+// the best backend and forward the call
+static _MicroHashDispatch _micro_hash_dispatch = {
+  _micro_hash_int32_wang_batch_resolve,
+  _micro_hash_int32_wang2_batch_resolve,
+  _micro_hash_int32_rob_batch_resolve,
+  _micro_hash_int64_wang_batch_resolve,
+  _micro_hash_int6432_wang_batch_resolve,
+  _micro_hash_bytes_crc32c_resolve,
+  _micro_hash_int64_crc32c_resolve,
+  _micro_hash_bytes_aes_resolve,
+};
+
+// MICRO_HASH_BACKEND_COUNT while no backend is bound
+static MicroHashBackend _micro_hash_backend = MICRO_HASH_BACKEND_COUNT;
+
+#ifdef MICRO_HASH_X86
+
+// Read the extended control register 0, which tells which register
+// states the OS saves on context switch
+static inline uint64_t _micro_hash_xgetbv(void)
+{
+  uint32_t eax, edx;
+  __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t) edx << 32) | eax;
+}
+
+#endif // MICRO_HASH_X86
+
+// Returns: the best backend supported by the CPU and the OS
+static MicroHashBackend _micro_hash_detect_backend(void)
+{
+#ifdef MICRO_HASH_X86
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return MICRO_HASH_BACKEND_SCALAR;
+
+  int sse42   = (ecx >> 20) & 1;
+  int osxsave = (ecx >> 27) & 1;
+  if (!sse42)
+    return MICRO_HASH_BACKEND_SCALAR;
+  if (!osxsave || __get_cpuid_max(0, NULL) < 7)
+    return MICRO_HASH_BACKEND_SSE42;
+
+  uint64_t xcr0 = _micro_hash_xgetbv();
+  int ymm_state = (xcr0 & 0x06) == 0x06;  // XMM and YMM
+  int zmm_state = (xcr0 & 0xE6) == 0xE6;  // and opmask, ZMM0-31
   
-  return hash;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  int avx2    = (ebx >> 5) & 1;
+  int avx512f = (ebx >> 16) & 1;
+
+  if (avx512f && zmm_state)
+    return MICRO_HASH_BACKEND_AVX512;
+  if (avx2 && ymm_state)
+    return MICRO_HASH_BACKEND_AVX2;
+  return MICRO_HASH_BACKEND_SSE42;
+#endif // MICRO_HASH_X86
+  return MICRO_HASH_BACKEND_SCALAR;
 }
 
-unsigned long micro_hash_str_sdbm(unsigned char *str)
+#ifdef MICRO_HASH_X86
+
+// Returns: whether the CPU has the AES extension
+static int _micro_hash_detect_aesni(void)
 {
-  unsigned long hash = 0;
-  int c;
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return (ecx >> 25) & 1;
+  return 0;
+}
 
-  while ((c = *str++))
-    hash = c + (hash << 6) + (hash << 16) - hash;
+#endif // MICRO_HASH_X86
+
+int micro_hash_backend_supported(MicroHashBackend backend)
+{
+  return backend >= MICRO_HASH_BACKEND_SCALAR
+    && backend < MICRO_HASH_BACKEND_COUNT
+    && backend <= _micro_hash_detect_backend();
+}
+
+const char *micro_hash_backend_name(MicroHashBackend backend)
+{
+  switch (backend)
+  {
+  case MICRO_HASH_BACKEND_SCALAR: return "scalar";
+  case MICRO_HASH_BACKEND_SSE42:  return "sse4.2";
+  case MICRO_HASH_BACKEND_AVX2:   return "avx2";
+  case MICRO_HASH_BACKEND_AVX512: return "avx512";
+  default:                        return "unknown";
+  }
+}
+
+int micro_hash_set_backend(MicroHashBackend backend)
+{
+  if (!micro_hash_backend_supported(backend))
+    return -1;
+
+  _MicroHashDispatch dispatch;
+  dispatch.int32_wang_batch  = micro_hash_int32_wang_batch_scalar;
+  dispatch.int32_wang2_batch = micro_hash_int32_wang2_batch_scalar;
+  dispatch.int32_rob_batch   = micro_hash_int32_rob_batch_scalar;
+  dispatch.int64_wang_batch   = micro_hash_int64_wang_batch_scalar;
+  dispatch.int6432_wang_batch = micro_hash_int6432_wang_batch_scalar;
+  dispatch.bytes_crc32c = micro_hash_bytes_crc32c_scalar;
+  dispatch.int64_crc32c = micro_hash_int64_crc32c_scalar;
+  dispatch.bytes_aes = micro_hash_bytes_aes_scalar;
+
+#ifdef MICRO_HASH_X86
+  if (backend >= MICRO_HASH_BACKEND_SSE42)
+  {
+    dispatch.bytes_crc32c = micro_hash_bytes_crc32c_sse42;
+    dispatch.int64_crc32c = micro_hash_int64_crc32c_sse42;
+    if (_micro_hash_detect_aesni())
+      dispatch.bytes_aes = micro_hash_bytes_aes_aesni;
+  }
+  if (backend == MICRO_HASH_BACKEND_AVX2)
+  {
+    dispatch.int32_wang_batch  = micro_hash_int32_wang_batch_avx2;
+    dispatch.int32_wang2_batch = micro_hash_int32_wang2_batch_avx2;
+    dispatch.int32_rob_batch   = micro_hash_int32_rob_batch_avx2;
+    dispatch.int64_wang_batch   = micro_hash_int64_wang_batch_avx2;
+    dispatch.int6432_wang_batch = micro_hash_int6432_wang_batch_avx2;
+  }
+  if (backend == MICRO_HASH_BACKEND_AVX512)
+  {
+    dispatch.int32_wang_batch  = micro_hash_int32_wang_batch_avx512;
+    dispatch.int32_wang2_batch = micro_hash_int32_wang2_batch_avx512;
+    dispatch.int32_rob_batch   = micro_hash_int32_rob_batch_avx512;
+    dispatch.int64_wang_batch   = micro_hash_int64_wang_batch_avx512;
+    dispatch.int6432_wang_batch = micro_hash_int6432_wang_batch_avx512;
+  }
+#endif // MICRO_HASH_X86
+
+  _micro_hash_dispatch = dispatch;
+  _micro_hash_backend = backend;
+  return 0;
+}
+
+MicroHashBackend micro_hash_get_backend(void)
+{
+  if (_micro_hash_backend == MICRO_HASH_BACKEND_COUNT)
+  {
+    MicroHashBackend backend = _micro_hash_detect_backend();
+#ifdef MICRO_HASH_FORCE_BACKEND
+    if (micro_hash_backend_supported(MICRO_HASH_FORCE_BACKEND))
+      backend = MICRO_HASH_FORCE_BACKEND;
+#endif
+    micro_hash_set_backend(backend);
+  }
+  return _micro_hash_backend;
+}
+
+static void _micro_hash_int32_wang_batch_resolve(const uint32_t *in, uint32_t *out, size_t n)
+{
+  micro_hash_get_backend();
+  _micro_hash_dispatch.int32_wang_batch(in, out, n);
+}
+
+static void _micro_hash_int32_wang2_batch_resolve(const uint32_t *in, uint32_t *out, size_t n)
+{
+  micro_hash_get_backend();
+  _micro_hash_dispatch.int32_wang2_batch(in, out, n);
+}
+
+static void _micro_hash_int32_rob_batch_resolve(const uint32_t *in, uint32_t *out, size_t n)
+{
+  micro_hash_get_backend();
+  _micro_hash_dispatch.int32_rob_batch(in, out, n);
+}
+
+static void _micro_hash_int64_wang_batch_resolve(const uint64_t *in, uint64_t *out, size_t n)
+{
+  micro_hash_get_backend();
+  _micro_hash_dispatch.int64_wang_batch(in, out, n);
+}
+
+static void _micro_hash_int6432_wang_batch_resolve(const uint64_t *in, uint32_t *out, size_t n)
+{
+  micro_hash_get_backend();
+  _micro_hash_dispatch.int6432_wang_batch(in, out, n);
+}
+
+static uint32_t _micro_hash_bytes_crc32c_resolve(const void *key, size_t key_length)
+{
+  micro_hash_get_backend();
+  return _micro_hash_dispatch.bytes_crc32c(key, key_length);
+}
+
+static uint32_t _micro_hash_int64_crc32c_resolve(uint64_t key)
+{
+  micro_hash_get_backend();
+  return _micro_hash_dispatch.int64_crc32c(key);
+}
+
+static uint64_t _micro_hash_bytes_aes_resolve(const void *key, size_t key_length,
+                                              uint64_t seed)
+{
+  micro_hash_get_backend();
+  return _micro_hash_dispatch.bytes_aes(key, key_length, seed);
+}
+
+// Batch entry points
+
+void micro_hash_int32_wang_batch(const uint32_t *in, uint32_t *out, size_t n)
+{
+  _micro_hash_dispatch.int32_wang_batch(in, out, n);
+}
+
+void micro_hash_int32_wang2_batch(const uint32_t *in, uint32_t *out, size_t n)
+{
+  _micro_hash_dispatch.int32_wang2_batch(in, out, n);
+}
+
+void micro_hash_int32_rob_batch(const uint32_t *in, uint32_t *out, size_t n)
+{
+  _micro_hash_dispatch.int32_rob_batch(in, out, n);
+}
+
+void micro_hash_int64_wang_batch(const uint64_t *in, uint64_t *out, size_t n)
+{
+  _micro_hash_dispatch.int64_wang_batch(in, out, n);
+}
+
+void micro_hash_int6432_wang_batch(const uint64_t *in, uint32_t *out, size_t n)
+{
+  _micro_hash_dispatch.int6432_wang_batch(in, out, n);
+}
+
+// Bytes
+
+size_t micro_hash_bytes_curl(void *key, size_t key_length)
+{
+  char *key_str = (char *) key;
+  char *end = key_str + key_length;
+  size_t h = 5381;
+
+  while(key_str < end) {
+    size_t j = (size_t)*key_str++;
+    h += h << 5;
+    h ^= j;
+  }
+
+  return h;
+}
+
+// Run the curl hash over `length` bytes, starting from h
+static inline size_t _micro_hash_curl_update(size_t h,
+                                             const unsigned char *p,
+                                             size_t length)
+{
+  // One step of the curl hash. The byte is converted through `char`
+  // so that it gets sign-extended exactly like in the byte loop.
+#define CURL_STEP(h, byte)                          \
+  do {                                              \
+    h += h << 5;                                    \
+    h ^= (size_t)(char)(unsigned char)(byte);       \
+  } while(0)
+
+  const unsigned char *end = p + length;
+
+  while (end - p >= 8) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    CURL_STEP(h, w >> 56);
+    CURL_STEP(h, w >> 48);
+    CURL_STEP(h, w >> 40);
+    CURL_STEP(h, w >> 32);
+    CURL_STEP(h, w >> 24);
+    CURL_STEP(h, w >> 16);
+    CURL_STEP(h, w >> 8);
+    CURL_STEP(h, w);
+#else
+    CURL_STEP(h, w);
+    CURL_STEP(h, w >> 8);
+    CURL_STEP(h, w >> 16);
+    CURL_STEP(h, w >> 24);
+    CURL_STEP(h, w >> 32);
+    CURL_STEP(h, w >> 40);
+    CURL_STEP(h, w >> 48);
+    CURL_STEP(h, w >> 56);
+#endif
+    p += 8;
+  }
+
+  while (p < end)
+    CURL_STEP(h, *p++);
+
+  return h;
+
+#undef CURL_STEP
+}
+
+size_t micro_hash_bytes_curl_wide(const void *key, size_t key_length)
+{
+  return _micro_hash_curl_update(5381, (const unsigned char *) key,
+                                 key_length);
+}
+
+void micro_hash_bytes_curl_init(MicroHashCurlState *state)
+{
+  state->hash = 5381;
+}
+
+void micro_hash_bytes_curl_update(MicroHashCurlState *state,
+                                  const void *data, size_t length)
+{
+  state->hash = _micro_hash_curl_update(state->hash,
+                                        (const unsigned char *) data, length);
+}
+
+size_t micro_hash_bytes_curl_final(const MicroHashCurlState *state)
+{
+  return state->hash;
+}
+
+static inline uint32_t _micro_hash_jenkins_update(uint32_t hash,
+                                                  const uint8_t *key,
+                                                  size_t length)
+{
+  size_t i = 0;
+  while (i != length) {
+    hash += key[i++];
+    hash += hash << 10;
+    hash ^= hash >> 6;
+  }
+  return hash;
+}
+
+static inline uint32_t _micro_hash_jenkins_final(uint32_t hash)
+{
+  hash += hash << 3;
+  hash ^= hash >> 11;
+  hash += hash << 15;
+  return hash;
+}
+
+uint32_t micro_hash_bytes_jenkins(uint8_t* key, size_t length)
+{
+  return _micro_hash_jenkins_final(_micro_hash_jenkins_update(0, key, length));
+}
+
+void micro_hash_bytes_jenkins_init(MicroHashJenkinsState *state)
+{
+  state->hash = 0;
+}
+
+void micro_hash_bytes_jenkins_update(MicroHashJenkinsState *state,
+                                     const void *data, size_t length)
+{
+  state->hash = _micro_hash_jenkins_update(state->hash,
+                                           (const uint8_t *) data, length);
+}
+
+uint32_t micro_hash_bytes_jenkins_final(const MicroHashJenkinsState *state)
+{
+  return _micro_hash_jenkins_final(state->hash);
+}
+
+#define MICRO_HASH_XXH64_PRIME1 0x9E3779B185EBCA87ULL
+#define MICRO_HASH_XXH64_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define MICRO_HASH_XXH64_PRIME3 0x165667B19E3779F9ULL
+#define MICRO_HASH_XXH64_PRIME4 0x85EBCA77C2B2AE63ULL
+#define MICRO_HASH_XXH64_PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t _micro_hash_rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+// Read a little endian 64 bit integer from unaligned memory
+static inline uint64_t _micro_hash_read64(const unsigned char *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+// Read a little endian 32 bit integer from unaligned memory
+static inline uint32_t _micro_hash_read32(const unsigned char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);
+#endif
+  return v;
+}
+
+static inline uint64_t _micro_hash_xxh64_round(uint64_t acc, uint64_t input)
+{
+  acc += input * MICRO_HASH_XXH64_PRIME2;
+  acc = _micro_hash_rotl64(acc, 31);
+  acc *= MICRO_HASH_XXH64_PRIME1;
+  return acc;
+}
+
+static inline uint64_t _micro_hash_xxh64_merge(uint64_t acc, uint64_t val)
+{
+  acc ^= _micro_hash_xxh64_round(0, val);
+  return acc * MICRO_HASH_XXH64_PRIME1 + MICRO_HASH_XXH64_PRIME4;
+}
+
+// Hash one 32 bytes stripe, 8 bytes per accumulator
+static inline void _micro_hash_xxh64_stripe(uint64_t acc[4],
+                                            const unsigned char *p)
+{
+  acc[0] = _micro_hash_xxh64_round(acc[0], _micro_hash_read64(p));
+  acc[1] = _micro_hash_xxh64_round(acc[1], _micro_hash_read64(p + 8));
+  acc[2] = _micro_hash_xxh64_round(acc[2], _micro_hash_read64(p + 16));
+  acc[3] = _micro_hash_xxh64_round(acc[3], _micro_hash_read64(p + 24));
+}
+
+static inline void _micro_hash_xxh64_reset(uint64_t acc[4], uint64_t seed)
+{
+  acc[0] = seed + MICRO_HASH_XXH64_PRIME1 + MICRO_HASH_XXH64_PRIME2;
+  acc[1] = seed + MICRO_HASH_XXH64_PRIME2;
+  acc[2] = seed;
+  acc[3] = seed - MICRO_HASH_XXH64_PRIME1;
+}
+
+// Merge the 4 accumulators of the stripe loop into a single value
+static inline uint64_t _micro_hash_xxh64_converge(const uint64_t acc[4])
+{
+  uint64_t h = _micro_hash_rotl64(acc[0], 1) + _micro_hash_rotl64(acc[1], 7)
+             + _micro_hash_rotl64(acc[2], 12) + _micro_hash_rotl64(acc[3], 18);
+  h = _micro_hash_xxh64_merge(h, acc[0]);
+  h = _micro_hash_xxh64_merge(h, acc[1]);
+  h = _micro_hash_xxh64_merge(h, acc[2]);
+  h = _micro_hash_xxh64_merge(h, acc[3]);
+  return h;
+}
+
+// Hash the last (less than 32) bytes and avalanche the result
+static inline uint64_t _micro_hash_xxh64_finalize(uint64_t h,
+                                                  const unsigned char *p,
+                                                  size_t length)
+{
+  while (length >= 8) {
+    h ^= _micro_hash_xxh64_round(0, _micro_hash_read64(p));
+    h = _micro_hash_rotl64(h, 27) * MICRO_HASH_XXH64_PRIME1
+      + MICRO_HASH_XXH64_PRIME4;
+    p += 8;
+    length -= 8;
+  }
+  if (length >= 4) {
+    h ^= (uint64_t)_micro_hash_read32(p) * MICRO_HASH_XXH64_PRIME1;
+    h = _micro_hash_rotl64(h, 23) * MICRO_HASH_XXH64_PRIME2
+      + MICRO_HASH_XXH64_PRIME3;
+    p += 4;
+    length -= 4;
+  }
+  while (length > 0) {
+    h ^= (*p++) * MICRO_HASH_XXH64_PRIME5;
+    h = _micro_hash_rotl64(h, 11) * MICRO_HASH_XXH64_PRIME1;
+    length--;
+  }
+
+  h ^= h >> 33;
+  h *= MICRO_HASH_XXH64_PRIME2;
+  h ^= h >> 29;
+  h *= MICRO_HASH_XXH64_PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t micro_hash_bytes_xxh64(const void *key, size_t key_length,
+                                uint64_t seed)
+{
+  const unsigned char *p = (const unsigned char *) key;
+  size_t length = key_length;
+  uint64_t h;
+
+  if (length >= 32) {
+    uint64_t acc[4];
+    _micro_hash_xxh64_reset(acc, seed);
+    do {
+      _micro_hash_xxh64_stripe(acc, p);
+      p += 32;
+      length -= 32;
+    } while (length >= 32);
+    h = _micro_hash_xxh64_converge(acc);
+  } else {
+    h = seed + MICRO_HASH_XXH64_PRIME5;
+  }
+
+  h += (uint64_t) key_length;
+  return _micro_hash_xxh64_finalize(h, p, length);
+}
+
+void micro_hash_bytes_xxh64_init(MicroHashXxh64State *state, uint64_t seed)
+{
+  _micro_hash_xxh64_reset(state->acc, seed);
+  state->seed = seed;
+  state->total_length = 0;
+  state->buffered = 0;
+}
+
+void micro_hash_bytes_xxh64_update(MicroHashXxh64State *state,
+                                   const void *data, size_t length)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  state->total_length += length;
+
+  if (state->buffered + length < 32) {
+    if (length > 0)
+      memcpy(state->buffer + state->buffered, p, length);
+    state->buffered += length;
+    return;
+  }
+
+  // Complete the buffered stripe first
+  if (state->buffered > 0) {
+    size_t missing = 32 - state->buffered;
+    memcpy(state->buffer + state->buffered, p, missing);
+    _micro_hash_xxh64_stripe(state->acc, state->buffer);
+    p += missing;
+    length -= missing;
+    state->buffered = 0;
+  }
+
+  // Stripes in the new data are hashed in place
+  while (length >= 32) {
+    _micro_hash_xxh64_stripe(state->acc, p);
+    p += 32;
+    length -= 32;
+  }
+
+  if (length > 0)
+    memcpy(state->buffer, p, length);
+  state->buffered = length;
+}
+
+uint64_t micro_hash_bytes_xxh64_final(const MicroHashXxh64State *state)
+{
+  uint64_t h;
+  if (state->total_length >= 32)
+    h = _micro_hash_xxh64_converge(state->acc);
+  else
+    h = state->seed + MICRO_HASH_XXH64_PRIME5;
+
+  h += state->total_length;
+  return _micro_hash_xxh64_finalize(h, state->buffer, state->buffered);
+}
+
+#ifdef MICRO_HASH_IOV
+
+size_t micro_hash_bytes_curl_iov(const struct iovec *iov, int iovcnt)
+{
+  size_t h = 5381;
+  for (int i = 0; i < iovcnt; ++i)
+    h = _micro_hash_curl_update(h, (const unsigned char *) iov[i].iov_base,
+                                iov[i].iov_len);
+  return h;
+}
+
+uint32_t micro_hash_bytes_jenkins_iov(const struct iovec *iov, int iovcnt)
+{
+  uint32_t hash = 0;
+  for (int i = 0; i < iovcnt; ++i)
+    hash = _micro_hash_jenkins_update(hash, (const uint8_t *) iov[i].iov_base,
+                                      iov[i].iov_len);
+  return _micro_hash_jenkins_final(hash);
+}
+
+uint64_t micro_hash_bytes_xxh64_iov(const struct iovec *iov, int iovcnt,
+                                    uint64_t seed)
+{
+  uint64_t acc[4];
+  uint64_t total_length = 0;
+  unsigned char carry[32];  // Stripe split across buffers
+  size_t carried = 0;
+  _micro_hash_xxh64_reset(acc, seed);
+
+  for (int i = 0; i < iovcnt; ++i) {
+    const unsigned char *p = (const unsigned char *) iov[i].iov_base;
+    size_t length = iov[i].iov_len;
+    total_length += length;
+
+    if (carried > 0) {
+      size_t n = 32 - carried;
+      if (n > length)
+        n = length;
+      if (n > 0)
+        memcpy(carry + carried, p, n);
+      carried += n;
+      p += n;
+      length -= n;
+      if (carried < 32)
+        continue;
+      _micro_hash_xxh64_stripe(acc, carry);
+      carried = 0;
+    }
+
+    while (length >= 32) {
+      _micro_hash_xxh64_stripe(acc, p);
+      p += 32;
+      length -= 32;
+    }
+
+    if (length > 0)
+      memcpy(carry, p, length);
+    carried = length;
+  }
+
+  uint64_t h;
+  if (total_length >= 32)
+    h = _micro_hash_xxh64_converge(acc);
+  else
+    h = seed + MICRO_HASH_XXH64_PRIME5;
+
+  h += total_length;
+  return _micro_hash_xxh64_finalize(h, carry, carried);
+}
+
+#endif // MICRO_HASH_IOV
+
+// CRC32C
+
+// Reversed Castagnoli polynomial
+#define MICRO_HASH_CRC32C_POLY 0x82F63B78
+
+// Bytes hashed by each of the three streams of the SSE4.2 kernel
+#define MICRO_HASH_CRC32C_LONG  8192
+#define MICRO_HASH_CRC32C_SHORT 256
+
+// The tables are precomputed from the reversed polynomial instead of
+// being built on first use, so that threads can share them without
+// any synchronization.
+//
+// Slicing-by-8 tables, table[k][n] is the CRC of byte n followed by
+// k zero bytes
+static const uint32_t _micro_hash_crc32c_table[8][256] = {
+  {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+  },
+  {
+    0x00000000, 0x13a29877, 0x274530ee, 0x34e7a899, 0x4e8a61dc, 0x5d28f9ab,
+    0x69cf5132, 0x7a6dc945, 0x9d14c3b8, 0x8eb65bcf, 0xba51f356, 0xa9f36b21,
+    0xd39ea264, 0xc03c3a13, 0xf4db928a, 0xe7790afd, 0x3fc5f181, 0x2c6769f6,
+    0x1880c16f, 0x0b225918, 0x714f905d, 0x62ed082a, 0x560aa0b3, 0x45a838c4,
+    0xa2d13239, 0xb173aa4e, 0x859402d7, 0x96369aa0, 0xec5b53e5, 0xfff9cb92,
+    0xcb1e630b, 0xd8bcfb7c, 0x7f8be302, 0x6c297b75, 0x58ced3ec, 0x4b6c4b9b,
+    0x310182de, 0x22a31aa9, 0x1644b230, 0x05e62a47, 0xe29f20ba, 0xf13db8cd,
+    0xc5da1054, 0xd6788823, 0xac154166, 0xbfb7d911, 0x8b507188, 0x98f2e9ff,
+    0x404e1283, 0x53ec8af4, 0x670b226d, 0x74a9ba1a, 0x0ec4735f, 0x1d66eb28,
+    0x298143b1, 0x3a23dbc6, 0xdd5ad13b, 0xcef8494c, 0xfa1fe1d5, 0xe9bd79a2,
+    0x93d0b0e7, 0x80722890, 0xb4958009, 0xa737187e, 0xff17c604, 0xecb55e73,
+    0xd852f6ea, 0xcbf06e9d, 0xb19da7d8, 0xa23f3faf, 0x96d89736, 0x857a0f41,
+    0x620305bc, 0x71a19dcb, 0x45463552, 0x56e4ad25, 0x2c896460, 0x3f2bfc17,
+    0x0bcc548e, 0x186eccf9, 0xc0d23785, 0xd370aff2, 0xe797076b, 0xf4359f1c,
+    0x8e585659, 0x9dface2e, 0xa91d66b7, 0xbabffec0, 0x5dc6f43d, 0x4e646c4a,
+    0x7a83c4d3, 0x69215ca4, 0x134c95e1, 0x00ee0d96, 0x3409a50f, 0x27ab3d78,
+    0x809c2506, 0x933ebd71, 0xa7d915e8, 0xb47b8d9f, 0xce1644da, 0xddb4dcad,
+    0xe9537434, 0xfaf1ec43, 0x1d88e6be, 0x0e2a7ec9, 0x3acdd650, 0x296f4e27,
+    0x53028762, 0x40a01f15, 0x7447b78c, 0x67e52ffb, 0xbf59d487, 0xacfb4cf0,
+    0x981ce469, 0x8bbe7c1e, 0xf1d3b55b, 0xe2712d2c, 0xd69685b5, 0xc5341dc2,
+    0x224d173f, 0x31ef8f48, 0x050827d1, 0x16aabfa6, 0x6cc776e3, 0x7f65ee94,
+    0x4b82460d, 0x5820de7a, 0xfbc3faf9, 0xe861628e, 0xdc86ca17, 0xcf245260,
+    0xb5499b25, 0xa6eb0352, 0x920cabcb, 0x81ae33bc, 0x66d73941, 0x7575a136,
+    0x419209af, 0x523091d8, 0x285d589d, 0x3bffc0ea, 0x0f186873, 0x1cbaf004,
+    0xc4060b78, 0xd7a4930f, 0xe3433b96, 0xf0e1a3e1, 0x8a8c6aa4, 0x992ef2d3,
+    0xadc95a4a, 0xbe6bc23d, 0x5912c8c0, 0x4ab050b7, 0x7e57f82e, 0x6df56059,
+    0x1798a91c, 0x043a316b, 0x30dd99f2, 0x237f0185, 0x844819fb, 0x97ea818c,
+    0xa30d2915, 0xb0afb162, 0xcac27827, 0xd960e050, 0xed8748c9, 0xfe25d0be,
+    0x195cda43, 0x0afe4234, 0x3e19eaad, 0x2dbb72da, 0x57d6bb9f, 0x447423e8,
+    0x70938b71, 0x63311306, 0xbb8de87a, 0xa82f700d, 0x9cc8d894, 0x8f6a40e3,
+    0xf50789a6, 0xe6a511d1, 0xd242b948, 0xc1e0213f, 0x26992bc2, 0x353bb3b5,
+    0x01dc1b2c, 0x127e835b, 0x68134a1e, 0x7bb1d269, 0x4f567af0, 0x5cf4e287,
+    0x04d43cfd, 0x1776a48a, 0x23910c13, 0x30339464, 0x4a5e5d21, 0x59fcc556,
+    0x6d1b6dcf, 0x7eb9f5b8, 0x99c0ff45, 0x8a626732, 0xbe85cfab, 0xad2757dc,
+    0xd74a9e99, 0xc4e806ee, 0xf00fae77, 0xe3ad3600, 0x3b11cd7c, 0x28b3550b,
+    0x1c54fd92, 0x0ff665e5, 0x759baca0, 0x663934d7, 0x52de9c4e, 0x417c0439,
+    0xa6050ec4, 0xb5a796b3, 0x81403e2a, 0x92e2a65d, 0xe88f6f18, 0xfb2df76f,
+    0xcfca5ff6, 0xdc68c781, 0x7b5fdfff, 0x68fd4788, 0x5c1aef11, 0x4fb87766,
+    0x35d5be23, 0x26772654, 0x12908ecd, 0x013216ba, 0xe64b1c47, 0xf5e98430,
+    0xc10e2ca9, 0xd2acb4de, 0xa8c17d9b, 0xbb63e5ec, 0x8f844d75, 0x9c26d502,
+    0x449a2e7e, 0x5738b609, 0x63df1e90, 0x707d86e7, 0x0a104fa2, 0x19b2d7d5,
+    0x2d557f4c, 0x3ef7e73b, 0xd98eedc6, 0xca2c75b1, 0xfecbdd28, 0xed69455f,
+    0x97048c1a, 0x84a6146d, 0xb041bcf4, 0xa3e32483
+  },
+  {
+    0x00000000, 0xa541927e, 0x4f6f520d, 0xea2ec073, 0x9edea41a, 0x3b9f3664,
+    0xd1b1f617, 0x74f06469, 0x38513ec5, 0x9d10acbb, 0x773e6cc8, 0xd27ffeb6,
+    0xa68f9adf, 0x03ce08a1, 0xe9e0c8d2, 0x4ca15aac, 0x70a27d8a, 0xd5e3eff4,
+    0x3fcd2f87, 0x9a8cbdf9, 0xee7cd990, 0x4b3d4bee, 0xa1138b9d, 0x045219e3,
+    0x48f3434f, 0xedb2d131, 0x079c1142, 0xa2dd833c, 0xd62de755, 0x736c752b,
+    0x9942b558, 0x3c032726, 0xe144fb14, 0x4405696a, 0xae2ba919, 0x0b6a3b67,
+    0x7f9a5f0e, 0xdadbcd70, 0x30f50d03, 0x95b49f7d, 0xd915c5d1, 0x7c5457af,
+    0x967a97dc, 0x333b05a2, 0x47cb61cb, 0xe28af3b5, 0x08a433c6, 0xade5a1b8,
+    0x91e6869e, 0x34a714e0, 0xde89d493, 0x7bc846ed, 0x0f382284, 0xaa79b0fa,
+    0x40577089, 0xe516e2f7, 0xa9b7b85b, 0x0cf62a25, 0xe6d8ea56, 0x43997828,
+    0x37691c41, 0x92288e3f, 0x78064e4c, 0xdd47dc32, 0xc76580d9, 0x622412a7,
+    0x880ad2d4, 0x2d4b40aa, 0x59bb24c3, 0xfcfab6bd, 0x16d476ce, 0xb395e4b0,
+    0xff34be1c, 0x5a752c62, 0xb05bec11, 0x151a7e6f, 0x61ea1a06, 0xc4ab8878,
+    0x2e85480b, 0x8bc4da75, 0xb7c7fd53, 0x12866f2d, 0xf8a8af5e, 0x5de93d20,
+    0x29195949, 0x8c58cb37, 0x66760b44, 0xc337993a, 0x8f96c396, 0x2ad751e8,
+    0xc0f9919b, 0x65b803e5, 0x1148678c, 0xb409f5f2, 0x5e273581, 0xfb66a7ff,
+    0x26217bcd, 0x8360e9b3, 0x694e29c0, 0xcc0fbbbe, 0xb8ffdfd7, 0x1dbe4da9,
+    0xf7908dda, 0x52d11fa4, 0x1e704508, 0xbb31d776, 0x511f1705, 0xf45e857b,
+    0x80aee112, 0x25ef736c, 0xcfc1b31f, 0x6a802161, 0x56830647, 0xf3c29439,
+    0x19ec544a, 0xbcadc634, 0xc85da25d, 0x6d1c3023, 0x8732f050, 0x2273622e,
+    0x6ed23882, 0xcb93aafc, 0x21bd6a8f, 0x84fcf8f1, 0xf00c9c98, 0x554d0ee6,
+    0xbf63ce95, 0x1a225ceb, 0x8b277743, 0x2e66e53d, 0xc448254e, 0x6109b730,
+    0x15f9d359, 0xb0b84127, 0x5a968154, 0xffd7132a, 0xb3764986, 0x1637dbf8,
+    0xfc191b8b, 0x595889f5, 0x2da8ed9c, 0x88e97fe2, 0x62c7bf91, 0xc7862def,
+    0xfb850ac9, 0x5ec498b7, 0xb4ea58c4, 0x11abcaba, 0x655baed3, 0xc01a3cad,
+    0x2a34fcde, 0x8f756ea0, 0xc3d4340c, 0x6695a672, 0x8cbb6601, 0x29faf47f,
+    0x5d0a9016, 0xf84b0268, 0x1265c21b, 0xb7245065, 0x6a638c57, 0xcf221e29,
+    0x250cde5a, 0x804d4c24, 0xf4bd284d, 0x51fcba33, 0xbbd27a40, 0x1e93e83e,
+    0x5232b292, 0xf77320ec, 0x1d5de09f, 0xb81c72e1, 0xccec1688, 0x69ad84f6,
+    0x83834485, 0x26c2d6fb, 0x1ac1f1dd, 0xbf8063a3, 0x55aea3d0, 0xf0ef31ae,
+    0x841f55c7, 0x215ec7b9, 0xcb7007ca, 0x6e3195b4, 0x2290cf18, 0x87d15d66,
+    0x6dff9d15, 0xc8be0f6b, 0xbc4e6b02, 0x190ff97c, 0xf321390f, 0x5660ab71,
+    0x4c42f79a, 0xe90365e4, 0x032da597, 0xa66c37e9, 0xd29c5380, 0x77ddc1fe,
+    0x9df3018d, 0x38b293f3, 0x7413c95f, 0xd1525b21, 0x3b7c9b52, 0x9e3d092c,
+    0xeacd6d45, 0x4f8cff3b, 0xa5a23f48, 0x00e3ad36, 0x3ce08a10, 0x99a1186e,
+    0x738fd81d, 0xd6ce4a63, 0xa23e2e0a, 0x077fbc74, 0xed517c07, 0x4810ee79,
+    0x04b1b4d5, 0xa1f026ab, 0x4bdee6d8, 0xee9f74a6, 0x9a6f10cf, 0x3f2e82b1,
+    0xd50042c2, 0x7041d0bc, 0xad060c8e, 0x08479ef0, 0xe2695e83, 0x4728ccfd,
+    0x33d8a894, 0x96993aea, 0x7cb7fa99, 0xd9f668e7, 0x9557324b, 0x3016a035,
+    0xda386046, 0x7f79f238, 0x0b899651, 0xaec8042f, 0x44e6c45c, 0xe1a75622,
+    0xdda47104, 0x78e5e37a, 0x92cb2309, 0x378ab177, 0x437ad51e, 0xe63b4760,
+    0x0c158713, 0xa954156d, 0xe5f54fc1, 0x40b4ddbf, 0xaa9a1dcc, 0x0fdb8fb2,
+    0x7b2bebdb, 0xde6a79a5, 0x3444b9d6, 0x91052ba8
+  },
+  {
+    0x00000000, 0xdd45aab8, 0xbf672381, 0x62228939, 0x7b2231f3, 0xa6679b4b,
+    0xc4451272, 0x1900b8ca, 0xf64463e6, 0x2b01c95e, 0x49234067, 0x9466eadf,
+    0x8d665215, 0x5023f8ad, 0x32017194, 0xef44db2c, 0xe964b13d, 0x34211b85,
+    0x560392bc, 0x8b463804, 0x924680ce, 0x4f032a76, 0x2d21a34f, 0xf06409f7,
+    0x1f20d2db, 0xc2657863, 0xa047f15a, 0x7d025be2, 0x6402e328, 0xb9474990,
+    0xdb65c0a9, 0x06206a11, 0xd725148b, 0x0a60be33, 0x6842370a, 0xb5079db2,
+    0xac072578, 0x71428fc0, 0x136006f9, 0xce25ac41, 0x2161776d, 0xfc24ddd5,
+    0x9e0654ec, 0x4343fe54, 0x5a43469e, 0x8706ec26, 0xe524651f, 0x3861cfa7,
+    0x3e41a5b6, 0xe3040f0e, 0x81268637, 0x5c632c8f, 0x45639445, 0x98263efd,
+    0xfa04b7c4, 0x27411d7c, 0xc805c650, 0x15406ce8, 0x7762e5d1, 0xaa274f69,
+    0xb327f7a3, 0x6e625d1b, 0x0c40d422, 0xd1057e9a, 0xaba65fe7, 0x76e3f55f,
+    0x14c17c66, 0xc984d6de, 0xd0846e14, 0x0dc1c4ac, 0x6fe34d95, 0xb2a6e72d,
+    0x5de23c01, 0x80a796b9, 0xe2851f80, 0x3fc0b538, 0x26c00df2, 0xfb85a74a,
+    0x99a72e73, 0x44e284cb, 0x42c2eeda, 0x9f874462, 0xfda5cd5b, 0x20e067e3,
+    0x39e0df29, 0xe4a57591, 0x8687fca8, 0x5bc25610, 0xb4868d3c, 0x69c32784,
+    0x0be1aebd, 0xd6a40405, 0xcfa4bccf, 0x12e11677, 0x70c39f4e, 0xad8635f6,
+    0x7c834b6c, 0xa1c6e1d4, 0xc3e468ed, 0x1ea1c255, 0x07a17a9f, 0xdae4d027,
+    0xb8c6591e, 0x6583f3a6, 0x8ac7288a, 0x57828232, 0x35a00b0b, 0xe8e5a1b3,
+    0xf1e51979, 0x2ca0b3c1, 0x4e823af8, 0x93c79040, 0x95e7fa51, 0x48a250e9,
+    0x2a80d9d0, 0xf7c57368, 0xeec5cba2, 0x3380611a, 0x51a2e823, 0x8ce7429b,
+    0x63a399b7, 0xbee6330f, 0xdcc4ba36, 0x0181108e, 0x1881a844, 0xc5c402fc,
+    0xa7e68bc5, 0x7aa3217d, 0x52a0c93f, 0x8fe56387, 0xedc7eabe, 0x30824006,
+    0x2982f8cc, 0xf4c75274, 0x96e5db4d, 0x4ba071f5, 0xa4e4aad9, 0x79a10061,
+    0x1b838958, 0xc6c623e0, 0xdfc69b2a, 0x02833192, 0x60a1b8ab, 0xbde41213,
+    0xbbc47802, 0x6681d2ba, 0x04a35b83, 0xd9e6f13b, 0xc0e649f1, 0x1da3e349,
+    0x7f816a70, 0xa2c4c0c8, 0x4d801be4, 0x90c5b15c, 0xf2e73865, 0x2fa292dd,
+    0x36a22a17, 0xebe780af, 0x89c50996, 0x5480a32e, 0x8585ddb4, 0x58c0770c,
+    0x3ae2fe35, 0xe7a7548d, 0xfea7ec47, 0x23e246ff, 0x41c0cfc6, 0x9c85657e,
+    0x73c1be52, 0xae8414ea, 0xcca69dd3, 0x11e3376b, 0x08e38fa1, 0xd5a62519,
+    0xb784ac20, 0x6ac10698, 0x6ce16c89, 0xb1a4c631, 0xd3864f08, 0x0ec3e5b0,
+    0x17c35d7a, 0xca86f7c2, 0xa8a47efb, 0x75e1d443, 0x9aa50f6f, 0x47e0a5d7,
+    0x25c22cee, 0xf8878656, 0xe1873e9c, 0x3cc29424, 0x5ee01d1d, 0x83a5b7a5,
+    0xf90696d8, 0x24433c60, 0x4661b559, 0x9b241fe1, 0x8224a72b, 0x5f610d93,
+    0x3d4384aa, 0xe0062e12, 0x0f42f53e, 0xd2075f86, 0xb025d6bf, 0x6d607c07,
+    0x7460c4cd, 0xa9256e75, 0xcb07e74c, 0x16424df4, 0x106227e5, 0xcd278d5d,
+    0xaf050464, 0x7240aedc, 0x6b401616, 0xb605bcae, 0xd4273597, 0x09629f2f,
+    0xe6264403, 0x3b63eebb, 0x59416782, 0x8404cd3a, 0x9d0475f0, 0x4041df48,
+    0x22635671, 0xff26fcc9, 0x2e238253, 0xf36628eb, 0x9144a1d2, 0x4c010b6a,
+    0x5501b3a0, 0x88441918, 0xea669021, 0x37233a99, 0xd867e1b5, 0x05224b0d,
+    0x6700c234, 0xba45688c, 0xa345d046, 0x7e007afe, 0x1c22f3c7, 0xc167597f,
+    0xc747336e, 0x1a0299d6, 0x782010ef, 0xa565ba57, 0xbc65029d, 0x6120a825,
+    0x0302211c, 0xde478ba4, 0x31035088, 0xec46fa30, 0x8e647309, 0x5321d9b1,
+    0x4a21617b, 0x9764cbc3, 0xf54642fa, 0x2803e842
+  },
+  {
+    0x00000000, 0x38116fac, 0x7022df58, 0x4833b0f4, 0xe045beb0, 0xd854d11c,
+    0x906761e8, 0xa8760e44, 0xc5670b91, 0xfd76643d, 0xb545d4c9, 0x8d54bb65,
+    0x2522b521, 0x1d33da8d, 0x55006a79, 0x6d1105d5, 0x8f2261d3, 0xb7330e7f,
+    0xff00be8b, 0xc711d127, 0x6f67df63, 0x5776b0cf, 0x1f45003b, 0x27546f97,
+    0x4a456a42, 0x725405ee, 0x3a67b51a, 0x0276dab6, 0xaa00d4f2, 0x9211bb5e,
+    0xda220baa, 0xe2336406, 0x1ba8b557, 0x23b9dafb, 0x6b8a6a0f, 0x539b05a3,
+    0xfbed0be7, 0xc3fc644b, 0x8bcfd4bf, 0xb3debb13, 0xdecfbec6, 0xe6ded16a,
+    0xaeed619e, 0x96fc0e32, 0x3e8a0076, 0x069b6fda, 0x4ea8df2e, 0x76b9b082,
+    0x948ad484, 0xac9bbb28, 0xe4a80bdc, 0xdcb96470, 0x74cf6a34, 0x4cde0598,
+    0x04edb56c, 0x3cfcdac0, 0x51eddf15, 0x69fcb0b9, 0x21cf004d, 0x19de6fe1,
+    0xb1a861a5, 0x89b90e09, 0xc18abefd, 0xf99bd151, 0x37516aae, 0x0f400502,
+    0x4773b5f6, 0x7f62da5a, 0xd714d41e, 0xef05bbb2, 0xa7360b46, 0x9f2764ea,
+    0xf236613f, 0xca270e93, 0x8214be67, 0xba05d1cb, 0x1273df8f, 0x2a62b023,
+    0x625100d7, 0x5a406f7b, 0xb8730b7d, 0x806264d1, 0xc851d425, 0xf040bb89,
+    0x5836b5cd, 0x6027da61, 0x28146a95, 0x10050539, 0x7d1400ec, 0x45056f40,
+    0x0d36dfb4, 0x3527b018, 0x9d51be5c, 0xa540d1f0, 0xed736104, 0xd5620ea8,
+    0x2cf9dff9, 0x14e8b055, 0x5cdb00a1, 0x64ca6f0d, 0xccbc6149, 0xf4ad0ee5,
+    0xbc9ebe11, 0x848fd1bd, 0xe99ed468, 0xd18fbbc4, 0x99bc0b30, 0xa1ad649c,
+    0x09db6ad8, 0x31ca0574, 0x79f9b580, 0x41e8da2c, 0xa3dbbe2a, 0x9bcad186,
+    0xd3f96172, 0xebe80ede, 0x439e009a, 0x7b8f6f36, 0x33bcdfc2, 0x0badb06e,
+    0x66bcb5bb, 0x5eadda17, 0x169e6ae3, 0x2e8f054f, 0x86f90b0b, 0xbee864a7,
+    0xf6dbd453, 0xcecabbff, 0x6ea2d55c, 0x56b3baf0, 0x1e800a04, 0x269165a8,
+    0x8ee76bec, 0xb6f60440, 0xfec5b4b4, 0xc6d4db18, 0xabc5decd, 0x93d4b161,
+    0xdbe70195, 0xe3f66e39, 0x4b80607d, 0x73910fd1, 0x3ba2bf25, 0x03b3d089,
+    0xe180b48f, 0xd991db23, 0x91a26bd7, 0xa9b3047b, 0x01c50a3f, 0x39d46593,
+    0x71e7d567, 0x49f6bacb, 0x24e7bf1e, 0x1cf6d0b2, 0x54c56046, 0x6cd40fea,
+    0xc4a201ae, 0xfcb36e02, 0xb480def6, 0x8c91b15a, 0x750a600b, 0x4d1b0fa7,
+    0x0528bf53, 0x3d39d0ff, 0x954fdebb, 0xad5eb117, 0xe56d01e3, 0xdd7c6e4f,
+    0xb06d6b9a, 0x887c0436, 0xc04fb4c2, 0xf85edb6e, 0x5028d52a, 0x6839ba86,
+    0x200a0a72, 0x181b65de, 0xfa2801d8, 0xc2396e74, 0x8a0ade80, 0xb21bb12c,
+    0x1a6dbf68, 0x227cd0c4, 0x6a4f6030, 0x525e0f9c, 0x3f4f0a49, 0x075e65e5,
+    0x4f6dd511, 0x777cbabd, 0xdf0ab4f9, 0xe71bdb55, 0xaf286ba1, 0x9739040d,
+    0x59f3bff2, 0x61e2d05e, 0x29d160aa, 0x11c00f06, 0xb9b60142, 0x81a76eee,
+    0xc994de1a, 0xf185b1b6, 0x9c94b463, 0xa485dbcf, 0xecb66b3b, 0xd4a70497,
+    0x7cd10ad3, 0x44c0657f, 0x0cf3d58b, 0x34e2ba27, 0xd6d1de21, 0xeec0b18d,
+    0xa6f30179, 0x9ee26ed5, 0x36946091, 0x0e850f3d, 0x46b6bfc9, 0x7ea7d065,
+    0x13b6d5b0, 0x2ba7ba1c, 0x63940ae8, 0x5b856544, 0xf3f36b00, 0xcbe204ac,
+    0x83d1b458, 0xbbc0dbf4, 0x425b0aa5, 0x7a4a6509, 0x3279d5fd, 0x0a68ba51,
+    0xa21eb415, 0x9a0fdbb9, 0xd23c6b4d, 0xea2d04e1, 0x873c0134, 0xbf2d6e98,
+    0xf71ede6c, 0xcf0fb1c0, 0x6779bf84, 0x5f68d028, 0x175b60dc, 0x2f4a0f70,
+    0xcd796b76, 0xf56804da, 0xbd5bb42e, 0x854adb82, 0x2d3cd5c6, 0x152dba6a,
+    0x5d1e0a9e, 0x650f6532, 0x081e60e7, 0x300f0f4b, 0x783cbfbf, 0x402dd013,
+    0xe85bde57, 0xd04ab1fb, 0x9879010f, 0xa0686ea3
+  },
+  {
+    0x00000000, 0xef306b19, 0xdb8ca0c3, 0x34bccbda, 0xb2f53777, 0x5dc55c6e,
+    0x697997b4, 0x8649fcad, 0x6006181f, 0x8f367306, 0xbb8ab8dc, 0x54bad3c5,
+    0xd2f32f68, 0x3dc34471, 0x097f8fab, 0xe64fe4b2, 0xc00c303e, 0x2f3c5b27,
+    0x1b8090fd, 0xf4b0fbe4, 0x72f90749, 0x9dc96c50, 0xa975a78a, 0x4645cc93,
+    0xa00a2821, 0x4f3a4338, 0x7b8688e2, 0x94b6e3fb, 0x12ff1f56, 0xfdcf744f,
+    0xc973bf95, 0x2643d48c, 0x85f4168d, 0x6ac47d94, 0x5e78b64e, 0xb148dd57,
+    0x370121fa, 0xd8314ae3, 0xec8d8139, 0x03bdea20, 0xe5f20e92, 0x0ac2658b,
+    0x3e7eae51, 0xd14ec548, 0x570739e5, 0xb83752fc, 0x8c8b9926, 0x63bbf23f,
+    0x45f826b3, 0xaac84daa, 0x9e748670, 0x7144ed69, 0xf70d11c4, 0x183d7add,
+    0x2c81b107, 0xc3b1da1e, 0x25fe3eac, 0xcace55b5, 0xfe729e6f, 0x1142f576,
+    0x970b09db, 0x783b62c2, 0x4c87a918, 0xa3b7c201, 0x0e045beb, 0xe13430f2,
+    0xd588fb28, 0x3ab89031, 0xbcf16c9c, 0x53c10785, 0x677dcc5f, 0x884da746,
+    0x6e0243f4, 0x813228ed, 0xb58ee337, 0x5abe882e, 0xdcf77483, 0x33c71f9a,
+    0x077bd440, 0xe84bbf59, 0xce086bd5, 0x213800cc, 0x1584cb16, 0xfab4a00f,
+    0x7cfd5ca2, 0x93cd37bb, 0xa771fc61, 0x48419778, 0xae0e73ca, 0x413e18d3,
+    0x7582d309, 0x9ab2b810, 0x1cfb44bd, 0xf3cb2fa4, 0xc777e47e, 0x28478f67,
+    0x8bf04d66, 0x64c0267f, 0x507ceda5, 0xbf4c86bc, 0x39057a11, 0xd6351108,
+    0xe289dad2, 0x0db9b1cb, 0xebf65579, 0x04c63e60, 0x307af5ba, 0xdf4a9ea3,
+    0x5903620e, 0xb6330917, 0x828fc2cd, 0x6dbfa9d4, 0x4bfc7d58, 0xa4cc1641,
+    0x9070dd9b, 0x7f40b682, 0xf9094a2f, 0x16392136, 0x2285eaec, 0xcdb581f5,
+    0x2bfa6547, 0xc4ca0e5e, 0xf076c584, 0x1f46ae9d, 0x990f5230, 0x763f3929,
+    0x4283f2f3, 0xadb399ea, 0x1c08b7d6, 0xf338dccf, 0xc7841715, 0x28b47c0c,
+    0xaefd80a1, 0x41cdebb8, 0x75712062, 0x9a414b7b, 0x7c0eafc9, 0x933ec4d0,
+    0xa7820f0a, 0x48b26413, 0xcefb98be, 0x21cbf3a7, 0x1577387d, 0xfa475364,
+    0xdc0487e8, 0x3334ecf1, 0x0788272b, 0xe8b84c32, 0x6ef1b09f, 0x81c1db86,
+    0xb57d105c, 0x5a4d7b45, 0xbc029ff7, 0x5332f4ee, 0x678e3f34, 0x88be542d,
+    0x0ef7a880, 0xe1c7c399, 0xd57b0843, 0x3a4b635a, 0x99fca15b, 0x76ccca42,
+    0x42700198, 0xad406a81, 0x2b09962c, 0xc439fd35, 0xf08536ef, 0x1fb55df6,
+    0xf9fab944, 0x16cad25d, 0x22761987, 0xcd46729e, 0x4b0f8e33, 0xa43fe52a,
+    0x90832ef0, 0x7fb345e9, 0x59f09165, 0xb6c0fa7c, 0x827c31a6, 0x6d4c5abf,
+    0xeb05a612, 0x0435cd0b, 0x308906d1, 0xdfb96dc8, 0x39f6897a, 0xd6c6e263,
+    0xe27a29b9, 0x0d4a42a0, 0x8b03be0d, 0x6433d514, 0x508f1ece, 0xbfbf75d7,
+    0x120cec3d, 0xfd3c8724, 0xc9804cfe, 0x26b027e7, 0xa0f9db4a, 0x4fc9b053,
+    0x7b757b89, 0x94451090, 0x720af422, 0x9d3a9f3b, 0xa98654e1, 0x46b63ff8,
+    0xc0ffc355, 0x2fcfa84c, 0x1b736396, 0xf443088f, 0xd200dc03, 0x3d30b71a,
+    0x098c7cc0, 0xe6bc17d9, 0x60f5eb74, 0x8fc5806d, 0xbb794bb7, 0x544920ae,
+    0xb206c41c, 0x5d36af05, 0x698a64df, 0x86ba0fc6, 0x00f3f36b, 0xefc39872,
+    0xdb7f53a8, 0x344f38b1, 0x97f8fab0, 0x78c891a9, 0x4c745a73, 0xa344316a,
+    0x250dcdc7, 0xca3da6de, 0xfe816d04, 0x11b1061d, 0xf7fee2af, 0x18ce89b6,
+    0x2c72426c, 0xc3422975, 0x450bd5d8, 0xaa3bbec1, 0x9e87751b, 0x71b71e02,
+    0x57f4ca8e, 0xb8c4a197, 0x8c786a4d, 0x63480154, 0xe501fdf9, 0x0a3196e0,
+    0x3e8d5d3a, 0xd1bd3623, 0x37f2d291, 0xd8c2b988, 0xec7e7252, 0x034e194b,
+    0x8507e5e6, 0x6a378eff, 0x5e8b4525, 0xb1bb2e3c
+  },
+  {
+    0x00000000, 0x68032cc8, 0xd0065990, 0xb8057558, 0xa5e0c5d1, 0xcde3e919,
+    0x75e69c41, 0x1de5b089, 0x4e2dfd53, 0x262ed19b, 0x9e2ba4c3, 0xf628880b,
+    0xebcd3882, 0x83ce144a, 0x3bcb6112, 0x53c84dda, 0x9c5bfaa6, 0xf458d66e,
+    0x4c5da336, 0x245e8ffe, 0x39bb3f77, 0x51b813bf, 0xe9bd66e7, 0x81be4a2f,
+    0xd27607f5, 0xba752b3d, 0x02705e65, 0x6a7372ad, 0x7796c224, 0x1f95eeec,
+    0xa7909bb4, 0xcf93b77c, 0x3d5b83bd, 0x5558af75, 0xed5dda2d, 0x855ef6e5,
+    0x98bb466c, 0xf0b86aa4, 0x48bd1ffc, 0x20be3334, 0x73767eee, 0x1b755226,
+    0xa370277e, 0xcb730bb6, 0xd696bb3f, 0xbe9597f7, 0x0690e2af, 0x6e93ce67,
+    0xa100791b, 0xc90355d3, 0x7106208b, 0x19050c43, 0x04e0bcca, 0x6ce39002,
+    0xd4e6e55a, 0xbce5c992, 0xef2d8448, 0x872ea880, 0x3f2bddd8, 0x5728f110,
+    0x4acd4199, 0x22ce6d51, 0x9acb1809, 0xf2c834c1, 0x7ab7077a, 0x12b42bb2,
+    0xaab15eea, 0xc2b27222, 0xdf57c2ab, 0xb754ee63, 0x0f519b3b, 0x6752b7f3,
+    0x349afa29, 0x5c99d6e1, 0xe49ca3b9, 0x8c9f8f71, 0x917a3ff8, 0xf9791330,
+    0x417c6668, 0x297f4aa0, 0xe6ecfddc, 0x8eefd114, 0x36eaa44c, 0x5ee98884,
+    0x430c380d, 0x2b0f14c5, 0x930a619d, 0xfb094d55, 0xa8c1008f, 0xc0c22c47,
+    0x78c7591f, 0x10c475d7, 0x0d21c55e, 0x6522e996, 0xdd279cce, 0xb524b006,
+    0x47ec84c7, 0x2fefa80f, 0x97eadd57, 0xffe9f19f, 0xe20c4116, 0x8a0f6dde,
+    0x320a1886, 0x5a09344e, 0x09c17994, 0x61c2555c, 0xd9c72004, 0xb1c40ccc,
+    0xac21bc45, 0xc422908d, 0x7c27e5d5, 0x1424c91d, 0xdbb77e61, 0xb3b452a9,
+    0x0bb127f1, 0x63b20b39, 0x7e57bbb0, 0x16549778, 0xae51e220, 0xc652cee8,
+    0x959a8332, 0xfd99affa, 0x459cdaa2, 0x2d9ff66a, 0x307a46e3, 0x58796a2b,
+    0xe07c1f73, 0x887f33bb, 0xf56e0ef4, 0x9d6d223c, 0x25685764, 0x4d6b7bac,
+    0x508ecb25, 0x388de7ed, 0x808892b5, 0xe88bbe7d, 0xbb43f3a7, 0xd340df6f,
+    0x6b45aa37, 0x034686ff, 0x1ea33676, 0x76a01abe, 0xcea56fe6, 0xa6a6432e,
+    0x6935f452, 0x0136d89a, 0xb933adc2, 0xd130810a, 0xccd53183, 0xa4d61d4b,
+    0x1cd36813, 0x74d044db, 0x27180901, 0x4f1b25c9, 0xf71e5091, 0x9f1d7c59,
+    0x82f8ccd0, 0xeafbe018, 0x52fe9540, 0x3afdb988, 0xc8358d49, 0xa036a181,
+    0x1833d4d9, 0x7030f811, 0x6dd54898, 0x05d66450, 0xbdd31108, 0xd5d03dc0,
+    0x8618701a, 0xee1b5cd2, 0x561e298a, 0x3e1d0542, 0x23f8b5cb, 0x4bfb9903,
+    0xf3feec5b, 0x9bfdc093, 0x546e77ef, 0x3c6d5b27, 0x84682e7f, 0xec6b02b7,
+    0xf18eb23e, 0x998d9ef6, 0x2188ebae, 0x498bc766, 0x1a438abc, 0x7240a674,
+    0xca45d32c, 0xa246ffe4, 0xbfa34f6d, 0xd7a063a5, 0x6fa516fd, 0x07a63a35,
+    0x8fd9098e, 0xe7da2546, 0x5fdf501e, 0x37dc7cd6, 0x2a39cc5f, 0x423ae097,
+    0xfa3f95cf, 0x923cb907, 0xc1f4f4dd, 0xa9f7d815, 0x11f2ad4d, 0x79f18185,
+    0x6414310c, 0x0c171dc4, 0xb412689c, 0xdc114454, 0x1382f328, 0x7b81dfe0,
+    0xc384aab8, 0xab878670, 0xb66236f9, 0xde611a31, 0x66646f69, 0x0e6743a1,
+    0x5daf0e7b, 0x35ac22b3, 0x8da957eb, 0xe5aa7b23, 0xf84fcbaa, 0x904ce762,
+    0x2849923a, 0x404abef2, 0xb2828a33, 0xda81a6fb, 0x6284d3a3, 0x0a87ff6b,
+    0x17624fe2, 0x7f61632a, 0xc7641672, 0xaf673aba, 0xfcaf7760, 0x94ac5ba8,
+    0x2ca92ef0, 0x44aa0238, 0x594fb2b1, 0x314c9e79, 0x8949eb21, 0xe14ac7e9,
+    0x2ed97095, 0x46da5c5d, 0xfedf2905, 0x96dc05cd, 0x8b39b544, 0xe33a998c,
+    0x5b3fecd4, 0x333cc01c, 0x60f48dc6, 0x08f7a10e, 0xb0f2d456, 0xd8f1f89e,
+    0xc5144817, 0xad1764df, 0x15121187, 0x7d113d4f
+  },
+  {
+    0x00000000, 0x493c7d27, 0x9278fa4e, 0xdb448769, 0x211d826d, 0x6821ff4a,
+    0xb3657823, 0xfa590504, 0x423b04da, 0x0b0779fd, 0xd043fe94, 0x997f83b3,
+    0x632686b7, 0x2a1afb90, 0xf15e7cf9, 0xb86201de, 0x847609b4, 0xcd4a7493,
+    0x160ef3fa, 0x5f328edd, 0xa56b8bd9, 0xec57f6fe, 0x37137197, 0x7e2f0cb0,
+    0xc64d0d6e, 0x8f717049, 0x5435f720, 0x1d098a07, 0xe7508f03, 0xae6cf224,
+    0x7528754d, 0x3c14086a, 0x0d006599, 0x443c18be, 0x9f789fd7, 0xd644e2f0,
+    0x2c1de7f4, 0x65219ad3, 0xbe651dba, 0xf759609d, 0x4f3b6143, 0x06071c64,
+    0xdd439b0d, 0x947fe62a, 0x6e26e32e, 0x271a9e09, 0xfc5e1960, 0xb5626447,
+    0x89766c2d, 0xc04a110a, 0x1b0e9663, 0x5232eb44, 0xa86bee40, 0xe1579367,
+    0x3a13140e, 0x732f6929, 0xcb4d68f7, 0x827115d0, 0x593592b9, 0x1009ef9e,
+    0xea50ea9a, 0xa36c97bd, 0x782810d4, 0x31146df3, 0x1a00cb32, 0x533cb615,
+    0x8878317c, 0xc1444c5b, 0x3b1d495f, 0x72213478, 0xa965b311, 0xe059ce36,
+    0x583bcfe8, 0x1107b2cf, 0xca4335a6, 0x837f4881, 0x79264d85, 0x301a30a2,
+    0xeb5eb7cb, 0xa262caec, 0x9e76c286, 0xd74abfa1, 0x0c0e38c8, 0x453245ef,
+    0xbf6b40eb, 0xf6573dcc, 0x2d13baa5, 0x642fc782, 0xdc4dc65c, 0x9571bb7b,
+    0x4e353c12, 0x07094135, 0xfd504431, 0xb46c3916, 0x6f28be7f, 0x2614c358,
+    0x1700aeab, 0x5e3cd38c, 0x857854e5, 0xcc4429c2, 0x361d2cc6, 0x7f2151e1,
+    0xa465d688, 0xed59abaf, 0x553baa71, 0x1c07d756, 0xc743503f, 0x8e7f2d18,
+    0x7426281c, 0x3d1a553b, 0xe65ed252, 0xaf62af75, 0x9376a71f, 0xda4ada38,
+    0x010e5d51, 0x48322076, 0xb26b2572, 0xfb575855, 0x2013df3c, 0x692fa21b,
+    0xd14da3c5, 0x9871dee2, 0x4335598b, 0x0a0924ac, 0xf05021a8, 0xb96c5c8f,
+    0x6228dbe6, 0x2b14a6c1, 0x34019664, 0x7d3deb43, 0xa6796c2a, 0xef45110d,
+    0x151c1409, 0x5c20692e, 0x8764ee47, 0xce589360, 0x763a92be, 0x3f06ef99,
+    0xe44268f0, 0xad7e15d7, 0x572710d3, 0x1e1b6df4, 0xc55fea9d, 0x8c6397ba,
+    0xb0779fd0, 0xf94be2f7, 0x220f659e, 0x6b3318b9, 0x916a1dbd, 0xd856609a,
+    0x0312e7f3, 0x4a2e9ad4, 0xf24c9b0a, 0xbb70e62d, 0x60346144, 0x29081c63,
+    0xd3511967, 0x9a6d6440, 0x4129e329, 0x08159e0e, 0x3901f3fd, 0x703d8eda,
+    0xab7909b3, 0xe2457494, 0x181c7190, 0x51200cb7, 0x8a648bde, 0xc358f6f9,
+    0x7b3af727, 0x32068a00, 0xe9420d69, 0xa07e704e, 0x5a27754a, 0x131b086d,
+    0xc85f8f04, 0x8163f223, 0xbd77fa49, 0xf44b876e, 0x2f0f0007, 0x66337d20,
+    0x9c6a7824, 0xd5560503, 0x0e12826a, 0x472eff4d, 0xff4cfe93, 0xb67083b4,
+    0x6d3404dd, 0x240879fa, 0xde517cfe, 0x976d01d9, 0x4c2986b0, 0x0515fb97,
+    0x2e015d56, 0x673d2071, 0xbc79a718, 0xf545da3f, 0x0f1cdf3b, 0x4620a21c,
+    0x9d642575, 0xd4585852, 0x6c3a598c, 0x250624ab, 0xfe42a3c2, 0xb77edee5,
+    0x4d27dbe1, 0x041ba6c6, 0xdf5f21af, 0x96635c88, 0xaa7754e2, 0xe34b29c5,
+    0x380faeac, 0x7133d38b, 0x8b6ad68f, 0xc256aba8, 0x19122cc1, 0x502e51e6,
+    0xe84c5038, 0xa1702d1f, 0x7a34aa76, 0x3308d751, 0xc951d255, 0x806daf72,
+    0x5b29281b, 0x1215553c, 0x230138cf, 0x6a3d45e8, 0xb179c281, 0xf845bfa6,
+    0x021cbaa2, 0x4b20c785, 0x906440ec, 0xd9583dcb, 0x613a3c15, 0x28064132,
+    0xf342c65b, 0xba7ebb7c, 0x4027be78, 0x091bc35f, 0xd25f4436, 0x9b633911,
+    0xa777317b, 0xee4b4c5c, 0x350fcb35, 0x7c33b612, 0x866ab316, 0xcf56ce31,
+    0x14124958, 0x5d2e347f, 0xe54c35a1, 0xac704886, 0x7734cfef, 0x3e08b2c8,
+    0xc451b7cc, 0x8d6dcaeb, 0x56294d82, 0x1f1530a5
+  }
+};
+
+// Tables to append MICRO_HASH_CRC32C_LONG and MICRO_HASH_CRC32C_SHORT
+// zero bytes to a CRC, one for each byte of the CRC
+static const uint32_t _micro_hash_crc32c_long[4][256] = {
+  {
+    0x00000000, 0xe040e0ac, 0xc56db7a9, 0x252d5705, 0x8f3719a3, 0x6f77f90f,
+    0x4a5aae0a, 0xaa1a4ea6, 0x1b8245b7, 0xfbc2a51b, 0xdeeff21e, 0x3eaf12b2,
+    0x94b55c14, 0x74f5bcb8, 0x51d8ebbd, 0xb1980b11, 0x37048b6e, 0xd7446bc2,
+    0xf2693cc7, 0x1229dc6b, 0xb83392cd, 0x58737261, 0x7d5e2564, 0x9d1ec5c8,
+    0x2c86ced9, 0xccc62e75, 0xe9eb7970, 0x09ab99dc, 0xa3b1d77a, 0x43f137d6,
+    0x66dc60d3, 0x869c807f, 0x6e0916dc, 0x8e49f670, 0xab64a175, 0x4b2441d9,
+    0xe13e0f7f, 0x017eefd3, 0x2453b8d6, 0xc413587a, 0x758b536b, 0x95cbb3c7,
+    0xb0e6e4c2, 0x50a6046e, 0xfabc4ac8, 0x1afcaa64, 0x3fd1fd61, 0xdf911dcd,
+    0x590d9db2, 0xb94d7d1e, 0x9c602a1b, 0x7c20cab7, 0xd63a8411, 0x367a64bd,
+    0x135733b8, 0xf317d314, 0x428fd805, 0xa2cf38a9, 0x87e26fac, 0x67a28f00,
+    0xcdb8c1a6, 0x2df8210a, 0x08d5760f, 0xe89596a3, 0xdc122db8, 0x3c52cd14,
+    0x197f9a11, 0xf93f7abd, 0x5325341b, 0xb365d4b7, 0x964883b2, 0x7608631e,
+    0xc790680f, 0x27d088a3, 0x02fddfa6, 0xe2bd3f0a, 0x48a771ac, 0xa8e79100,
+    0x8dcac605, 0x6d8a26a9, 0xeb16a6d6, 0x0b56467a, 0x2e7b117f, 0xce3bf1d3,
+    0x6421bf75, 0x84615fd9, 0xa14c08dc, 0x410ce870, 0xf094e361, 0x10d403cd,
+    0x35f954c8, 0xd5b9b464, 0x7fa3fac2, 0x9fe31a6e, 0xbace4d6b, 0x5a8eadc7,
+    0xb21b3b64, 0x525bdbc8, 0x77768ccd, 0x97366c61, 0x3d2c22c7, 0xdd6cc26b,
+    0xf841956e, 0x180175c2, 0xa9997ed3, 0x49d99e7f, 0x6cf4c97a, 0x8cb429d6,
+    0x26ae6770, 0xc6ee87dc, 0xe3c3d0d9, 0x03833075, 0x851fb00a, 0x655f50a6,
+    0x407207a3, 0xa032e70f, 0x0a28a9a9, 0xea684905, 0xcf451e00, 0x2f05feac,
+    0x9e9df5bd, 0x7edd1511, 0x5bf04214, 0xbbb0a2b8, 0x11aaec1e, 0xf1ea0cb2,
+    0xd4c75bb7, 0x3487bb1b, 0xbdc82d81, 0x5d88cd2d, 0x78a59a28, 0x98e57a84,
+    0x32ff3422, 0xd2bfd48e, 0xf792838b, 0x17d26327, 0xa64a6836, 0x460a889a,
+    0x6327df9f, 0x83673f33, 0x297d7195, 0xc93d9139, 0xec10c63c, 0x0c502690,
+    0x8acca6ef, 0x6a8c4643, 0x4fa11146, 0xafe1f1ea, 0x05fbbf4c, 0xe5bb5fe0,
+    0xc09608e5, 0x20d6e849, 0x914ee358, 0x710e03f4, 0x542354f1, 0xb463b45d,
+    0x1e79fafb, 0xfe391a57, 0xdb144d52, 0x3b54adfe, 0xd3c13b5d, 0x3381dbf1,
+    0x16ac8cf4, 0xf6ec6c58, 0x5cf622fe, 0xbcb6c252, 0x999b9557, 0x79db75fb,
+    0xc8437eea, 0x28039e46, 0x0d2ec943, 0xed6e29ef, 0x47746749, 0xa73487e5,
+    0x8219d0e0, 0x6259304c, 0xe4c5b033, 0x0485509f, 0x21a8079a, 0xc1e8e736,
+    0x6bf2a990, 0x8bb2493c, 0xae9f1e39, 0x4edffe95, 0xff47f584, 0x1f071528,
+    0x3a2a422d, 0xda6aa281, 0x7070ec27, 0x90300c8b, 0xb51d5b8e, 0x555dbb22,
+    0x61da0039, 0x819ae095, 0xa4b7b790, 0x44f7573c, 0xeeed199a, 0x0eadf936,
+    0x2b80ae33, 0xcbc04e9f, 0x7a58458e, 0x9a18a522, 0xbf35f227, 0x5f75128b,
+    0xf56f5c2d, 0x152fbc81, 0x3002eb84, 0xd0420b28, 0x56de8b57, 0xb69e6bfb,
+    0x93b33cfe, 0x73f3dc52, 0xd9e992f4, 0x39a97258, 0x1c84255d, 0xfcc4c5f1,
+    0x4d5ccee0, 0xad1c2e4c, 0x88317949, 0x687199e5, 0xc26bd743, 0x222b37ef,
+    0x070660ea, 0xe7468046, 0x0fd316e5, 0xef93f649, 0xcabea14c, 0x2afe41e0,
+    0x80e40f46, 0x60a4efea, 0x4589b8ef, 0xa5c95843, 0x14515352, 0xf411b3fe,
+    0xd13ce4fb, 0x317c0457, 0x9b664af1, 0x7b26aa5d, 0x5e0bfd58, 0xbe4b1df4,
+    0x38d79d8b, 0xd8977d27, 0xfdba2a22, 0x1dfaca8e, 0xb7e08428, 0x57a06484,
+    0x728d3381, 0x92cdd32d, 0x2355d83c, 0xc3153890, 0xe6386f95, 0x06788f39,
+    0xac62c19f, 0x4c222133, 0x690f7636, 0x894f969a
+  },
+  {
+    0x00000000, 0x7e7c2df3, 0xfcf85be6, 0x82847615, 0xfc1cc13d, 0x8260ecce,
+    0x00e49adb, 0x7e98b728, 0xfdd5f48b, 0x83a9d978, 0x012daf6d, 0x7f51829e,
+    0x01c935b6, 0x7fb51845, 0xfd316e50, 0x834d43a3, 0xfe479fe7, 0x803bb214,
+    0x02bfc401, 0x7cc3e9f2, 0x025b5eda, 0x7c277329, 0xfea3053c, 0x80df28cf,
+    0x03926b6c, 0x7dee469f, 0xff6a308a, 0x81161d79, 0xff8eaa51, 0x81f287a2,
+    0x0376f1b7, 0x7d0adc44, 0xf963493f, 0x871f64cc, 0x059b12d9, 0x7be73f2a,
+    0x057f8802, 0x7b03a5f1, 0xf987d3e4, 0x87fbfe17, 0x04b6bdb4, 0x7aca9047,
+    0xf84ee652, 0x8632cba1, 0xf8aa7c89, 0x86d6517a, 0x0452276f, 0x7a2e0a9c,
+    0x0724d6d8, 0x7958fb2b, 0xfbdc8d3e, 0x85a0a0cd, 0xfb3817e5, 0x85443a16,
+    0x07c04c03, 0x79bc61f0, 0xfaf12253, 0x848d0fa0, 0x060979b5, 0x78755446,
+    0x06ede36e, 0x7891ce9d, 0xfa15b888, 0x8469957b, 0xf72ae48f, 0x8956c97c,
+    0x0bd2bf69, 0x75ae929a, 0x0b3625b2, 0x754a0841, 0xf7ce7e54, 0x89b253a7,
+    0x0aff1004, 0x74833df7, 0xf6074be2, 0x887b6611, 0xf6e3d139, 0x889ffcca,
+    0x0a1b8adf, 0x7467a72c, 0x096d7b68, 0x7711569b, 0xf595208e, 0x8be90d7d,
+    0xf571ba55, 0x8b0d97a6, 0x0989e1b3, 0x77f5cc40, 0xf4b88fe3, 0x8ac4a210,
+    0x0840d405, 0x763cf9f6, 0x08a44ede, 0x76d8632d, 0xf45c1538, 0x8a2038cb,
+    0x0e49adb0, 0x70358043, 0xf2b1f656, 0x8ccddba5, 0xf2556c8d, 0x8c29417e,
+    0x0ead376b, 0x70d11a98, 0xf39c593b, 0x8de074c8, 0x0f6402dd, 0x71182f2e,
+    0x0f809806, 0x71fcb5f5, 0xf378c3e0, 0x8d04ee13, 0xf00e3257, 0x8e721fa4,
+    0x0cf669b1, 0x728a4442, 0x0c12f36a, 0x726ede99, 0xf0eaa88c, 0x8e96857f,
+    0x0ddbc6dc, 0x73a7eb2f, 0xf1239d3a, 0x8f5fb0c9, 0xf1c707e1, 0x8fbb2a12,
+    0x0d3f5c07, 0x734371f4, 0xebb9bfef, 0x95c5921c, 0x1741e409, 0x693dc9fa,
+    0x17a57ed2, 0x69d95321, 0xeb5d2534, 0x952108c7, 0x166c4b64, 0x68106697,
+    0xea941082, 0x94e83d71, 0xea708a59, 0x940ca7aa, 0x1688d1bf, 0x68f4fc4c,
+    0x15fe2008, 0x6b820dfb, 0xe9067bee, 0x977a561d, 0xe9e2e135, 0x979eccc6,
+    0x151abad3, 0x6b669720, 0xe82bd483, 0x9657f970, 0x14d38f65, 0x6aafa296,
+    0x143715be, 0x6a4b384d, 0xe8cf4e58, 0x96b363ab, 0x12daf6d0, 0x6ca6db23,
+    0xee22ad36, 0x905e80c5, 0xeec637ed, 0x90ba1a1e, 0x123e6c0b, 0x6c4241f8,
+    0xef0f025b, 0x91732fa8, 0x13f759bd, 0x6d8b744e, 0x1313c366, 0x6d6fee95,
+    0xefeb9880, 0x9197b573, 0xec9d6937, 0x92e144c4, 0x106532d1, 0x6e191f22,
+    0x1081a80a, 0x6efd85f9, 0xec79f3ec, 0x9205de1f, 0x11489dbc, 0x6f34b04f,
+    0xedb0c65a, 0x93cceba9, 0xed545c81, 0x93287172, 0x11ac0767, 0x6fd02a94,
+    0x1c935b60, 0x62ef7693, 0xe06b0086, 0x9e172d75, 0xe08f9a5d, 0x9ef3b7ae,
+    0x1c77c1bb, 0x620bec48, 0xe146afeb, 0x9f3a8218, 0x1dbef40d, 0x63c2d9fe,
+    0x1d5a6ed6, 0x63264325, 0xe1a23530, 0x9fde18c3, 0xe2d4c487, 0x9ca8e974,
+    0x1e2c9f61, 0x6050b292, 0x1ec805ba, 0x60b42849, 0xe2305e5c, 0x9c4c73af,
+    0x1f01300c, 0x617d1dff, 0xe3f96bea, 0x9d854619, 0xe31df131, 0x9d61dcc2,
+    0x1fe5aad7, 0x61998724, 0xe5f0125f, 0x9b8c3fac, 0x190849b9, 0x6774644a,
+    0x19ecd362, 0x6790fe91, 0xe5148884, 0x9b68a577, 0x1825e6d4, 0x6659cb27,
+    0xe4ddbd32, 0x9aa190c1, 0xe43927e9, 0x9a450a1a, 0x18c17c0f, 0x66bd51fc,
+    0x1bb78db8, 0x65cba04b, 0xe74fd65e, 0x9933fbad, 0xe7ab4c85, 0x99d76176,
+    0x1b531763, 0x652f3a90, 0xe6627933, 0x981e54c0, 0x1a9a22d5, 0x64e60f26,
+    0x1a7eb80e, 0x640295fd, 0xe686e3e8, 0x98face1b
+  },
+  {
+    0x00000000, 0xd29f092f, 0xa0d264af, 0x724d6d80, 0x4448bfaf, 0x96d7b680,
+    0xe49adb00, 0x3605d22f, 0x88917f5e, 0x5a0e7671, 0x28431bf1, 0xfadc12de,
+    0xccd9c0f1, 0x1e46c9de, 0x6c0ba45e, 0xbe94ad71, 0x14ce884d, 0xc6518162,
+    0xb41cece2, 0x6683e5cd, 0x508637e2, 0x82193ecd, 0xf054534d, 0x22cb5a62,
+    0x9c5ff713, 0x4ec0fe3c, 0x3c8d93bc, 0xee129a93, 0xd81748bc, 0x0a884193,
+    0x78c52c13, 0xaa5a253c, 0x299d109a, 0xfb0219b5, 0x894f7435, 0x5bd07d1a,
+    0x6dd5af35, 0xbf4aa61a, 0xcd07cb9a, 0x1f98c2b5, 0xa10c6fc4, 0x739366eb,
+    0x01de0b6b, 0xd3410244, 0xe544d06b, 0x37dbd944, 0x4596b4c4, 0x9709bdeb,
+    0x3d5398d7, 0xefcc91f8, 0x9d81fc78, 0x4f1ef557, 0x791b2778, 0xab842e57,
+    0xd9c943d7, 0x0b564af8, 0xb5c2e789, 0x675deea6, 0x15108326, 0xc78f8a09,
+    0xf18a5826, 0x23155109, 0x51583c89, 0x83c735a6, 0x533a2134, 0x81a5281b,
+    0xf3e8459b, 0x21774cb4, 0x17729e9b, 0xc5ed97b4, 0xb7a0fa34, 0x653ff31b,
+    0xdbab5e6a, 0x09345745, 0x7b793ac5, 0xa9e633ea, 0x9fe3e1c5, 0x4d7ce8ea,
+    0x3f31856a, 0xedae8c45, 0x47f4a979, 0x956ba056, 0xe726cdd6, 0x35b9c4f9,
+    0x03bc16d6, 0xd1231ff9, 0xa36e7279, 0x71f17b56, 0xcf65d627, 0x1dfadf08,
+    0x6fb7b288, 0xbd28bba7, 0x8b2d6988, 0x59b260a7, 0x2bff0d27, 0xf9600408,
+    0x7aa731ae, 0xa8383881, 0xda755501, 0x08ea5c2e, 0x3eef8e01, 0xec70872e,
+    0x9e3deaae, 0x4ca2e381, 0xf2364ef0, 0x20a947df, 0x52e42a5f, 0x807b2370,
+    0xb67ef15f, 0x64e1f870, 0x16ac95f0, 0xc4339cdf, 0x6e69b9e3, 0xbcf6b0cc,
+    0xcebbdd4c, 0x1c24d463, 0x2a21064c, 0xf8be0f63, 0x8af362e3, 0x586c6bcc,
+    0xe6f8c6bd, 0x3467cf92, 0x462aa212, 0x94b5ab3d, 0xa2b07912, 0x702f703d,
+    0x02621dbd, 0xd0fd1492, 0xa6744268, 0x74eb4b47, 0x06a626c7, 0xd4392fe8,
+    0xe23cfdc7, 0x30a3f4e8, 0x42ee9968, 0x90719047, 0x2ee53d36, 0xfc7a3419,
+    0x8e375999, 0x5ca850b6, 0x6aad8299, 0xb8328bb6, 0xca7fe636, 0x18e0ef19,
+    0xb2baca25, 0x6025c30a, 0x1268ae8a, 0xc0f7a7a5, 0xf6f2758a, 0x246d7ca5,
+    0x56201125, 0x84bf180a, 0x3a2bb57b, 0xe8b4bc54, 0x9af9d1d4, 0x4866d8fb,
+    0x7e630ad4, 0xacfc03fb, 0xdeb16e7b, 0x0c2e6754, 0x8fe952f2, 0x5d765bdd,
+    0x2f3b365d, 0xfda43f72, 0xcba1ed5d, 0x193ee472, 0x6b7389f2, 0xb9ec80dd,
+    0x07782dac, 0xd5e72483, 0xa7aa4903, 0x7535402c, 0x43309203, 0x91af9b2c,
+    0xe3e2f6ac, 0x317dff83, 0x9b27dabf, 0x49b8d390, 0x3bf5be10, 0xe96ab73f,
+    0xdf6f6510, 0x0df06c3f, 0x7fbd01bf, 0xad220890, 0x13b6a5e1, 0xc129acce,
+    0xb364c14e, 0x61fbc861, 0x57fe1a4e, 0x85611361, 0xf72c7ee1, 0x25b377ce,
+    0xf54e635c, 0x27d16a73, 0x559c07f3, 0x87030edc, 0xb106dcf3, 0x6399d5dc,
+    0x11d4b85c, 0xc34bb173, 0x7ddf1c02, 0xaf40152d, 0xdd0d78ad, 0x0f927182,
+    0x3997a3ad, 0xeb08aa82, 0x9945c702, 0x4bdace2d, 0xe180eb11, 0x331fe23e,
+    0x41528fbe, 0x93cd8691, 0xa5c854be, 0x77575d91, 0x051a3011, 0xd785393e,
+    0x6911944f, 0xbb8e9d60, 0xc9c3f0e0, 0x1b5cf9cf, 0x2d592be0, 0xffc622cf,
+    0x8d8b4f4f, 0x5f144660, 0xdcd373c6, 0x0e4c7ae9, 0x7c011769, 0xae9e1e46,
+    0x989bcc69, 0x4a04c546, 0x3849a8c6, 0xead6a1e9, 0x54420c98, 0x86dd05b7,
+    0xf4906837, 0x260f6118, 0x100ab337, 0xc295ba18, 0xb0d8d798, 0x6247deb7,
+    0xc81dfb8b, 0x1a82f2a4, 0x68cf9f24, 0xba50960b, 0x8c554424, 0x5eca4d0b,
+    0x2c87208b, 0xfe1829a4, 0x408c84d5, 0x92138dfa, 0xe05ee07a, 0x32c1e955,
+    0x04c43b7a, 0xd65b3255, 0xa4165fd5, 0x768956fa
+  },
+  {
+    0x00000000, 0x4904f221, 0x9209e442, 0xdb0d1663, 0x21ffbe75, 0x68fb4c54,
+    0xb3f65a37, 0xfaf2a816, 0x43ff7cea, 0x0afb8ecb, 0xd1f698a8, 0x98f26a89,
+    0x6200c29f, 0x2b0430be, 0xf00926dd, 0xb90dd4fc, 0x87fef9d4, 0xcefa0bf5,
+    0x15f71d96, 0x5cf3efb7, 0xa60147a1, 0xef05b580, 0x3408a3e3, 0x7d0c51c2,
+    0xc401853e, 0x8d05771f, 0x5608617c, 0x1f0c935d, 0xe5fe3b4b, 0xacfac96a,
+    0x77f7df09, 0x3ef32d28, 0x0a118559, 0x43157778, 0x9818611b, 0xd11c933a,
+    0x2bee3b2c, 0x62eac90d, 0xb9e7df6e, 0xf0e32d4f, 0x49eef9b3, 0x00ea0b92,
+    0xdbe71df1, 0x92e3efd0, 0x681147c6, 0x2115b5e7, 0xfa18a384, 0xb31c51a5,
+    0x8def7c8d, 0xc4eb8eac, 0x1fe698cf, 0x56e26aee, 0xac10c2f8, 0xe51430d9,
+    0x3e1926ba, 0x771dd49b, 0xce100067, 0x8714f246, 0x5c19e425, 0x151d1604,
+    0xefefbe12, 0xa6eb4c33, 0x7de65a50, 0x34e2a871, 0x14230ab2, 0x5d27f893,
+    0x862aeef0, 0xcf2e1cd1, 0x35dcb4c7, 0x7cd846e6, 0xa7d55085, 0xeed1a2a4,
+    0x57dc7658, 0x1ed88479, 0xc5d5921a, 0x8cd1603b, 0x7623c82d, 0x3f273a0c,
+    0xe42a2c6f, 0xad2ede4e, 0x93ddf366, 0xdad90147, 0x01d41724, 0x48d0e505,
+    0xb2224d13, 0xfb26bf32, 0x202ba951, 0x692f5b70, 0xd0228f8c, 0x99267dad,
+    0x422b6bce, 0x0b2f99ef, 0xf1dd31f9, 0xb8d9c3d8, 0x63d4d5bb, 0x2ad0279a,
+    0x1e328feb, 0x57367dca, 0x8c3b6ba9, 0xc53f9988, 0x3fcd319e, 0x76c9c3bf,
+    0xadc4d5dc, 0xe4c027fd, 0x5dcdf301, 0x14c90120, 0xcfc41743, 0x86c0e562,
+    0x7c324d74, 0x3536bf55, 0xee3ba936, 0xa73f5b17, 0x99cc763f, 0xd0c8841e,
+    0x0bc5927d, 0x42c1605c, 0xb833c84a, 0xf1373a6b, 0x2a3a2c08, 0x633ede29,
+    0xda330ad5, 0x9337f8f4, 0x483aee97, 0x013e1cb6, 0xfbccb4a0, 0xb2c84681,
+    0x69c550e2, 0x20c1a2c3, 0x28461564, 0x6142e745, 0xba4ff126, 0xf34b0307,
+    0x09b9ab11, 0x40bd5930, 0x9bb04f53, 0xd2b4bd72, 0x6bb9698e, 0x22bd9baf,
+    0xf9b08dcc, 0xb0b47fed, 0x4a46d7fb, 0x034225da, 0xd84f33b9, 0x914bc198,
+    0xafb8ecb0, 0xe6bc1e91, 0x3db108f2, 0x74b5fad3, 0x8e4752c5, 0xc743a0e4,
+    0x1c4eb687, 0x554a44a6, 0xec47905a, 0xa543627b, 0x7e4e7418, 0x374a8639,
+    0xcdb82e2f, 0x84bcdc0e, 0x5fb1ca6d, 0x16b5384c, 0x2257903d, 0x6b53621c,
+    0xb05e747f, 0xf95a865e, 0x03a82e48, 0x4aacdc69, 0x91a1ca0a, 0xd8a5382b,
+    0x61a8ecd7, 0x28ac1ef6, 0xf3a10895, 0xbaa5fab4, 0x405752a2, 0x0953a083,
+    0xd25eb6e0, 0x9b5a44c1, 0xa5a969e9, 0xecad9bc8, 0x37a08dab, 0x7ea47f8a,
+    0x8456d79c, 0xcd5225bd, 0x165f33de, 0x5f5bc1ff, 0xe6561503, 0xaf52e722,
+    0x745ff141, 0x3d5b0360, 0xc7a9ab76, 0x8ead5957, 0x55a04f34, 0x1ca4bd15,
+    0x3c651fd6, 0x7561edf7, 0xae6cfb94, 0xe76809b5, 0x1d9aa1a3, 0x549e5382,
+    0x8f9345e1, 0xc697b7c0, 0x7f9a633c, 0x369e911d, 0xed93877e, 0xa497755f,
+    0x5e65dd49, 0x17612f68, 0xcc6c390b, 0x8568cb2a, 0xbb9be602, 0xf29f1423,
+    0x29920240, 0x6096f061, 0x9a645877, 0xd360aa56, 0x086dbc35, 0x41694e14,
+    0xf8649ae8, 0xb16068c9, 0x6a6d7eaa, 0x23698c8b, 0xd99b249d, 0x909fd6bc,
+    0x4b92c0df, 0x029632fe, 0x36749a8f, 0x7f7068ae, 0xa47d7ecd, 0xed798cec,
+    0x178b24fa, 0x5e8fd6db, 0x8582c0b8, 0xcc863299, 0x758be665, 0x3c8f1444,
+    0xe7820227, 0xae86f006, 0x54745810, 0x1d70aa31, 0xc67dbc52, 0x8f794e73,
+    0xb18a635b, 0xf88e917a, 0x23838719, 0x6a877538, 0x9075dd2e, 0xd9712f0f,
+    0x027c396c, 0x4b78cb4d, 0xf2751fb1, 0xbb71ed90, 0x607cfbf3, 0x297809d2,
+    0xd38aa1c4, 0x9a8e53e5, 0x41834586, 0x0887b7a7
+  }
+};
+static const uint32_t _micro_hash_crc32c_short[4][256] = {
+  {
+    0x00000000, 0xdcb17aa4, 0xbc8e83b9, 0x603ff91d, 0x7cf17183, 0xa0400b27,
+    0xc07ff23a, 0x1cce889e, 0xf9e2e306, 0x255399a2, 0x456c60bf, 0x99dd1a1b,
+    0x85139285, 0x59a2e821, 0x399d113c, 0xe52c6b98, 0xf629b0fd, 0x2a98ca59,
+    0x4aa73344, 0x961649e0, 0x8ad8c17e, 0x5669bbda, 0x365642c7, 0xeae73863,
+    0x0fcb53fb, 0xd37a295f, 0xb345d042, 0x6ff4aae6, 0x733a2278, 0xaf8b58dc,
+    0xcfb4a1c1, 0x1305db65, 0xe9bf170b, 0x350e6daf, 0x553194b2, 0x8980ee16,
+    0x954e6688, 0x49ff1c2c, 0x29c0e531, 0xf5719f95, 0x105df40d, 0xccec8ea9,
+    0xacd377b4, 0x70620d10, 0x6cac858e, 0xb01dff2a, 0xd0220637, 0x0c937c93,
+    0x1f96a7f6, 0xc327dd52, 0xa318244f, 0x7fa95eeb, 0x6367d675, 0xbfd6acd1,
+    0xdfe955cc, 0x03582f68, 0xe67444f0, 0x3ac53e54, 0x5afac749, 0x864bbded,
+    0x9a853573, 0x46344fd7, 0x260bb6ca, 0xfabacc6e, 0xd69258e7, 0x0a232243,
+    0x6a1cdb5e, 0xb6ada1fa, 0xaa632964, 0x76d253c0, 0x16edaadd, 0xca5cd079,
+    0x2f70bbe1, 0xf3c1c145, 0x93fe3858, 0x4f4f42fc, 0x5381ca62, 0x8f30b0c6,
+    0xef0f49db, 0x33be337f, 0x20bbe81a, 0xfc0a92be, 0x9c356ba3, 0x40841107,
+    0x5c4a9999, 0x80fbe33d, 0xe0c41a20, 0x3c756084, 0xd9590b1c, 0x05e871b8,
+    0x65d788a5, 0xb966f201, 0xa5a87a9f, 0x7919003b, 0x1926f926, 0xc5978382,
+    0x3f2d4fec, 0xe39c3548, 0x83a3cc55, 0x5f12b6f1, 0x43dc3e6f, 0x9f6d44cb,
+    0xff52bdd6, 0x23e3c772, 0xc6cfacea, 0x1a7ed64e, 0x7a412f53, 0xa6f055f7,
+    0xba3edd69, 0x668fa7cd, 0x06b05ed0, 0xda012474, 0xc904ff11, 0x15b585b5,
+    0x758a7ca8, 0xa93b060c, 0xb5f58e92, 0x6944f436, 0x097b0d2b, 0xd5ca778f,
+    0x30e61c17, 0xec5766b3, 0x8c689fae, 0x50d9e50a, 0x4c176d94, 0x90a61730,
+    0xf099ee2d, 0x2c289489, 0xa8c8c73f, 0x7479bd9b, 0x14464486, 0xc8f73e22,
+    0xd439b6bc, 0x0888cc18, 0x68b73505, 0xb4064fa1, 0x512a2439, 0x8d9b5e9d,
+    0xeda4a780, 0x3115dd24, 0x2ddb55ba, 0xf16a2f1e, 0x9155d603, 0x4de4aca7,
+    0x5ee177c2, 0x82500d66, 0xe26ff47b, 0x3ede8edf, 0x22100641, 0xfea17ce5,
+    0x9e9e85f8, 0x422fff5c, 0xa70394c4, 0x7bb2ee60, 0x1b8d177d, 0xc73c6dd9,
+    0xdbf2e547, 0x07439fe3, 0x677c66fe, 0xbbcd1c5a, 0x4177d034, 0x9dc6aa90,
+    0xfdf9538d, 0x21482929, 0x3d86a1b7, 0xe137db13, 0x8108220e, 0x5db958aa,
+    0xb8953332, 0x64244996, 0x041bb08b, 0xd8aaca2f, 0xc46442b1, 0x18d53815,
+    0x78eac108, 0xa45bbbac, 0xb75e60c9, 0x6bef1a6d, 0x0bd0e370, 0xd76199d4,
+    0xcbaf114a, 0x171e6bee, 0x772192f3, 0xab90e857, 0x4ebc83cf, 0x920df96b,
+    0xf2320076, 0x2e837ad2, 0x324df24c, 0xeefc88e8, 0x8ec371f5, 0x52720b51,
+    0x7e5a9fd8, 0xa2ebe57c, 0xc2d41c61, 0x1e6566c5, 0x02abee5b, 0xde1a94ff,
+    0xbe256de2, 0x62941746, 0x87b87cde, 0x5b09067a, 0x3b36ff67, 0xe78785c3,
+    0xfb490d5d, 0x27f877f9, 0x47c78ee4, 0x9b76f440, 0x88732f25, 0x54c25581,
+    0x34fdac9c, 0xe84cd638, 0xf4825ea6, 0x28332402, 0x480cdd1f, 0x94bda7bb,
+    0x7191cc23, 0xad20b687, 0xcd1f4f9a, 0x11ae353e, 0x0d60bda0, 0xd1d1c704,
+    0xb1ee3e19, 0x6d5f44bd, 0x97e588d3, 0x4b54f277, 0x2b6b0b6a, 0xf7da71ce,
+    0xeb14f950, 0x37a583f4, 0x579a7ae9, 0x8b2b004d, 0x6e076bd5, 0xb2b61171,
+    0xd289e86c, 0x0e3892c8, 0x12f61a56, 0xce4760f2, 0xae7899ef, 0x72c9e34b,
+    0x61cc382e, 0xbd7d428a, 0xdd42bb97, 0x01f3c133, 0x1d3d49ad, 0xc18c3309,
+    0xa1b3ca14, 0x7d02b0b0, 0x982edb28, 0x449fa18c, 0x24a05891, 0xf8112235,
+    0xe4dfaaab, 0x386ed00f, 0x58512912, 0x84e053b6
+  },
+  {
+    0x00000000, 0x547df88f, 0xa8fbf11e, 0xfc860991, 0x541b94cd, 0x00666c42,
+    0xfce065d3, 0xa89d9d5c, 0xa837299a, 0xfc4ad115, 0x00ccd884, 0x54b1200b,
+    0xfc2cbd57, 0xa85145d8, 0x54d74c49, 0x00aab4c6, 0x558225c5, 0x01ffdd4a,
+    0xfd79d4db, 0xa9042c54, 0x0199b108, 0x55e44987, 0xa9624016, 0xfd1fb899,
+    0xfdb50c5f, 0xa9c8f4d0, 0x554efd41, 0x013305ce, 0xa9ae9892, 0xfdd3601d,
+    0x0155698c, 0x55289103, 0xab044b8a, 0xff79b305, 0x03ffba94, 0x5782421b,
+    0xff1fdf47, 0xab6227c8, 0x57e42e59, 0x0399d6d6, 0x03336210, 0x574e9a9f,
+    0xabc8930e, 0xffb56b81, 0x5728f6dd, 0x03550e52, 0xffd307c3, 0xabaeff4c,
+    0xfe866e4f, 0xaafb96c0, 0x567d9f51, 0x020067de, 0xaa9dfa82, 0xfee0020d,
+    0x02660b9c, 0x561bf313, 0x56b147d5, 0x02ccbf5a, 0xfe4ab6cb, 0xaa374e44,
+    0x02aad318, 0x56d72b97, 0xaa512206, 0xfe2cda89, 0x53e4e1e5, 0x0799196a,
+    0xfb1f10fb, 0xaf62e874, 0x07ff7528, 0x53828da7, 0xaf048436, 0xfb797cb9,
+    0xfbd3c87f, 0xafae30f0, 0x53283961, 0x0755c1ee, 0xafc85cb2, 0xfbb5a43d,
+    0x0733adac, 0x534e5523, 0x0666c420, 0x521b3caf, 0xae9d353e, 0xfae0cdb1,
+    0x527d50ed, 0x0600a862, 0xfa86a1f3, 0xaefb597c, 0xae51edba, 0xfa2c1535,
+    0x06aa1ca4, 0x52d7e42b, 0xfa4a7977, 0xae3781f8, 0x52b18869, 0x06cc70e6,
+    0xf8e0aa6f, 0xac9d52e0, 0x501b5b71, 0x0466a3fe, 0xacfb3ea2, 0xf886c62d,
+    0x0400cfbc, 0x507d3733, 0x50d783f5, 0x04aa7b7a, 0xf82c72eb, 0xac518a64,
+    0x04cc1738, 0x50b1efb7, 0xac37e626, 0xf84a1ea9, 0xad628faa, 0xf91f7725,
+    0x05997eb4, 0x51e4863b, 0xf9791b67, 0xad04e3e8, 0x5182ea79, 0x05ff12f6,
+    0x0555a630, 0x51285ebf, 0xadae572e, 0xf9d3afa1, 0x514e32fd, 0x0533ca72,
+    0xf9b5c3e3, 0xadc83b6c, 0xa7c9c3ca, 0xf3b43b45, 0x0f3232d4, 0x5b4fca5b,
+    0xf3d25707, 0xa7afaf88, 0x5b29a619, 0x0f545e96, 0x0ffeea50, 0x5b8312df,
+    0xa7051b4e, 0xf378e3c1, 0x5be57e9d, 0x0f988612, 0xf31e8f83, 0xa763770c,
+    0xf24be60f, 0xa6361e80, 0x5ab01711, 0x0ecdef9e, 0xa65072c2, 0xf22d8a4d,
+    0x0eab83dc, 0x5ad67b53, 0x5a7ccf95, 0x0e01371a, 0xf2873e8b, 0xa6fac604,
+    0x0e675b58, 0x5a1aa3d7, 0xa69caa46, 0xf2e152c9, 0x0ccd8840, 0x58b070cf,
+    0xa436795e, 0xf04b81d1, 0x58d61c8d, 0x0cabe402, 0xf02ded93, 0xa450151c,
+    0xa4faa1da, 0xf0875955, 0x0c0150c4, 0x587ca84b, 0xf0e13517, 0xa49ccd98,
+    0x581ac409, 0x0c673c86, 0x594fad85, 0x0d32550a, 0xf1b45c9b, 0xa5c9a414,
+    0x0d543948, 0x5929c1c7, 0xa5afc856, 0xf1d230d9, 0xf178841f, 0xa5057c90,
+    0x59837501, 0x0dfe8d8e, 0xa56310d2, 0xf11ee85d, 0x0d98e1cc, 0x59e51943,
+    0xf42d222f, 0xa050daa0, 0x5cd6d331, 0x08ab2bbe, 0xa036b6e2, 0xf44b4e6d,
+    0x08cd47fc, 0x5cb0bf73, 0x5c1a0bb5, 0x0867f33a, 0xf4e1faab, 0xa09c0224,
+    0x08019f78, 0x5c7c67f7, 0xa0fa6e66, 0xf48796e9, 0xa1af07ea, 0xf5d2ff65,
+    0x0954f6f4, 0x5d290e7b, 0xf5b49327, 0xa1c96ba8, 0x5d4f6239, 0x09329ab6,
+    0x09982e70, 0x5de5d6ff, 0xa163df6e, 0xf51e27e1, 0x5d83babd, 0x09fe4232,
+    0xf5784ba3, 0xa105b32c, 0x5f2969a5, 0x0b54912a, 0xf7d298bb, 0xa3af6034,
+    0x0b32fd68, 0x5f4f05e7, 0xa3c90c76, 0xf7b4f4f9, 0xf71e403f, 0xa363b8b0,
+    0x5fe5b121, 0x0b9849ae, 0xa305d4f2, 0xf7782c7d, 0x0bfe25ec, 0x5f83dd63,
+    0x0aab4c60, 0x5ed6b4ef, 0xa250bd7e, 0xf62d45f1, 0x5eb0d8ad, 0x0acd2022,
+    0xf64b29b3, 0xa236d13c, 0xa29c65fa, 0xf6e19d75, 0x0a6794e4, 0x5e1a6c6b,
+    0xf687f137, 0xa2fa09b8, 0x5e7c0029, 0x0a01f8a6
+  },
+  {
+    0x00000000, 0x4a7ff165, 0x94ffe2ca, 0xde8013af, 0x2c13b365, 0x666c4200,
+    0xb8ec51af, 0xf293a0ca, 0x582766ca, 0x125897af, 0xccd88400, 0x86a77565,
+    0x7434d5af, 0x3e4b24ca, 0xe0cb3765, 0xaab4c600, 0xb04ecd94, 0xfa313cf1,
+    0x24b12f5e, 0x6ecede3b, 0x9c5d7ef1, 0xd6228f94, 0x08a29c3b, 0x42dd6d5e,
+    0xe869ab5e, 0xa2165a3b, 0x7c964994, 0x36e9b8f1, 0xc47a183b, 0x8e05e95e,
+    0x5085faf1, 0x1afa0b94, 0x6571edd9, 0x2f0e1cbc, 0xf18e0f13, 0xbbf1fe76,
+    0x49625ebc, 0x031dafd9, 0xdd9dbc76, 0x97e24d13, 0x3d568b13, 0x77297a76,
+    0xa9a969d9, 0xe3d698bc, 0x11453876, 0x5b3ac913, 0x85badabc, 0xcfc52bd9,
+    0xd53f204d, 0x9f40d128, 0x41c0c287, 0x0bbf33e2, 0xf92c9328, 0xb353624d,
+    0x6dd371e2, 0x27ac8087, 0x8d184687, 0xc767b7e2, 0x19e7a44d, 0x53985528,
+    0xa10bf5e2, 0xeb740487, 0x35f41728, 0x7f8be64d, 0xcae3dbb2, 0x809c2ad7,
+    0x5e1c3978, 0x1463c81d, 0xe6f068d7, 0xac8f99b2, 0x720f8a1d, 0x38707b78,
+    0x92c4bd78, 0xd8bb4c1d, 0x063b5fb2, 0x4c44aed7, 0xbed70e1d, 0xf4a8ff78,
+    0x2a28ecd7, 0x60571db2, 0x7aad1626, 0x30d2e743, 0xee52f4ec, 0xa42d0589,
+    0x56bea543, 0x1cc15426, 0xc2414789, 0x883eb6ec, 0x228a70ec, 0x68f58189,
+    0xb6759226, 0xfc0a6343, 0x0e99c389, 0x44e632ec, 0x9a662143, 0xd019d026,
+    0xaf92366b, 0xe5edc70e, 0x3b6dd4a1, 0x711225c4, 0x8381850e, 0xc9fe746b,
+    0x177e67c4, 0x5d0196a1, 0xf7b550a1, 0xbdcaa1c4, 0x634ab26b, 0x2935430e,
+    0xdba6e3c4, 0x91d912a1, 0x4f59010e, 0x0526f06b, 0x1fdcfbff, 0x55a30a9a,
+    0x8b231935, 0xc15ce850, 0x33cf489a, 0x79b0b9ff, 0xa730aa50, 0xed4f5b35,
+    0x47fb9d35, 0x0d846c50, 0xd3047fff, 0x997b8e9a, 0x6be82e50, 0x2197df35,
+    0xff17cc9a, 0xb5683dff, 0x902bc195, 0xda5430f0, 0x04d4235f, 0x4eabd23a,
+    0xbc3872f0, 0xf6478395, 0x28c7903a, 0x62b8615f, 0xc80ca75f, 0x8273563a,
+    0x5cf34595, 0x168cb4f0, 0xe41f143a, 0xae60e55f, 0x70e0f6f0, 0x3a9f0795,
+    0x20650c01, 0x6a1afd64, 0xb49aeecb, 0xfee51fae, 0x0c76bf64, 0x46094e01,
+    0x98895dae, 0xd2f6accb, 0x78426acb, 0x323d9bae, 0xecbd8801, 0xa6c27964,
+    0x5451d9ae, 0x1e2e28cb, 0xc0ae3b64, 0x8ad1ca01, 0xf55a2c4c, 0xbf25dd29,
+    0x61a5ce86, 0x2bda3fe3, 0xd9499f29, 0x93366e4c, 0x4db67de3, 0x07c98c86,
+    0xad7d4a86, 0xe702bbe3, 0x3982a84c, 0x73fd5929, 0x816ef9e3, 0xcb110886,
+    0x15911b29, 0x5feeea4c, 0x4514e1d8, 0x0f6b10bd, 0xd1eb0312, 0x9b94f277,
+    0x690752bd, 0x2378a3d8, 0xfdf8b077, 0xb7874112, 0x1d338712, 0x574c7677,
+    0x89cc65d8, 0xc3b394bd, 0x31203477, 0x7b5fc512, 0xa5dfd6bd, 0xefa027d8,
+    0x5ac81a27, 0x10b7eb42, 0xce37f8ed, 0x84480988, 0x76dba942, 0x3ca45827,
+    0xe2244b88, 0xa85bbaed, 0x02ef7ced, 0x48908d88, 0x96109e27, 0xdc6f6f42,
+    0x2efccf88, 0x64833eed, 0xba032d42, 0xf07cdc27, 0xea86d7b3, 0xa0f926d6,
+    0x7e793579, 0x3406c41c, 0xc69564d6, 0x8cea95b3, 0x526a861c, 0x18157779,
+    0xb2a1b179, 0xf8de401c, 0x265e53b3, 0x6c21a2d6, 0x9eb2021c, 0xd4cdf379,
+    0x0a4de0d6, 0x403211b3, 0x3fb9f7fe, 0x75c6069b, 0xab461534, 0xe139e451,
+    0x13aa449b, 0x59d5b5fe, 0x8755a651, 0xcd2a5734, 0x679e9134, 0x2de16051,
+    0xf36173fe, 0xb91e829b, 0x4b8d2251, 0x01f2d334, 0xdf72c09b, 0x950d31fe,
+    0x8ff73a6a, 0xc588cb0f, 0x1b08d8a0, 0x517729c5, 0xa3e4890f, 0xe99b786a,
+    0x371b6bc5, 0x7d649aa0, 0xd7d05ca0, 0x9dafadc5, 0x432fbe6a, 0x09504f0f,
+    0xfbc3efc5, 0xb1bc1ea0, 0x6f3c0d0f, 0x2543fc6a
+  },
+  {
+    0x00000000, 0x25bbf5db, 0x4b77ebb6, 0x6ecc1e6d, 0x96efd76c, 0xb35422b7,
+    0xdd983cda, 0xf823c901, 0x2833d829, 0x0d882df2, 0x6344339f, 0x46ffc644,
+    0xbedc0f45, 0x9b67fa9e, 0xf5abe4f3, 0xd0101128, 0x5067b052, 0x75dc4589,
+    0x1b105be4, 0x3eabae3f, 0xc688673e, 0xe33392e5, 0x8dff8c88, 0xa8447953,
+    0x7854687b, 0x5def9da0, 0x332383cd, 0x16987616, 0xeebbbf17, 0xcb004acc,
+    0xa5cc54a1, 0x8077a17a, 0xa0cf60a4, 0x8574957f, 0xebb88b12, 0xce037ec9,
+    0x3620b7c8, 0x139b4213, 0x7d575c7e, 0x58eca9a5, 0x88fcb88d, 0xad474d56,
+    0xc38b533b, 0xe630a6e0, 0x1e136fe1, 0x3ba89a3a, 0x55648457, 0x70df718c,
+    0xf0a8d0f6, 0xd513252d, 0xbbdf3b40, 0x9e64ce9b, 0x6647079a, 0x43fcf241,
+    0x2d30ec2c, 0x088b19f7, 0xd89b08df, 0xfd20fd04, 0x93ece369, 0xb65716b2,
+    0x4e74dfb3, 0x6bcf2a68, 0x05033405, 0x20b8c1de, 0x4472b7b9, 0x61c94262,
+    0x0f055c0f, 0x2abea9d4, 0xd29d60d5, 0xf726950e, 0x99ea8b63, 0xbc517eb8,
+    0x6c416f90, 0x49fa9a4b, 0x27368426, 0x028d71fd, 0xfaaeb8fc, 0xdf154d27,
+    0xb1d9534a, 0x9462a691, 0x141507eb, 0x31aef230, 0x5f62ec5d, 0x7ad91986,
+    0x82fad087, 0xa741255c, 0xc98d3b31, 0xec36ceea, 0x3c26dfc2, 0x199d2a19,
+    0x77513474, 0x52eac1af, 0xaac908ae, 0x8f72fd75, 0xe1bee318, 0xc40516c3,
+    0xe4bdd71d, 0xc10622c6, 0xafca3cab, 0x8a71c970, 0x72520071, 0x57e9f5aa,
+    0x3925ebc7, 0x1c9e1e1c, 0xcc8e0f34, 0xe935faef, 0x87f9e482, 0xa2421159,
+    0x5a61d858, 0x7fda2d83, 0x111633ee, 0x34adc635, 0xb4da674f, 0x91619294,
+    0xffad8cf9, 0xda167922, 0x2235b023, 0x078e45f8, 0x69425b95, 0x4cf9ae4e,
+    0x9ce9bf66, 0xb9524abd, 0xd79e54d0, 0xf225a10b, 0x0a06680a, 0x2fbd9dd1,
+    0x417183bc, 0x64ca7667, 0x88e56f72, 0xad5e9aa9, 0xc39284c4, 0xe629711f,
+    0x1e0ab81e, 0x3bb14dc5, 0x557d53a8, 0x70c6a673, 0xa0d6b75b, 0x856d4280,
+    0xeba15ced, 0xce1aa936, 0x36396037, 0x138295ec, 0x7d4e8b81, 0x58f57e5a,
+    0xd882df20, 0xfd392afb, 0x93f53496, 0xb64ec14d, 0x4e6d084c, 0x6bd6fd97,
+    0x051ae3fa, 0x20a11621, 0xf0b10709, 0xd50af2d2, 0xbbc6ecbf, 0x9e7d1964,
+    0x665ed065, 0x43e525be, 0x2d293bd3, 0x0892ce08, 0x282a0fd6, 0x0d91fa0d,
+    0x635de460, 0x46e611bb, 0xbec5d8ba, 0x9b7e2d61, 0xf5b2330c, 0xd009c6d7,
+    0x0019d7ff, 0x25a22224, 0x4b6e3c49, 0x6ed5c992, 0x96f60093, 0xb34df548,
+    0xdd81eb25, 0xf83a1efe, 0x784dbf84, 0x5df64a5f, 0x333a5432, 0x1681a1e9,
+    0xeea268e8, 0xcb199d33, 0xa5d5835e, 0x806e7685, 0x507e67ad, 0x75c59276,
+    0x1b098c1b, 0x3eb279c0, 0xc691b0c1, 0xe32a451a, 0x8de65b77, 0xa85daeac,
+    0xcc97d8cb, 0xe92c2d10, 0x87e0337d, 0xa25bc6a6, 0x5a780fa7, 0x7fc3fa7c,
+    0x110fe411, 0x34b411ca, 0xe4a400e2, 0xc11ff539, 0xafd3eb54, 0x8a681e8f,
+    0x724bd78e, 0x57f02255, 0x393c3c38, 0x1c87c9e3, 0x9cf06899, 0xb94b9d42,
+    0xd787832f, 0xf23c76f4, 0x0a1fbff5, 0x2fa44a2e, 0x41685443, 0x64d3a198,
+    0xb4c3b0b0, 0x9178456b, 0xffb45b06, 0xda0faedd, 0x222c67dc, 0x07979207,
+    0x695b8c6a, 0x4ce079b1, 0x6c58b86f, 0x49e34db4, 0x272f53d9, 0x0294a602,
+    0xfab76f03, 0xdf0c9ad8, 0xb1c084b5, 0x947b716e, 0x446b6046, 0x61d0959d,
+    0x0f1c8bf0, 0x2aa77e2b, 0xd284b72a, 0xf73f42f1, 0x99f35c9c, 0xbc48a947,
+    0x3c3f083d, 0x1984fde6, 0x7748e38b, 0x52f31650, 0xaad0df51, 0x8f6b2a8a,
+    0xe1a734e7, 0xc41cc13c, 0x140cd014, 0x31b725cf, 0x5f7b3ba2, 0x7ac0ce79,
+    0x82e30778, 0xa758f2a3, 0xc994ecce, 0xec2f1915
+  }
+};
+
+static inline uint32_t _micro_hash_crc32c_shift(const uint32_t table[4][256],
+                                                uint32_t crc)
+{
+  return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff]
+       ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+// Feed 8 bytes, already xored with the CRC, to the slicing tables
+static inline uint32_t _micro_hash_crc32c_slice8(uint64_t w)
+{
+  return _micro_hash_crc32c_table[7][w & 0xff]
+       ^ _micro_hash_crc32c_table[6][(w >> 8) & 0xff]
+       ^ _micro_hash_crc32c_table[5][(w >> 16) & 0xff]
+       ^ _micro_hash_crc32c_table[4][(w >> 24) & 0xff]
+       ^ _micro_hash_crc32c_table[3][(w >> 32) & 0xff]
+       ^ _micro_hash_crc32c_table[2][(w >> 40) & 0xff]
+       ^ _micro_hash_crc32c_table[1][(w >> 48) & 0xff]
+       ^ _micro_hash_crc32c_table[0][w >> 56];
+}
+
+uint32_t micro_hash_bytes_crc32c_scalar(const void *key, size_t key_length)
+{
+  const unsigned char *p = (const unsigned char *) key;
+  uint32_t crc = 0xFFFFFFFF;
+
+  while (key_length >= 8) {
+    crc = _micro_hash_crc32c_slice8(_micro_hash_read64(p) ^ crc);
+    p += 8;
+    key_length -= 8;
+  }
+  while (key_length > 0) {
+    crc = _micro_hash_crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    key_length--;
+  }
+  
+  return ~crc;
+}
+
+uint32_t micro_hash_int64_crc32c_scalar(uint64_t key)
+{
+  return ~_micro_hash_crc32c_slice8(key ^ 0xFFFFFFFF);
+}
+
+#ifdef MICRO_HASH_X86
+
+MICRO_HASH_TARGET("sse4.2")
+static inline uint32_t _micro_hash_crc32c_u64_sse42(uint32_t crc, uint64_t w)
+{
+#ifdef __x86_64__
+  return (uint32_t) _mm_crc32_u64(crc, w);
+#else
+  crc = _mm_crc32_u32(crc, (uint32_t) w);
+  return _mm_crc32_u32(crc, (uint32_t) (w >> 32));
+#endif
+}
+
+// Hash 3 * `length` bytes as three streams of `length` bytes, then
+// merge them by appending `length` zeros to the CRC of the first one
+// with `zeros`. The loop runs one crc32 per stream per iteration, so
+// the three are in flight at the same time.
+MICRO_HASH_TARGET("sse4.2")
+static inline uint32_t _micro_hash_crc32c_3way_sse42(uint32_t crc,
+                                                     const unsigned char *p,
+                                                     size_t length,
+                                                     const uint32_t zeros[4][256])
+{
+  uint32_t crc1 = 0, crc2 = 0;
+  const unsigned char *end = p + length;
+  do {
+    uint64_t w0, w1, w2;
+    memcpy(&w0, p, sizeof(w0));
+    memcpy(&w1, p + length, sizeof(w1));
+    memcpy(&w2, p + 2 * length, sizeof(w2));
+    crc  = _micro_hash_crc32c_u64_sse42(crc, w0);
+    crc1 = _micro_hash_crc32c_u64_sse42(crc1, w1);
+    crc2 = _micro_hash_crc32c_u64_sse42(crc2, w2);
+    p += 8;
+  } while (p < end);
+
+  crc = _micro_hash_crc32c_shift(zeros, crc) ^ crc1;
+  return _micro_hash_crc32c_shift(zeros, crc) ^ crc2;
+}
+
+MICRO_HASH_TARGET("sse4.2")
+uint32_t micro_hash_bytes_crc32c_sse42(const void *key, size_t key_length)
+{
+  const unsigned char *p = (const unsigned char *) key;
+  uint32_t crc = 0xFFFFFFFF;
+
+  // Align the words of the streams
+  while (key_length > 0 && ((uintptr_t) p & 7)) {
+    crc = _mm_crc32_u8(crc, *p++);
+    key_length--;
+  }
+
+  if (key_length >= 3 * MICRO_HASH_CRC32C_SHORT) {
+    while (key_length >= 3 * MICRO_HASH_CRC32C_LONG) {
+      crc = _micro_hash_crc32c_3way_sse42(crc, p, MICRO_HASH_CRC32C_LONG,
+                                          _micro_hash_crc32c_long);
+      p += 3 * MICRO_HASH_CRC32C_LONG;
+      key_length -= 3 * MICRO_HASH_CRC32C_LONG;
+    }
+    while (key_length >= 3 * MICRO_HASH_CRC32C_SHORT) {
+      crc = _micro_hash_crc32c_3way_sse42(crc, p, MICRO_HASH_CRC32C_SHORT,
+                                          _micro_hash_crc32c_short);
+      p += 3 * MICRO_HASH_CRC32C_SHORT;
+      key_length -= 3 * MICRO_HASH_CRC32C_SHORT;
+    }
+  }
+
+  while (key_length >= 8) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    crc = _micro_hash_crc32c_u64_sse42(crc, w);
+    p += 8;
+    key_length -= 8;
+  }
+  while (key_length > 0) {
+    crc = _mm_crc32_u8(crc, *p++);
+    key_length--;
+  }
+
+  return ~crc;
+}
+
+MICRO_HASH_TARGET("sse4.2")
+uint32_t micro_hash_int64_crc32c_sse42(uint64_t key)
+{
+  return ~_micro_hash_crc32c_u64_sse42(0xFFFFFFFF, key);
+}
+
+#endif // MICRO_HASH_X86
+
+uint32_t micro_hash_bytes_crc32c(const void *key, size_t key_length)
+{
+  return _micro_hash_dispatch.bytes_crc32c(key, key_length);
+}
+
+uint32_t micro_hash_int64_crc32c(uint64_t key)
+{
+  return _micro_hash_dispatch.int64_crc32c(key);
+}
+
+// AES
+
+// Digits of pi, used as initial lanes and as round keys
+static const uint64_t _micro_hash_aes_pi[16] = {
+  0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL,
+  0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+  0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL,
+  0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL,
+  0x9216D5D98979FB1BULL, 0xD1310BA698DFB5ACULL,
+  0x2FFD72DBD01ADFB7ULL, 0xB8E1AFED6A267E96ULL,
+  0xBA7C9045F12C7F99ULL, 0x24A19947B3916CF7ULL,
+  0x0801F2E2858EFC16ULL, 0x636920D871574E69ULL,
+};
+
+// Number of 16 bytes lanes hashed in parallel
+#define MICRO_HASH_AES_LANES 8
+
+static const uint8_t _micro_hash_aes_sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+// A 128 bit AES state, in the byte order of an xmm register
+typedef struct {
+  uint8_t b[16];
+} _MicroHashAesBlock;
+
+static inline _MicroHashAesBlock _micro_hash_aes_set(uint64_t lo, uint64_t hi)
+{
+  _MicroHashAesBlock s;
+  for (int i = 0; i < 8; ++i) {
+    s.b[i] = (uint8_t) (lo >> (8 * i));
+    s.b[i + 8] = (uint8_t) (hi >> (8 * i));
+  }
+  return s;
+}
+
+static inline uint8_t _micro_hash_aes_xtime(uint8_t x)
+{
+  return (uint8_t) ((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+// Software version of the AESENC instruction: one round of SubBytes,
+// ShiftRows, MixColumns and AddRoundKey
+static _MicroHashAesBlock _micro_hash_aesenc(_MicroHashAesBlock s,
+                                             _MicroHashAesBlock key)
+{
+  _MicroHashAesBlock t;
+  for (int c = 0; c < 4; ++c)
+    for (int r = 0; r < 4; ++r)
+      t.b[4 * c + r] = _micro_hash_aes_sbox[s.b[4 * ((c + r) & 3) + r]];
+
+  for (int c = 0; c < 4; ++c) {
+    uint8_t *a = &t.b[4 * c];
+    uint8_t all = a[0] ^ a[1] ^ a[2] ^ a[3];
+    s.b[4 * c + 0] = a[0] ^ all ^ _micro_hash_aes_xtime(a[0] ^ a[1]);
+    s.b[4 * c + 1] = a[1] ^ all ^ _micro_hash_aes_xtime(a[1] ^ a[2]);
+    s.b[4 * c + 2] = a[2] ^ all ^ _micro_hash_aes_xtime(a[2] ^ a[3]);
+    s.b[4 * c + 3] = a[3] ^ all ^ _micro_hash_aes_xtime(a[3] ^ a[0]);
+  }
+
+  for (int i = 0; i < 16; ++i)
+    s.b[i] ^= key.b[i];
+  return s;
+}
+
+// Read a key of at most 16 bytes in two words, with overlapping loads
+// instead of a byte loop. The words hold every byte of the key, and
+// go into the state of the round, not its round key: the length is
+// xored in after the round, and would cancel out with the bytes of a
+// key that was only xored in too, like "1" and "113".
+static inline void _micro_hash_aes_read_short(const unsigned char *p,
+                                              size_t length,
+                                              uint64_t *lo, uint64_t *hi)
+{
+  if (length >= 8) {
+    *lo = _micro_hash_read64(p);
+    *hi = _micro_hash_read64(p + length - 8);
+  } else if (length >= 4) {
+    *lo = _micro_hash_read32(p)
+      | ((uint64_t) _micro_hash_read32(p + length - 4) << 32);
+    *hi = 0;
+  } else if (length > 0) {
+    *lo = ((uint64_t) p[0] << 16) | ((uint64_t) p[length >> 1] << 8)
+      | p[length - 1];
+    *hi = 0;
+  } else {
+    *lo = 0;
+    *hi = 0;
+  }
+}
+
+static inline _MicroHashAesBlock _micro_hash_aes_load(const unsigned char *p)
+{
+  _MicroHashAesBlock s;
+  memcpy(s.b, p, 16);
+  return s;
+}
+
+uint64_t micro_hash_bytes_aes_scalar(const void *key, size_t key_length,
+                                     uint64_t seed)
+{
+  const unsigned char *p = (const unsigned char *) key;
+  size_t length = key_length;
+  _MicroHashAesBlock h;
+
+  if (length <= 16) {
+    uint64_t lo, hi;
+    _micro_hash_aes_read_short(p, length, &lo, &hi);
+    h = _micro_hash_aesenc(_micro_hash_aes_set(seed ^ _micro_hash_aes_pi[0] ^ lo,
+                                               _micro_hash_aes_pi[1] ^ hi),
+                           _micro_hash_aes_set(_micro_hash_aes_pi[2],
+                                               _micro_hash_aes_pi[3]));
+  } else {
+    _MicroHashAesBlock acc[MICRO_HASH_AES_LANES];
+    const unsigned char *end = p + length;
+    int j;
+    
+    for (j = 0; j < MICRO_HASH_AES_LANES; ++j)
+      acc[j] = _micro_hash_aes_set(seed ^ _micro_hash_aes_pi[2 * j],
+                                   _micro_hash_aes_pi[2 * j + 1]);
+
+    while (length >= 16 * MICRO_HASH_AES_LANES) {
+      for (j = 0; j < MICRO_HASH_AES_LANES; ++j)
+        acc[j] = _micro_hash_aesenc(acc[j], _micro_hash_aes_load(p + 16 * j));
+      p += 16 * MICRO_HASH_AES_LANES;
+      length -= 16 * MICRO_HASH_AES_LANES;
+    }
+
+    // The last block is the last 16 bytes of the key, overlapping the
+    // block before it
+    for (j = 0; length > 16; ++j) {
+      acc[j] = _micro_hash_aesenc(acc[j], _micro_hash_aes_load(p));
+      p += 16;
+      length -= 16;
+    }
+    if (length > 0)
+      acc[j] = _micro_hash_aesenc(acc[j], _micro_hash_aes_load(end - 16));
+
+    for (int width = MICRO_HASH_AES_LANES / 2; width > 0; width /= 2)
+      for (j = 0; j < width; ++j)
+        acc[j] = _micro_hash_aesenc(acc[j], acc[j + width]);
+    h = acc[0];
+  }
+
+  _MicroHashAesBlock tail = _micro_hash_aes_set((uint64_t) key_length, seed);
+  for (int i = 0; i < 16; ++i)
+    h.b[i] ^= tail.b[i];
+  for (int j = 0; j < 3; ++j)
+    h = _micro_hash_aesenc(h, _micro_hash_aes_set(_micro_hash_aes_pi[2 * j],
+                                                  _micro_hash_aes_pi[2 * j + 1]));
+
+  uint64_t lo = 0, hi = 0;
+  for (int i = 7; i >= 0; --i) {
+    lo = (lo << 8) | h.b[i];
+    hi = (hi << 8) | h.b[i + 8];
+  }
+  return lo ^ hi;
+}
+
+#ifdef MICRO_HASH_X86
+
+MICRO_HASH_TARGET("sse2,aes")
+uint64_t micro_hash_bytes_aes_aesni(const void *key, size_t key_length,
+                                    uint64_t seed)
+{
+  const unsigned char *p = (const unsigned char *) key;
+  size_t length = key_length;
+  __m128i h;
+
+  if (length <= 16) {
+    uint64_t lo, hi;
+    _micro_hash_aes_read_short(p, length, &lo, &hi);
+    h = _mm_aesenc_si128(_mm_set_epi64x((long long) (_micro_hash_aes_pi[1] ^ hi),
+                                        (long long) (seed ^ _micro_hash_aes_pi[0] ^ lo)),
+                         _mm_set_epi64x((long long) _micro_hash_aes_pi[3],
+                                        (long long) _micro_hash_aes_pi[2]));
+  } else {
+    __m128i acc[MICRO_HASH_AES_LANES];
+    const unsigned char *end = p + length;
+    int j;
+
+    for (j = 0; j < MICRO_HASH_AES_LANES; ++j)
+      acc[j] = _mm_set_epi64x((long long) _micro_hash_aes_pi[2 * j + 1],
+                              (long long) (seed ^ _micro_hash_aes_pi[2 * j]));
+
+    while (length >= 16 * MICRO_HASH_AES_LANES) {
+      for (j = 0; j < MICRO_HASH_AES_LANES; ++j)
+        acc[j] = _mm_aesenc_si128(acc[j],
+                                  _mm_loadu_si128((const __m128i *) (p + 16 * j)));
+      p += 16 * MICRO_HASH_AES_LANES;
+      length -= 16 * MICRO_HASH_AES_LANES;
+    }
+
+    for (j = 0; length > 16; ++j) {
+      acc[j] = _mm_aesenc_si128(acc[j], _mm_loadu_si128((const __m128i *) p));
+      p += 16;
+      length -= 16;
+    }
+    if (length > 0)
+      acc[j] = _mm_aesenc_si128(acc[j],
+                                _mm_loadu_si128((const __m128i *) (end - 16)));
+
+    for (int width = MICRO_HASH_AES_LANES / 2; width > 0; width /= 2)
+      for (j = 0; j < width; ++j)
+        acc[j] = _mm_aesenc_si128(acc[j], acc[j + width]);
+    h = acc[0];
+  }
+
+  h = _mm_xor_si128(h, _mm_set_epi64x((long long) seed, (long long) key_length));
+  for (int j = 0; j < 3; ++j)
+    h = _mm_aesenc_si128(h, _mm_set_epi64x((long long) _micro_hash_aes_pi[2 * j + 1],
+                                           (long long) _micro_hash_aes_pi[2 * j]));
+
+  uint64_t half[2];
+  _mm_storeu_si128((__m128i *) half, h);
+  return half[0] ^ half[1];
+}
+
+#endif // MICRO_HASH_X86
+
+uint64_t micro_hash_bytes_aes(const void *key, size_t key_length,
+                              uint64_t seed)
+{
+  return _micro_hash_dispatch.bytes_aes(key, key_length, seed);
+}
+
+// Strings
+  
+#define SIZE_T_BITS           ((sizeof (size_t)) * 8)
+#define ROTATE_LEFT(val, n)   (((val) << (n)) | ((val) >> (SIZE_T_BITS - (n))))
+#define ROTATE_RIGHT(val, n)  (((val) >> (n)) | ((val) << (SIZE_T_BITS - (n))))
+
+// Final mix of micro_hash_str_stb and micro_hash_str_stb_n
+static inline size_t _micro_hash_str_stb_mix(size_t hash, size_t seed)
+{
+  // Thomas Wang 64-to-32 bit mix function, hopefully also works in 32 bits
+  hash ^= seed;
+  hash = (~hash) + (hash << 18);
+  hash ^= hash ^ ROTATE_RIGHT(hash,31);
+  hash = hash * 21;
+  hash ^= hash ^ ROTATE_RIGHT(hash,11);
+  hash += (hash << 6);
+  hash ^= ROTATE_RIGHT(hash,22);
+  return hash+seed;
+}
+
+size_t micro_hash_str_stb(char *str, size_t seed)
+{
+  size_t hash = seed;
+  while (*str)
+     hash = ROTATE_LEFT(hash, 9) + (unsigned char) *str++;
+
+  return _micro_hash_str_stb_mix(hash, seed);
+}
+
+size_t micro_hash_str_stb_n(const char *str, size_t length, size_t seed)
+{
+  const unsigned char *p = (const unsigned char *) str;
+  size_t hash = seed;
+
+  // The rotation does not distribute over the addition, so the steps
+  // stay serial: only the loads and the loop branches are saved
+  while (length >= 8) {
+    uint64_t w = _micro_hash_read64(p);
+    for (int i = 0; i < 64; i += 8)
+      hash = ROTATE_LEFT(hash, 9) + (size_t) ((w >> i) & 0xff);
+    p += 8;
+    length -= 8;
+  }
+  while (length-- > 0)
+    hash = ROTATE_LEFT(hash, 9) + *p++;
+
+  return _micro_hash_str_stb_mix(hash, seed);
+}
+
+#undef ROTATE_LEFT
+#undef ROTATE_RIGHT
+#undef SIZE_T_BITS
+
+// Run 8 steps of hash = hash * m + c, one for each byte c of w
+// starting from the lowest, as
+// hash * m^8 + c0 * m^7 + c1 * m^6 + ... + c7
+static inline unsigned long _micro_hash_str_poly8(unsigned long hash,
+                                                  uint64_t w,
+                                                  unsigned long m)
+{
+#define C(i) ((unsigned long) ((w >> (8 * (i))) & 0xff))
+
+  unsigned long m2 = m * m, m3 = m2 * m, m4 = m2 * m2;
+  hash = hash * m4 + C(0) * m3 + C(1) * m2 + C(2) * m + C(3);
+  return hash * m4 + C(4) * m3 + C(5) * m2 + C(6) * m + C(7);
+
+#undef C
+}
+
+unsigned long micro_hash_str_djb2(unsigned char *str)
+{
+  unsigned long hash = 5381;
+  int c;
+  
+  while ((c = *str++))
+    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+  
+  return hash;
+}
+
+unsigned long micro_hash_str_djb2_n(const unsigned char *str, size_t length)
+{
+  unsigned long hash = 5381;
+
+  while (length >= 8) {
+    hash = _micro_hash_str_poly8(hash, _micro_hash_read64(str), 33);
+    str += 8;
+    length -= 8;
+  }
+  while (length-- > 0)
+    hash = ((hash << 5) + hash) + *str++;
+
+  return hash;
+}
+
+unsigned long micro_hash_str_sdbm(unsigned char *str)
+{
+  unsigned long hash = 0;
+  int c;
+
+  while ((c = *str++))
+    hash = c + (hash << 6) + (hash << 16) - hash;
+
+  return hash;
+}
+
+unsigned long micro_hash_str_sdbm_n(const unsigned char *str, size_t length)
+{
+  unsigned long hash = 0;
+
+  while (length >= 8) {
+    hash = _micro_hash_str_poly8(hash, _micro_hash_read64(str), 65599);
+    str += 8;
+    length -= 8;
+  }
+  while (length-- > 0)
+    hash = *str++ + (hash << 6) + (hash << 16) - hash;
 
   return hash;
 }
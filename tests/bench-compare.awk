@@ -0,0 +1,52 @@
+# SPDX-License-Identifier: MIT
+#
+# Compare two benchmark records written with --format=csv
+#
+#   awk -v threshold=10 -f bench-compare.awk baseline.csv current.csv
+#
+# Prints the results that are more than threshold percent worse than
+# the baseline, and exits with 1 if there is any.
+
+BEGIN {
+  FS = ","
+  if (threshold == "")
+    threshold = 10
+  higher["\"GB/s\""] = 1
+  higher["\"Mkeys/s\""] = 1
+  higher["\"Mops/s\""] = 1
+  lower["\"ns/hash\""] = 1
+  lower["\"cycles/hash\""] = 1
+  lower["\"usec\""] = 1
+}
+
+FNR == 1 { next }
+
+{
+  key = $1 FS $2 FS $3 FS $4
+}
+
+NR == FNR {
+  baseline[key] = $5
+  next
+}
+
+{
+  if (!(key in baseline) || baseline[key] <= 0)
+    next
+  base = baseline[key]
+  change = 100 * ($5 - base) / base
+  if ((($4 in higher) && change < -threshold) ||
+      (($4 in lower) && change > threshold))
+  {
+    gsub(/"/, "", key)
+    printf("regression: %s: %g -> %g (%+.1f%%)\n", key, base, $5, change)
+    regressions++
+  }
+  compared++
+}
+
+END {
+  printf("%d results compared, %d regressions over %g%%\n",
+         compared, regressions, threshold)
+  exit (regressions > 0)
+}
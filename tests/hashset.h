@@ -7,6 +7,25 @@
 // Simple implementation of an hashset in C99 for any type, uses
 // macros.
 //
+// HASHSET_DECLARE probes one slot at a time, HASHSET_CACHED_DECLARE
+// does the same and also stores the hash of each element, and
+// HASHSET_INCREMENTAL_DECLARE spreads each resize over the following
+// operations. HASHSET_SWISS_DECLARE has the same API, and probes 16
+// slots at a time over an array of control bytes, like Abseil's
+// SwissTable. HASHSET_ROBINHOOD_DECLARE has the same API too, and
+// keeps probe lengths short and free of tombstones under inserts and
+// removes.
+//
+// HASHSET_DECLARE, HASHSET_CACHED_DECLARE and HASHSET_SWISS_DECLARE
+// also have insert_many and contains_many, that prefetch the slots of
+// a group of keys before probing them. HASHSET_DECLARE and its
+// variants take their memory from a hashset_allocator. All of them
+// can be sized up front with init_with_capacity and reserve.
+//
+// HASHSET_CONCURRENT_DECLARE has the same API, and can be used by
+// many threads at once without locks. HASHSET_SHARDED_DECLARE can be
+// used by many threads too, with a lock for each shard of the set.
+//
 // Author:  Giovanni Santini
 // Mail:    giovanni.santini@proton.me
 // License: MIT
@@ -19,6 +38,18 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+#if defined(__linux__)
+  #include <sys/mman.h>
+  #if defined(MAP_ANONYMOUS) && defined(MAP_HUGETLB)
+    #define HASHSET_HUGE_PAGES
+  #endif
+#endif
 
 //
 // Configuration
@@ -27,90 +58,1502 @@
 #define HASHSET_INITIAL_CAPACITY 16
 #define HASHSET_MAX_LOAD_FACTOR 0.7
 
+// Load factor of HASHSET_SWISS_DECLARE, deleted slots included. The
+// probes stop at the first group with an empty slot, so it can be
+// higher than HASHSET_MAX_LOAD_FACTOR.
+#define HASHSET_SWISS_MAX_LOAD_FACTOR 0.875
+
+// Slots of the old table moved on each operation of
+// HASHSET_INCREMENTAL_DECLARE while it resizes. Must be at least 2:
+// the old table is then empty before the new one fills up.
+#define HASHSET_INCREMENTAL_STEP 64
+
+// Keys hashed and prefetched at a time by the bulk operations
+#define HASHSET_PREFETCH_GROUP 16
+
+// Slots moved to the next table by each insert of
+// HASHSET_CONCURRENT_DECLARE while it grows. A power of two, at most
+// HASHSET_INITIAL_CAPACITY.
+#define HASHSET_CONCURRENT_MIGRATE_SLOTS 16
+
+// Shards of HASHSET_SHARDED_DECLARE made by init, a power of two
+#define HASHSET_SHARDED_SHARDS 64
+
+// Most shards of HASHSET_SHARDED_DECLARE, a power of two. The bulk
+// operations keep a bitmap of the shards to lock on the stack.
+#define HASHSET_SHARDED_MAX_SHARDS 1024
+
+// Keys locked at a time by the bulk operations of
+// HASHSET_SHARDED_DECLARE, whose hashes are kept on the stack
+#define HASHSET_SHARDED_CHUNK 256
+
+// Size of a cache line, the shards of HASHSET_SHARDED_DECLARE are
+// padded to a multiple of it
+#define HASHSET_CACHE_LINE 64
+
+// Alignment of the allocations of hashset_arena, a cache line
+#define HASHSET_ARENA_ALIGNMENT 64
+
+// Size of a huge page, and the smallest allocation of
+// hashset_huge_allocator that goes on huge pages
+#define HASHSET_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Smallest capacity of HASHSET_SWISS_DECLARE, a probe reads at least
+// a whole group
+#define HASHSET_SWISS_MIN_CAPACITY \
+    (HASHSET_INITIAL_CAPACITY > HASHSET_GROUP_WIDTH \
+     ? HASHSET_INITIAL_CAPACITY : HASHSET_GROUP_WIDTH)
+
+// Load factor of HASHSET_ROBINHOOD_DECLARE
+#define HASHSET_ROBINHOOD_MAX_LOAD_FACTOR 0.9
+
+// Longest probe of HASHSET_ROBINHOOD_DECLARE, the set grows if an
+// insert needs a longer one. Must fit in a uint8_t.
+#define HASHSET_ROBINHOOD_MAX_PROBE 255
+
+// Returns: the smallest power of two capacity, at least min_capacity,
+// that holds count elements within max_load_factor
+static inline size_t hashset_capacity_for(size_t count,
+                                          double max_load_factor,
+                                          size_t min_capacity)
+{
+    size_t capacity = min_capacity;
+    while ((double)count / capacity > max_load_factor)
+        capacity *= 2;
+    return capacity;
+}
+
+// Returns: the capacity to rehash a set into when its used and
+// deleted slots reach the load factor. If the deleted slots are most
+// of them the capacity stays the same, and rehashing only drops them.
+static inline size_t hashset_rehash_capacity(size_t size, size_t capacity,
+                                             double max_load_factor)
+{
+    if ((double)size / capacity > max_load_factor / 2)
+        return capacity * 2;
+    return capacity;
+}
+
+//
+// Control bytes
+//
+// Each slot of a swiss set has a control byte: HASHSET_CTRL_EMPTY,
+// HASHSET_CTRL_DELETED, or the low 7 bits of the hash of its element
+// when used. The first HASHSET_GROUP_WIDTH bytes are copied after the
+// last one, so that a group can be loaded at any slot.
+//
+
+#define HASHSET_GROUP_WIDTH 16
+#define HASHSET_CTRL_EMPTY   ((int8_t) -128)
+#define HASHSET_CTRL_DELETED ((int8_t) -2)
+
+// Returns: a bit for each byte of the group at ctrl equal to value
+static inline uint32_t hashset_group_match(const int8_t *ctrl, int8_t value)
+{
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HASHSET_GROUP_WIDTH; i++)
+        mask |= (uint32_t) (ctrl[i] == value) << i;
+    return mask;
+#endif
+}
+
+// Returns: a bit for each empty or deleted byte of the group at ctrl,
+// which are the only negative ones
+static inline uint32_t hashset_group_match_free(const int8_t *ctrl)
+{
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return (uint32_t) _mm_movemask_epi8(group);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HASHSET_GROUP_WIDTH; i++)
+        mask |= (uint32_t) (ctrl[i] < 0) << i;
+    return mask;
+#endif
+}
+
+// Returns: the index of the lowest set bit of a non zero mask
+static inline int hashset_lowest_bit(uint32_t mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1)) { mask >>= 1; i++; }
+    return i;
+#endif
+}
+
+// Hint that the cache line at address will be read soon
+static inline void hashset_prefetch(const void *address)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void) address;
+#endif
+}
+
+// Returns: the shard of a hash_bits wide hash among 2^shard_bits,
+// from its top bits, as the tables use the low ones
+static inline size_t hashset_shard_index(uint64_t hash, unsigned int hash_bits,
+                                         unsigned int shard_bits)
+{
+    if (shard_bits == 0)
+        return 0;
+    return (size_t) (hash >> (hash_bits - shard_bits))
+           & (((size_t) 1 << shard_bits) - 1);
+}
+
+// Tell the CPU the thread is spinning on a value
+static inline void hashset_cpu_relax(void)
+{
+#if defined(__SSE2__)
+    _mm_pause();
+#endif
+}
+
+//
+// Slot states
+//
+// States of the slots of HASHSET_CONCURRENT_DECLARE. Empty slots are
+// claimed as busy while an element is written, then published as
+// full. Sealed slots end the probes of a full table. Full slots are
+// moving while their element is copied to the next table, then moved.
+//
+
+#define HASHSET_SLOT_EMPTY   0
+#define HASHSET_SLOT_BUSY    1
+#define HASHSET_SLOT_FULL    2
+#define HASHSET_SLOT_DELETED 3
+#define HASHSET_SLOT_SEALED  4
+#define HASHSET_SLOT_MOVING  5
+#define HASHSET_SLOT_MOVED   6
+
+//
+// Allocators
+//
+// HASHSET_DECLARE gets the memory of its tables from an allocator,
+// passed by value to init_with_allocator, or with a capacity to
+// init_with_capacity_and_allocator. free receives the size
+// given to alloc. The default one uses malloc, the arena one bumps a
+// pointer in a caller buffer, and the huge page one maps big tables
+// on huge pages. When alloc returns NULL the set falls back to the
+// malloc one, and aborts if malloc fails too.
+//
+
+typedef struct {
+    void *(*alloc)(void *context, size_t size);
+    void (*free)(void *context, void *ptr, size_t size);
+    void *context;
+} hashset_allocator;
+
+static inline void *hashset_malloc_alloc(void *context, size_t size)
+{
+    (void) context;
+    return malloc(size);
+}
+
+static inline void hashset_malloc_free(void *context, void *ptr, size_t size)
+{
+    (void) context; (void) size;
+    free(ptr);
+}
+
+static inline hashset_allocator hashset_malloc_allocator(void)
+{
+    hashset_allocator allocator = { hashset_malloc_alloc,
+                                    hashset_malloc_free, NULL };
+    return allocator;
+}
+
+// A bump allocator over a caller buffer, for sets that live shorter
+// than the buffer. Freeing only gives back the last allocation, and
+// hashset_arena_reset gives back everything. Allocations that do not
+// fit use malloc.
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t used;
+} hashset_arena;
+
+static inline void hashset_arena_init(hashset_arena *arena,
+                                      void *buffer, size_t size)
+{
+    arena->buffer = (char *) buffer;
+    arena->size = size;
+    arena->used = 0;
+}
+
+static inline void hashset_arena_reset(hashset_arena *arena)
+{
+    arena->used = 0;
+}
+
+static inline void *hashset_arena_alloc(void *context, size_t size)
+{
+    hashset_arena *arena = (hashset_arena *) context;
+    size_t start = (arena->used + HASHSET_ARENA_ALIGNMENT - 1)
+                 & ~(size_t) (HASHSET_ARENA_ALIGNMENT - 1);
+    if (start > arena->size || arena->size - start < size)
+        return malloc(size);
+    arena->used = start + size;
+    return arena->buffer + start;
+}
+
+static inline void hashset_arena_free(void *context, void *ptr, size_t size)
+{
+    hashset_arena *arena = (hashset_arena *) context;
+    char *p = (char *) ptr;
+    if (p < arena->buffer || p >= arena->buffer + arena->size)
+        free(ptr);
+    else if (p + size == arena->buffer + arena->used)
+        arena->used = (size_t) (p - arena->buffer);
+}
+
+static inline hashset_allocator hashset_arena_allocator(hashset_arena *arena)
+{
+    hashset_allocator allocator = { hashset_arena_alloc,
+                                    hashset_arena_free, arena };
+    return allocator;
+}
+
+#if defined(HASHSET_HUGE_PAGES)
+
+// Allocations of at least HASHSET_HUGE_PAGE_SIZE are mapped from the
+// huge page pool, or if it is empty from normal pages the kernel is
+// asked to back with transparent huge pages. Smaller ones use malloc.
+static inline void *hashset_huge_alloc(void *context, size_t size)
+{
+    (void) context;
+    if (size < HASHSET_HUGE_PAGE_SIZE)
+        return malloc(size);
+    size_t length = (size + HASHSET_HUGE_PAGE_SIZE - 1)
+                  & ~(size_t) (HASHSET_HUGE_PAGE_SIZE - 1);
+    void *ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED)
+        return ptr;
+    ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+#if defined(MADV_HUGEPAGE)
+    madvise(ptr, length, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+static inline void hashset_huge_free(void *context, void *ptr, size_t size)
+{
+    (void) context;
+    if (size < HASHSET_HUGE_PAGE_SIZE) {
+        free(ptr);
+        return;
+    }
+    munmap(ptr, (size + HASHSET_HUGE_PAGE_SIZE - 1)
+                & ~(size_t) (HASHSET_HUGE_PAGE_SIZE - 1));
+}
+
+static inline hashset_allocator hashset_huge_allocator(void)
+{
+    hashset_allocator allocator = { hashset_huge_alloc,
+                                    hashset_huge_free, NULL };
+    return allocator;
+}
+
+#endif // HASHSET_HUGE_PAGES
+
 //
 // Macros
 //
 
+// Bulk operations over an array of keys, for the sets that define
+// insert_hashed, contains_hashed and prefetch. Keys are processed in
+// groups of HASHSET_PREFETCH_GROUP: the whole group is hashed and the
+// first slot of each probe is prefetched, then the keys are probed,
+// so the cache misses of a group overlap instead of adding up. The
+// result of each key is stored in results, if not NULL.
+#define HASHSET_BULK_DECLARE(type, prefix, hash_fn, hash_type)                 \
+                                                                               \
+/* Returns: the number of keys inserted, that were not in the set */           \
+static inline size_t prefix##_set_insert_many(prefix##_set *set,               \
+                                              const type *keys, size_t count,  \
+                                              bool *results) {                 \
+    hash_type hashes[HASHSET_PREFETCH_GROUP];                                  \
+    size_t inserted = 0;                                                       \
+    for (size_t i = 0; i < count; i += HASHSET_PREFETCH_GROUP) {               \
+        size_t n = count - i < HASHSET_PREFETCH_GROUP                          \
+                 ? count - i : HASHSET_PREFETCH_GROUP;                         \
+        for (size_t j = 0; j < n; j++) {                                       \
+            hashes[j] = (hash_type) hash_fn(keys[i + j]);                      \
+            prefix##_set_prefetch(set, hashes[j]);                             \
+        }                                                                      \
+        for (size_t j = 0; j < n; j++) {                                       \
+            bool ok = prefix##_set_insert_hashed(set, keys[i + j], hashes[j]); \
+            if (results) results[i + j] = ok;                                  \
+            inserted += ok;                                                    \
+        }                                                                      \
+    }                                                                          \
+    return inserted;                                                           \
+}                                                                              \
+                                                                               \
+/* Returns: the number of keys in the set */                                   \
+static inline size_t prefix##_set_contains_many(prefix##_set *set,             \
+                                                const type *keys, size_t count,\
+                                                bool *results) {               \
+    hash_type hashes[HASHSET_PREFETCH_GROUP];                                  \
+    size_t found = 0;                                                          \
+    for (size_t i = 0; i < count; i += HASHSET_PREFETCH_GROUP) {               \
+        size_t n = count - i < HASHSET_PREFETCH_GROUP                          \
+                 ? count - i : HASHSET_PREFETCH_GROUP;                         \
+        for (size_t j = 0; j < n; j++) {                                       \
+            hashes[j] = (hash_type) hash_fn(keys[i + j]);                      \
+            prefix##_set_prefetch(set, hashes[j]);                             \
+        }                                                                      \
+        for (size_t j = 0; j < n; j++) {                                       \
+            bool ok = prefix##_set_contains_hashed(set, keys[i + j],           \
+                                                   hashes[j]);                 \
+            if (results) results[i + j] = ok;                                  \
+            found += ok;                                                       \
+        }                                                                      \
+    }                                                                          \
+    return found;                                                              \
+}
+
 #define HASHSET_DECLARE(type, prefix, hash_fn, eq_fn)                          \
+    HASHSET_DECLARE_IMPL(type, prefix, hash_fn, eq_fn, 0)
+
+// Like HASHSET_DECLARE, and also stores the full hash of each
+// element. Resizing reads the stored hashes instead of calling
+// hash_fn, and probes call eq_fn only on elements with an equal
+// hash. Worth the extra 8 bytes per slot when hashing or comparing
+// keys is expensive, like with strings.
+#define HASHSET_CACHED_DECLARE(type, prefix, hash_fn, eq_fn)                   \
+    HASHSET_DECLARE_IMPL(type, prefix, hash_fn, eq_fn, 1)
+
+// cache_hash is a constant, the compiler drops the unused branches.
+// Each table is one allocation: the elements, then the hashes if
+// cached, then the states.
+#define HASHSET_DECLARE_IMPL(type, prefix, hash_fn, eq_fn, cache_hash)         \
 typedef struct {                                                               \
     type *data;                                                                \
     uint8_t *state; /* 0=empty,1=used,2=deleted */                             \
+    uint64_t *hashes; /* hash of each used slot, if cache_hash */              \
     size_t size;                                                               \
+    size_t deleted;                                                            \
     size_t capacity;                                                           \
+    hashset_allocator allocator;                                               \
 } prefix##_set;                                                                \
                                                                                \
-static inline void prefix##_set_init(prefix##_set *set) {                      \
+/* Returns: the size of the allocation of a table */                           \
+static inline size_t prefix##_set_bytes(size_t capacity) {                     \
+    return capacity * (sizeof(type) + ((cache_hash) ? sizeof(uint64_t) : 0)    \
+                       + sizeof(uint8_t));                                     \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_alloc(prefix##_set *set, size_t capacity) {    \
+    char *block = (char *) set->allocator.alloc(set->allocator.context,        \
+                                                prefix##_set_bytes(capacity)); \
+    /* An allocator out of memory, like the huge page one without */           \
+    /* huge pages, hands the set over to malloc */                             \
+    if (block == NULL) {                                                       \
+        set->allocator = hashset_malloc_allocator();                           \
+        block = (char *) malloc(prefix##_set_bytes(capacity));                 \
+        if (block == NULL) abort();                                            \
+    }                                                                          \
     set->size = 0;                                                             \
-    set->capacity = HASHSET_INITIAL_CAPACITY;                                  \
-    set->data = malloc(set->capacity * sizeof(type));                          \
-    set->state = calloc(set->capacity, sizeof(uint8_t));                       \
+    set->deleted = 0;                                                          \
+    set->capacity = capacity;                                                  \
+    set->data = (type *) block;                                                \
+    block += capacity * sizeof(type);                                          \
+    set->hashes = (cache_hash) ? (uint64_t *) block : NULL;                    \
+    block += (cache_hash) ? capacity * sizeof(uint64_t) : 0;                   \
+    set->state = (uint8_t *) block;                                            \
+    memset(set->state, 0, capacity);                                           \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init_with_allocator(prefix##_set *set,         \
+                                               hashset_allocator allocator) {  \
+    set->allocator = allocator;                                                \
+    prefix##_set_alloc(set, HASHSET_INITIAL_CAPACITY);                         \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init(prefix##_set *set) {                      \
+    prefix##_set_init_with_allocator(set, hashset_malloc_allocator());         \
 }                                                                              \
                                                                                \
 static inline void prefix##_set_free(prefix##_set *set) {                      \
-    free(set->data);                                                           \
-    free(set->state);                                                          \
-    set->data = NULL; set->state = NULL;                                       \
-    set->size = set->capacity = 0;                                             \
+    if (set->data)                                                             \
+        set->allocator.free(set->allocator.context, set->data,                 \
+                            prefix##_set_bytes(set->capacity));                \
+    set->data = NULL; set->state = NULL; set->hashes = NULL;                   \
+    set->size = set->deleted = set->capacity = 0;                              \
 }                                                                              \
                                                                                \
-static inline size_t prefix##_set_find_slot(prefix##_set *set, type key) {     \
+/* Returns: the slot of key if it is in the set, else the first */             \
+/* deleted or empty slot of its probe. hash is hash_fn(key). */                \
+static inline size_t prefix##_set_find_hashed(prefix##_set *set, type key,     \
+                                              uint64_t hash) {                 \
     size_t mask = set->capacity - 1;                                           \
-    size_t idx = hash_fn(key) & mask;                                          \
-    size_t start = idx;                                                        \
-    while (set->state[idx] == 1 && !eq_fn(set->data[idx], key)) {              \
+    size_t idx = hash & mask;                                                  \
+    size_t free_slot = set->capacity;                                          \
+    for (size_t n = 0; n < set->capacity; n++) {                               \
+        if (set->state[idx] == 0)                                              \
+            return (free_slot != set->capacity) ? free_slot : idx;             \
+        if (set->state[idx] == 2) {                                            \
+            if (free_slot == set->capacity) free_slot = idx;                   \
+        } else if ((!(cache_hash) || set->hashes[idx] == hash)                 \
+                   && eq_fn(set->data[idx], key)) {                            \
+            return idx;                                                        \
+        }                                                                      \
         idx = (idx + 1) & mask;                                                \
-        if (idx == start) return set->capacity; /* full */                     \
     }                                                                          \
-    return idx;                                                                \
+    return free_slot; /* no empty slot */                                      \
+}                                                                              \
+                                                                               \
+static inline size_t prefix##_set_find_slot(prefix##_set *set, type key) {     \
+    return prefix##_set_find_hashed(set, key, (uint64_t) hash_fn(key));        \
 }                                                                              \
                                                                                \
 static inline void prefix##_set_resize(prefix##_set *set, size_t newcap) {     \
-    type *old_data = set->data;                                                \
-    uint8_t *old_state = set->state;                                           \
-    size_t old_cap = set->capacity;                                            \
+    prefix##_set old = *set;                                                   \
+    prefix##_set_alloc(set, newcap);                                           \
+    size_t mask = newcap - 1;                                                  \
                                                                                \
-    set->capacity = newcap;                                                    \
-    set->data = malloc(newcap * sizeof(type));                                 \
-    set->state = calloc(newcap, sizeof(uint8_t));                              \
+    /* The elements are distinct and there are no deleted slots, so */         \
+    /* each one goes in the first empty slot of its probe */                   \
+    for (size_t i = 0; i < old.capacity; i++) {                                \
+        if (old.state[i] != 1) continue;                                       \
+        uint64_t hash = (cache_hash) ? old.hashes[i]                           \
+                                     : (uint64_t) hash_fn(old.data[i]);        \
+        size_t idx = hash & mask;                                              \
+        while (set->state[idx] != 0) idx = (idx + 1) & mask;                   \
+        set->data[idx] = old.data[i];                                          \
+        set->state[idx] = 1;                                                   \
+        if (cache_hash) set->hashes[idx] = hash;                               \
+        set->size++;                                                           \
+    }                                                                          \
+    prefix##_set_free(&old);                                                   \
+}                                                                              \
+                                                                               \
+/* Returns: the capacity that holds count elements without resizing */         \
+static inline size_t prefix##_set_capacity_for(size_t count) {                 \
+    return hashset_capacity_for(count, HASHSET_MAX_LOAD_FACTOR,                \
+                                HASHSET_INITIAL_CAPACITY);                     \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init_with_capacity_and_allocator(              \
+        prefix##_set *set, size_t count, hashset_allocator allocator) {        \
+    set->allocator = allocator;                                                \
+    prefix##_set_alloc(set, prefix##_set_capacity_for(count));                 \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init_with_capacity(prefix##_set *set,          \
+                                                 size_t count) {               \
+    prefix##_set_init_with_capacity_and_allocator(set, count,                  \
+                                              hashset_malloc_allocator());     \
+}                                                                              \
+                                                                               \
+/* Grow the set, if needed, to hold count elements without resizing */         \
+static inline void prefix##_set_reserve(prefix##_set *set, size_t count) {     \
+    size_t capacity = prefix##_set_capacity_for(count);                        \
+    if (capacity < set->capacity) capacity = set->capacity;                    \
+    if (prefix##_set_capacity_for(count + set->deleted) > set->capacity)       \
+        prefix##_set_resize(set, capacity);                                    \
+}                                                                              \
+static inline bool prefix##_set_insert_hashed(prefix##_set *set, type key,     \
+                                              uint64_t hash) {                 \
+    if ((double)(set->size + set->deleted) / set->capacity                     \
+        > HASHSET_MAX_LOAD_FACTOR)                                             \
+        prefix##_set_resize(set, hashset_rehash_capacity(set->size,            \
+                                     set->capacity, HASHSET_MAX_LOAD_FACTOR)); \
+                                                                               \
+    size_t idx = prefix##_set_find_hashed(set, key, hash);                     \
+    if (set->state[idx] == 1) return false; /* already exists */               \
+    if (set->state[idx] == 2) set->deleted--;                                  \
+    set->data[idx] = key;                                                      \
+    set->state[idx] = 1;                                                       \
+    if (cache_hash) set->hashes[idx] = hash;                                   \
+    set->size++;                                                               \
+    return true;                                                               \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_insert(prefix##_set *set, type key) {          \
+    return prefix##_set_insert_hashed(set, key, (uint64_t) hash_fn(key));      \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_contains_hashed(prefix##_set *set, type key,   \
+                                                uint64_t hash) {               \
+    return set->state[prefix##_set_find_hashed(set, key, hash)] == 1;          \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_contains(prefix##_set *set, type key) {        \
+    return prefix##_set_contains_hashed(set, key, (uint64_t) hash_fn(key));    \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_prefetch(prefix##_set *set, uint64_t hash) {   \
+    size_t idx = hash & (set->capacity - 1);                                   \
+    hashset_prefetch(&set->data[idx]);                                         \
+    hashset_prefetch(&set->state[idx]);                                        \
+}                                                                              \
+                                                                               \
+HASHSET_BULK_DECLARE(type, prefix, hash_fn, uint64_t)                          \
+                                                                               \
+static inline bool prefix##_set_remove(prefix##_set *set, type key) {          \
+    size_t idx = prefix##_set_find_slot(set, key);                             \
+    if (set->state[idx] != 1) return false;                                    \
+    set->state[idx] = 2; /* mark deleted */                                    \
+    set->size--;                                                               \
+    set->deleted++;                                                            \
+    return true;                                                               \
+}
+
+// A HASHSET_DECLARE set that grows without stopping: on a resize the
+// old table is kept next to the new one, and each insert, lookup and
+// remove moves the elements of the next HASHSET_INCREMENTAL_STEP slots
+// of the old table to the new one, like Redis dict rehashing. Moved
+// slots are marked deleted, so the probes of the old table still
+// reach the elements after them. The old table is freed once empty.
+#define HASHSET_INCREMENTAL_DECLARE(type, prefix, hash_fn, eq_fn)              \
+HASHSET_DECLARE(type, prefix##_table, hash_fn, eq_fn)                          \
+                                                                               \
+typedef struct {                                                               \
+    prefix##_table_set table;                                                  \
+    prefix##_table_set old; /* capacity 0 when not resizing */                 \
+    size_t cursor; /* next slot of old to move */                              \
+    size_t size;                                                               \
+} prefix##_set;                                                                \
+                                                                               \
+static inline void prefix##_set_init_with_allocator(prefix##_set *set,         \
+                                               hashset_allocator allocator) {  \
+    prefix##_table_set_init_with_allocator(&set->table, allocator);            \
+    memset(&set->old, 0, sizeof(set->old));                                    \
+    set->cursor = 0;                                                           \
+    set->size = 0;                                                             \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init(prefix##_set *set) {                      \
+    prefix##_set_init_with_allocator(set, hashset_malloc_allocator());         \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_free(prefix##_set *set) {                      \
+    prefix##_table_set_free(&set->table);                                      \
+    prefix##_table_set_free(&set->old);                                        \
+    set->cursor = set->size = 0;                                               \
+}                                                                              \
+                                                                               \
+/* Put a key that is not in the table in it, without growing it */            \
+static inline void prefix##_set_place(prefix##_table_set *table, type key) {   \
+    size_t idx = prefix##_table_set_find_slot(table, key);                     \
+    if (table->state[idx] == 2) table->deleted--;                              \
+    table->data[idx] = key;                                                    \
+    table->state[idx] = 1;                                                     \
+    table->size++;                                                             \
+}                                                                              \
+                                                                               \
+/* Move the elements of up to slots slots of the old table */                  \
+static inline void prefix##_set_step(prefix##_set *set, size_t slots) {        \
+    prefix##_table_set *old = &set->old;                                       \
+    if (old->capacity == 0) return;                                            \
+    for (; slots > 0 && set->cursor < old->capacity; slots--, set->cursor++) { \
+        if (old->state[set->cursor] != 1) continue;                            \
+        prefix##_set_place(&set->table, old->data[set->cursor]);               \
+        old->state[set->cursor] = 2;                                           \
+        old->size--;                                                           \
+        old->deleted++;                                                        \
+    }                                                                          \
+    if (set->cursor == old->capacity) {                                        \
+        prefix##_table_set_free(old);                                          \
+        set->cursor = 0;                                                       \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_grow(prefix##_set *set) {                      \
+    /* The step makes sure this only happens with huge removes */              \
+    prefix##_set_step(set, set->old.capacity);                                 \
+    set->old = set->table;                                                     \
+    prefix##_table_set_alloc(&set->table,                                      \
+        hashset_rehash_capacity(set->old.size, set->old.capacity,              \
+                                HASHSET_MAX_LOAD_FACTOR));                     \
+    set->cursor = 0;                                                           \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init_with_capacity_and_allocator(              \
+        prefix##_set *set, size_t count, hashset_allocator allocator) {        \
+    prefix##_table_set_init_with_capacity_and_allocator(&set->table, count,    \
+                                                        allocator);            \
+    memset(&set->old, 0, sizeof(set->old));                                    \
+    set->cursor = 0;                                                           \
+    set->size = 0;                                                             \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init_with_capacity(prefix##_set *set,          \
+                                                 size_t count) {               \
+    prefix##_set_init_with_capacity_and_allocator(set, count,                  \
+                                              hashset_malloc_allocator());     \
+}                                                                              \
+                                                                               \
+/* Grow the set, if needed, to hold count elements without resizing. */        \
+/* Finishes any resize in progress at once. */                                 \
+static inline void prefix##_set_reserve(prefix##_set *set, size_t count) {     \
+    prefix##_set_step(set, set->old.capacity);                                 \
+    prefix##_table_set_reserve(&set->table, count);                            \
+}                                                                              \
+static inline bool prefix##_set_contains(prefix##_set *set, type key) {        \
+    prefix##_set_step(set, HASHSET_INCREMENTAL_STEP);                          \
+    if (prefix##_table_set_contains(&set->table, key)) return true;            \
+    return set->old.capacity != 0                                              \
+        && prefix##_table_set_contains(&set->old, key);                        \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_insert(prefix##_set *set, type key) {          \
+    if (prefix##_set_contains(set, key)) return false; /* already exists */    \
+    prefix##_table_set *table = &set->table;                                   \
+    if ((double)(table->size + table->deleted + 1) / table->capacity           \
+        > HASHSET_MAX_LOAD_FACTOR) {                                           \
+        prefix##_set_grow(set);                                                \
+        prefix##_set_step(set, HASHSET_INCREMENTAL_STEP);                      \
+    }                                                                          \
+    prefix##_set_place(table, key);                                            \
+    set->size++;                                                               \
+    return true;                                                               \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_remove(prefix##_set *set, type key) {          \
+    prefix##_set_step(set, HASHSET_INCREMENTAL_STEP);                          \
+    if (!prefix##_table_set_remove(&set->table, key)                           \
+        && (set->old.capacity == 0                                             \
+            || !prefix##_table_set_remove(&set->old, key)))                    \
+        return false;                                                          \
+    set->size--;                                                               \
+    return true;                                                               \
+}
+
+// The hash is split in h1, the slot where the probe starts, and h2,
+// the 7 bits stored in the control byte. Only the elements whose h2
+// matches are compared with eq_fn, about one in 128 of the others.
+// The probe moves by whole groups and stops at the first group with
+// an empty slot.
+#define HASHSET_SWISS_DECLARE(type, prefix, hash_fn, eq_fn)                    \
+typedef struct {                                                               \
+    type *data;                                                                \
+    int8_t *ctrl; /* capacity + HASHSET_GROUP_WIDTH control bytes */           \
+    size_t size;                                                               \
+    size_t deleted;                                                            \
+    size_t capacity;                                                           \
+} prefix##_set;                                                                \
+                                                                               \
+static inline void prefix##_set_alloc(prefix##_set *set, size_t capacity) {    \
     set->size = 0;                                                             \
+    set->deleted = 0;                                                          \
+    set->capacity = capacity;                                                  \
+    set->data = malloc(capacity * sizeof(type));                               \
+    set->ctrl = malloc(capacity + HASHSET_GROUP_WIDTH);                        \
+    memset(set->ctrl, HASHSET_CTRL_EMPTY, capacity + HASHSET_GROUP_WIDTH);     \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init(prefix##_set *set) {                      \
+    prefix##_set_alloc(set, HASHSET_SWISS_MIN_CAPACITY);                       \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_free(prefix##_set *set) {                      \
+    free(set->data);                                                           \
+    free(set->ctrl);                                                           \
+    set->data = NULL; set->ctrl = NULL;                                        \
+    set->size = set->deleted = set->capacity = 0;                              \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_set_ctrl(prefix##_set *set, size_t idx,        \
+                                         int8_t value) {                       \
+    set->ctrl[idx] = value;                                                    \
+    if (idx < HASHSET_GROUP_WIDTH)                                             \
+        set->ctrl[set->capacity + idx] = value;                                \
+}                                                                              \
                                                                                \
-    for (size_t i = 0; i < old_cap; i++) {                                     \
-        if (old_state[i] == 1) {                                               \
-            type val = old_data[i];                                            \
-            size_t slot = prefix##_set_find_slot(set, val);                    \
+/* Returns: the slot of key, or capacity if it is not in the set */            \
+static inline size_t prefix##_set_find_hashed(prefix##_set *set, type key,     \
+                                              size_t hash) {                   \
+    size_t mask = set->capacity - 1;                                           \
+    int8_t h2 = (int8_t) (hash & 0x7f);                                        \
+    size_t pos = (hash >> 7) & mask;                                           \
+    for (;;) {                                                                 \
+        const int8_t *group = set->ctrl + pos;                                 \
+        uint32_t match = hashset_group_match(group, h2);                       \
+        while (match) {                                                        \
+            size_t idx = (pos + hashset_lowest_bit(match)) & mask;             \
+            if (eq_fn(set->data[idx], key)) return idx;                        \
+            match &= match - 1;                                                \
+        }                                                                      \
+        if (hashset_group_match(group, HASHSET_CTRL_EMPTY))                    \
+            return set->capacity;                                              \
+        pos = (pos + HASHSET_GROUP_WIDTH) & mask;                              \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static inline size_t prefix##_set_find_slot(prefix##_set *set, type key) {     \
+    return prefix##_set_find_hashed(set, key, (size_t) hash_fn(key));          \
+}                                                                              \
+                                                                               \
+/* Returns: the first empty or deleted slot on the probe of hash */            \
+static inline size_t prefix##_set_find_free(prefix##_set *set, size_t hash) {  \
+    size_t mask = set->capacity - 1;                                           \
+    size_t pos = (hash >> 7) & mask;                                           \
+    for (;;) {                                                                 \
+        uint32_t match = hashset_group_match_free(set->ctrl + pos);            \
+        if (match)                                                             \
+            return (pos + hashset_lowest_bit(match)) & mask;                   \
+        pos = (pos + HASHSET_GROUP_WIDTH) & mask;                              \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_resize(prefix##_set *set, size_t newcap) {     \
+    prefix##_set old = *set;                                                   \
+    prefix##_set_alloc(set, newcap);                                           \
+                                                                               \
+    for (size_t i = 0; i < old.capacity; i++) {                                \
+        if (old.ctrl[i] >= 0) {                                                \
+            type val = old.data[i];                                            \
+            size_t hash = (size_t) hash_fn(val);                               \
+            size_t slot = prefix##_set_find_free(set, hash);                   \
             set->data[slot] = val;                                             \
-            set->state[slot] = 1;                                              \
+            prefix##_set_set_ctrl(set, slot, (int8_t) (hash & 0x7f));          \
             set->size++;                                                       \
         }                                                                      \
     }                                                                          \
-    free(old_data); free(old_state);                                           \
+    free(old.data); free(old.ctrl);                                            \
 }                                                                              \
                                                                                \
-static inline bool prefix##_set_insert(prefix##_set *set, type key) {          \
-    if ((double)set->size / set->capacity > HASHSET_MAX_LOAD_FACTOR)           \
-        prefix##_set_resize(set, set->capacity * 2);                           \
+/* Returns: the capacity that holds count elements without resizing */         \
+static inline size_t prefix##_set_capacity_for(size_t count) {                 \
+    return hashset_capacity_for(count, HASHSET_SWISS_MAX_LOAD_FACTOR,          \
+                                HASHSET_SWISS_MIN_CAPACITY);                   \
+}                                                                              \
                                                                                \
-    size_t idx = prefix##_set_find_slot(set, key);                             \
-    if (set->state[idx] == 1) return false; /* already exists */               \
+static inline void prefix##_set_init_with_capacity(prefix##_set *set,          \
+                                                 size_t count) {               \
+    prefix##_set_alloc(set, prefix##_set_capacity_for(count));                 \
+}                                                                              \
+                                                                               \
+/* Grow the set, if needed, to hold count elements without resizing */         \
+static inline void prefix##_set_reserve(prefix##_set *set, size_t count) {     \
+    size_t capacity = prefix##_set_capacity_for(count);                        \
+    if (capacity < set->capacity) capacity = set->capacity;                    \
+    if (prefix##_set_capacity_for(count + set->deleted) > set->capacity)       \
+        prefix##_set_resize(set, capacity);                                    \
+}                                                                              \
+static inline bool prefix##_set_insert_hashed(prefix##_set *set, type key,     \
+                                              size_t hash) {                   \
+    if (prefix##_set_find_hashed(set, key, hash) != set->capacity)             \
+        return false; /* already exists */                                     \
+                                                                               \
+    if ((double)(set->size + set->deleted + 1) / set->capacity                 \
+        > HASHSET_SWISS_MAX_LOAD_FACTOR) {                                     \
+        prefix##_set_resize(set, hashset_rehash_capacity(set->size,            \
+                               set->capacity, HASHSET_SWISS_MAX_LOAD_FACTOR)); \
+    }                                                                          \
+                                                                               \
+    size_t idx = prefix##_set_find_free(set, hash);                            \
+    if (set->ctrl[idx] == HASHSET_CTRL_DELETED) set->deleted--;                \
     set->data[idx] = key;                                                      \
-    set->state[idx] = 1;                                                       \
+    prefix##_set_set_ctrl(set, idx, (int8_t) (hash & 0x7f));                   \
     set->size++;                                                               \
     return true;                                                               \
 }                                                                              \
                                                                                \
+static inline bool prefix##_set_insert(prefix##_set *set, type key) {          \
+    return prefix##_set_insert_hashed(set, key, (size_t) hash_fn(key));        \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_contains_hashed(prefix##_set *set, type key,   \
+                                                size_t hash) {                 \
+    return prefix##_set_find_hashed(set, key, hash) != set->capacity;          \
+}                                                                              \
+                                                                               \
 static inline bool prefix##_set_contains(prefix##_set *set, type key) {        \
+    return prefix##_set_find_slot(set, key) != set->capacity;                  \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_prefetch(prefix##_set *set, size_t hash) {     \
+    size_t pos = (hash >> 7) & (set->capacity - 1);                            \
+    hashset_prefetch(set->ctrl + pos);                                         \
+    hashset_prefetch(&set->data[pos]);                                         \
+}                                                                              \
+                                                                               \
+HASHSET_BULK_DECLARE(type, prefix, hash_fn, size_t)                            \
+                                                                               \
+static inline bool prefix##_set_remove(prefix##_set *set, type key) {          \
     size_t idx = prefix##_set_find_slot(set, key);                             \
-    return set->state[idx] == 1;                                               \
+    if (idx == set->capacity) return false;                                    \
+    prefix##_set_set_ctrl(set, idx, HASHSET_CTRL_DELETED);                     \
+    set->size--;                                                               \
+    set->deleted++;                                                            \
+    return true;                                                               \
+}
+
+// Each slot stores its probe length, the distance from the slot where
+// the probe of its element starts plus one, or 0 if empty. An insert
+// takes the slot of any element with a shorter probe than its own and
+// moves that element on, so probe lengths stay close to the mean. A
+// lookup stops at the first slot with a shorter probe than its own,
+// and a remove shifts the following elements back by one slot instead
+// of leaving a tombstone.
+#define HASHSET_ROBINHOOD_DECLARE(type, prefix, hash_fn, eq_fn)                \
+typedef struct {                                                               \
+    type *data;                                                                \
+    uint8_t *dist; /* 0=empty, else probe length */                            \
+    size_t size;                                                               \
+    size_t capacity;                                                           \
+} prefix##_set;                                                                \
+                                                                               \
+static inline void prefix##_set_alloc(prefix##_set *set, size_t capacity) {    \
+    set->size = 0;                                                             \
+    set->capacity = capacity;                                                  \
+    set->data = malloc(capacity * sizeof(type));                               \
+    set->dist = calloc(capacity, sizeof(uint8_t));                             \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init(prefix##_set *set) {                      \
+    prefix##_set_alloc(set, HASHSET_INITIAL_CAPACITY);                         \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_free(prefix##_set *set) {                      \
+    free(set->data);                                                           \
+    free(set->dist);                                                           \
+    set->data = NULL; set->dist = NULL;                                        \
+    set->size = set->capacity = 0;                                             \
+}                                                                              \
+                                                                               \
+/* Returns: the slot of key, or capacity if it is not in the set */            \
+static inline size_t prefix##_set_find_slot(prefix##_set *set, type key) {     \
+    size_t mask = set->capacity - 1;                                           \
+    size_t idx = hash_fn(key) & mask;                                          \
+    for (unsigned int d = 1; set->dist[idx] >= d; d++) {                       \
+        if (set->dist[idx] == d && eq_fn(set->data[idx], key)) return idx;     \
+        idx = (idx + 1) & mask;                                                \
+    }                                                                          \
+    return set->capacity;                                                      \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_resize(prefix##_set *set, size_t newcap);      \
+                                                                               \
+/* Place a key that is not in the set */                                       \
+static inline void prefix##_set_place(prefix##_set *set, type key) {           \
+    size_t mask = set->capacity - 1;                                           \
+    size_t idx = hash_fn(key) & mask;                                          \
+    unsigned int d = 1;                                                        \
+    for (;;) {                                                                 \
+        if (set->dist[idx] == 0) {                                             \
+            set->data[idx] = key;                                              \
+            set->dist[idx] = (uint8_t) d;                                      \
+            set->size++;                                                       \
+            return;                                                            \
+        }                                                                      \
+        if (set->dist[idx] < d) { /* take the slot, carry its element on */    \
+            type carried = set->data[idx];                                     \
+            unsigned int carried_d = set->dist[idx];                           \
+            set->data[idx] = key;                                              \
+            set->dist[idx] = (uint8_t) d;                                      \
+            key = carried;                                                     \
+            d = carried_d;                                                     \
+        }                                                                      \
+        idx = (idx + 1) & mask;                                                \
+        if (++d > HASHSET_ROBINHOOD_MAX_PROBE) {                               \
+            /* The probe length does not fit, grow and place again */          \
+            prefix##_set_resize(set, set->capacity * 2);                       \
+            prefix##_set_place(set, key);                                      \
+            return;                                                            \
+        }                                                                      \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_resize(prefix##_set *set, size_t newcap) {     \
+    prefix##_set old = *set;                                                   \
+    prefix##_set_alloc(set, newcap);                                           \
+                                                                               \
+    for (size_t i = 0; i < old.capacity; i++)                                  \
+        if (old.dist[i] != 0)                                                  \
+            prefix##_set_place(set, old.data[i]);                              \
+    free(old.data); free(old.dist);                                            \
+}                                                                              \
+                                                                               \
+/* Returns: the capacity that holds count elements without resizing */         \
+static inline size_t prefix##_set_capacity_for(size_t count) {                 \
+    return hashset_capacity_for(count, HASHSET_ROBINHOOD_MAX_LOAD_FACTOR,      \
+                                HASHSET_INITIAL_CAPACITY);                     \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init_with_capacity(prefix##_set *set,          \
+                                                 size_t count) {               \
+    prefix##_set_alloc(set, prefix##_set_capacity_for(count));                 \
+}                                                                              \
+                                                                               \
+/* Grow the set, if needed, to hold count elements without resizing */         \
+static inline void prefix##_set_reserve(prefix##_set *set, size_t count) {     \
+    size_t capacity = prefix##_set_capacity_for(count);                        \
+    if (capacity < set->capacity) capacity = set->capacity;                    \
+    if (prefix##_set_capacity_for(count) > set->capacity)                      \
+        prefix##_set_resize(set, capacity);                                    \
+}                                                                              \
+static inline bool prefix##_set_insert(prefix##_set *set, type key) {          \
+    if (prefix##_set_find_slot(set, key) != set->capacity)                     \
+        return false; /* already exists */                                     \
+    if ((double)(set->size + 1) / set->capacity                                \
+        > HASHSET_ROBINHOOD_MAX_LOAD_FACTOR)                                   \
+        prefix##_set_resize(set, set->capacity * 2);                           \
+    prefix##_set_place(set, key);                                              \
+    return true;                                                               \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_contains(prefix##_set *set, type key) {        \
+    return prefix##_set_find_slot(set, key) != set->capacity;                  \
 }                                                                              \
                                                                                \
 static inline bool prefix##_set_remove(prefix##_set *set, type key) {          \
+    size_t mask = set->capacity - 1;                                           \
     size_t idx = prefix##_set_find_slot(set, key);                             \
-    if (set->state[idx] != 1) return false;                                    \
-    set->state[idx] = 2; /* mark deleted */                                    \
+    if (idx == set->capacity) return false;                                    \
+                                                                               \
+    /* Shift back the elements after it, until an empty slot or an */          \
+    /* element in the first slot of its probe */                               \
+    size_t next = (idx + 1) & mask;                                            \
+    while (set->dist[next] > 1) {                                              \
+        set->data[idx] = set->data[next];                                      \
+        set->dist[idx] = set->dist[next] - 1;                                  \
+        idx = next;                                                            \
+        next = (next + 1) & mask;                                              \
+    }                                                                          \
+    set->dist[idx] = 0;                                                        \
     set->size--;                                                               \
     return true;                                                               \
 }
 
+// A set that many threads can use at once, without locks. Threads
+// claim an empty slot with a compare and swap on its state, write the
+// element, then publish it. Lookups never wait, inserts only wait for
+// an element being written on their probe, to compare it.
+//
+// The set is a chain of tables. Once the last one reaches the load
+// factor, the next insert allocates a new one and the first thread to
+// link it wins. Each probe ends at the first empty slot of a table: a
+// thread that finds one in a full table seals it and moves on to the
+// next table, so an element is only ever inserted in one table. Like
+// in Cliff Click's hash map, every insert then helps move a chunk of
+// HASHSET_CONCURRENT_MIGRATE_SLOTS slots from the first table to the
+// following ones, marking each element moving, then moved. Lookups
+// and removes walk the tables in order. A drained table is unlinked,
+// and freed by the first operation that finds itself alone on the
+// set. Deleted slots are only reclaimed by the migrations.
+//
+// Needs the __atomic builtins of GCC and Clang. init,
+// init_with_capacity and free are not thread safe.
+#define HASHSET_CONCURRENT_DECLARE(type, prefix, hash_fn, eq_fn)               \
+typedef struct prefix##_table {                                                \
+    type *data;                                                                \
+    uint8_t *state; /* one of HASHSET_SLOT_* */                                \
+    size_t capacity;                                                           \
+    size_t used; /* claimed slots, atomic */                                   \
+    size_t migrate_next; /* next chunk to move, atomic */                      \
+    size_t migrated; /* slots moved, atomic */                                 \
+    struct prefix##_table *next; /* atomic */                                  \
+} prefix##_table;                                                              \
+                                                                               \
+typedef struct {                                                               \
+    prefix##_table *head; /* first table not drained, atomic */                \
+    prefix##_table *retired; /* first drained table not freed, atomic */       \
+    size_t active; /* operations running, atomic */                            \
+    size_t size; /* atomic */                                                  \
+} prefix##_set;                                                                \
+                                                                               \
+static inline prefix##_table *prefix##_table_alloc(size_t capacity) {          \
+    prefix##_table *table = malloc(sizeof(prefix##_table));                    \
+    table->data = malloc(capacity * sizeof(type));                             \
+    table->state = calloc(capacity, sizeof(uint8_t));                          \
+    table->capacity = capacity;                                                \
+    table->used = table->migrate_next = table->migrated = 0;                   \
+    table->next = NULL;                                                        \
+    return table;                                                              \
+}                                                                              \
+                                                                               \
+static inline void prefix##_table_free(prefix##_table *table) {                \
+    free(table->data);                                                         \
+    free(table->state);                                                        \
+    free(table);                                                               \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init_with_capacity(prefix##_set *set,          \
+                                                 size_t count) {               \
+    set->head = prefix##_table_alloc(hashset_capacity_for(count,               \
+                    HASHSET_MAX_LOAD_FACTOR, HASHSET_INITIAL_CAPACITY));       \
+    set->retired = set->head;                                                  \
+    set->active = 0;                                                           \
+    set->size = 0;                                                             \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init(prefix##_set *set) {                      \
+    prefix##_set_init_with_capacity(set, 0);                                   \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_free(prefix##_set *set) {                      \
+    prefix##_table *table = set->retired;                                      \
+    while (table) {                                                            \
+        prefix##_table *next = table->next;                                    \
+        prefix##_table_free(table);                                            \
+        table = next;                                                          \
+    }                                                                          \
+    set->head = set->retired = NULL;                                           \
+    set->size = 0;                                                             \
+}                                                                              \
+                                                                               \
+static inline size_t prefix##_set_size(prefix##_set *set) {                    \
+    return __atomic_load_n(&set->size, __ATOMIC_RELAXED);                      \
+}                                                                              \
+                                                                               \
+/* Returns: the first table, the operation can use the tables */               \
+/* from it until prefix##_set_leave */                                         \
+static inline prefix##_table *prefix##_set_enter(prefix##_set *set) {          \
+    __atomic_fetch_add(&set->active, 1, __ATOMIC_SEQ_CST);                     \
+    return __atomic_load_n(&set->head, __ATOMIC_SEQ_CST);                      \
+}                                                                              \
+                                                                               \
+/* Free the drained tables if no other operation can be using them. */         \
+/* Operations that start after the check see at least head. */                 \
+static inline void prefix##_set_leave(prefix##_set *set) {                     \
+    prefix##_table *head = __atomic_load_n(&set->head, __ATOMIC_SEQ_CST);      \
+    if (__atomic_load_n(&set->active, __ATOMIC_SEQ_CST) == 1) {                \
+        prefix##_table *retired =                                              \
+            __atomic_load_n(&set->retired, __ATOMIC_ACQUIRE);                  \
+        while (retired != head) {                                              \
+            prefix##_table *next =                                             \
+                __atomic_load_n(&retired->next, __ATOMIC_RELAXED);             \
+            prefix##_table_free(retired);                                      \
+            retired = next;                                                    \
+        }                                                                      \
+        __atomic_store_n(&set->retired, head, __ATOMIC_RELEASE);               \
+    }                                                                          \
+    __atomic_fetch_sub(&set->active, 1, __ATOMIC_SEQ_CST);                     \
+}                                                                              \
+                                                                               \
+/* Returns: the table after table, allocating it if needed */                  \
+static inline prefix##_table *prefix##_set_next_table(prefix##_set *set,       \
+                                                      prefix##_table *table) { \
+    prefix##_table *next = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);    \
+    if (next) return next;                                                     \
+    prefix##_table *grown = prefix##_table_alloc(hashset_rehash_capacity(      \
+        prefix##_set_size(set), table->capacity, HASHSET_MAX_LOAD_FACTOR));    \
+    if (__atomic_compare_exchange_n(&table->next, &next, grown, false,         \
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))       \
+        return grown;                                                          \
+    prefix##_table_free(grown); /* another thread was first */                 \
+    return next;                                                               \
+}                                                                              \
+                                                                               \
+/* Insert key in table or in the tables after it. Returns: false if */         \
+/* it is already there */                                                      \
+static inline bool prefix##_set_insert_from(prefix##_set *set,                 \
+                                            prefix##_table *table,             \
+                                            type key, size_t hash) {           \
+    for (;;) {                                                                 \
+        size_t mask = table->capacity - 1;                                     \
+        bool full = __atomic_load_n(&table->used, __ATOMIC_RELAXED)            \
+                    >= table->capacity * HASHSET_MAX_LOAD_FACTOR;              \
+        size_t idx = hash & mask;                                              \
+        size_t n = 0;                                                          \
+        while (n < table->capacity) {                                          \
+            uint8_t state = __atomic_load_n(&table->state[idx],                \
+                                            __ATOMIC_ACQUIRE);                 \
+            if (state == HASHSET_SLOT_EMPTY) {                                 \
+                uint8_t claim = full ? HASHSET_SLOT_SEALED                     \
+                                     : HASHSET_SLOT_BUSY;                      \
+                if (!__atomic_compare_exchange_n(&table->state[idx], &state,   \
+                        claim, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))     \
+                    continue; /* lost the slot, look at it again */            \
+                if (full) break;                                               \
+                table->data[idx] = key;                                        \
+                __atomic_store_n(&table->state[idx], HASHSET_SLOT_FULL,        \
+                                 __ATOMIC_RELEASE);                            \
+                __atomic_fetch_add(&table->used, 1, __ATOMIC_RELAXED);         \
+                return true;                                                   \
+            }                                                                  \
+            if (state == HASHSET_SLOT_SEALED) break;                           \
+            if (state == HASHSET_SLOT_BUSY) {                                  \
+                hashset_cpu_relax();                                           \
+                continue; /* wait for the element to compare it */             \
+            }                                                                  \
+            if ((state == HASHSET_SLOT_FULL || state == HASHSET_SLOT_MOVING    \
+                 || state == HASHSET_SLOT_MOVED)                               \
+                && eq_fn(table->data[idx], key)) {                             \
+                if (state != HASHSET_SLOT_MOVED) return false; /* exists */    \
+                break; /* moved, claiming a later slot would duplicate it */   \
+            }                                                                  \
+            idx = (idx + 1) & mask;                                            \
+            n++;                                                               \
+        }                                                                      \
+        table = prefix##_set_next_table(set, table);                           \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+/* Move the element of a slot of table, if any, to the next tables, */         \
+/* and seal the slot if empty */                                               \
+static inline void prefix##_set_migrate_slot(prefix##_set *set,                \
+                                             prefix##_table *table,            \
+                                             size_t idx) {                     \
+    for (;;) {                                                                 \
+        uint8_t state = __atomic_load_n(&table->state[idx], __ATOMIC_ACQUIRE); \
+        if (state == HASHSET_SLOT_BUSY) {                                      \
+            hashset_cpu_relax();                                               \
+            continue;                                                          \
+        }                                                                      \
+        if (state != HASHSET_SLOT_EMPTY && state != HASHSET_SLOT_FULL)         \
+            return; /* deleted or sealed */                                    \
+        uint8_t claim = (state == HASHSET_SLOT_EMPTY) ? HASHSET_SLOT_SEALED    \
+                                                      : HASHSET_SLOT_MOVING;   \
+        if (!__atomic_compare_exchange_n(&table->state[idx], &state, claim,    \
+                false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))                    \
+            continue;                                                          \
+        if (claim == HASHSET_SLOT_MOVING) {                                    \
+            type key = table->data[idx];                                       \
+            prefix##_set_insert_from(set, prefix##_set_next_table(set, table), \
+                                     key, (size_t) hash_fn(key));              \
+            __atomic_store_n(&table->state[idx], HASHSET_SLOT_MOVED,           \
+                             __ATOMIC_RELEASE);                                \
+        }                                                                      \
+        return;                                                                \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+/* Move a chunk of the first table if it is followed by another one, */        \
+/* and unlink it once drained */                                               \
+static inline void prefix##_set_help_migrate(prefix##_set *set,                \
+                                             prefix##_table *head) {           \
+    if (!__atomic_load_n(&head->next, __ATOMIC_ACQUIRE)) return;               \
+    size_t start = __atomic_fetch_add(&head->migrate_next,                     \
+                       HASHSET_CONCURRENT_MIGRATE_SLOTS, __ATOMIC_RELAXED);    \
+    if (start >= head->capacity) return;                                       \
+    for (size_t i = 0; i < HASHSET_CONCURRENT_MIGRATE_SLOTS; i++)              \
+        prefix##_set_migrate_slot(set, head, start + i);                       \
+    if (__atomic_add_fetch(&head->migrated, HASHSET_CONCURRENT_MIGRATE_SLOTS,  \
+                           __ATOMIC_ACQ_REL) == head->capacity)                \
+        __atomic_store_n(&set->head,                                           \
+                         __atomic_load_n(&head->next, __ATOMIC_ACQUIRE),       \
+                         __ATOMIC_SEQ_CST);                                    \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_insert(prefix##_set *set, type key) {          \
+    prefix##_table *head = prefix##_set_enter(set);                            \
+    prefix##_set_help_migrate(set, head);                                      \
+    bool inserted = prefix##_set_insert_from(set, head, key,                   \
+                                             (size_t) hash_fn(key));           \
+    if (inserted) __atomic_fetch_add(&set->size, 1, __ATOMIC_RELAXED);         \
+    prefix##_set_leave(set);                                                   \
+    return inserted;                                                           \
+}                                                                              \
+                                                                               \
+/* Returns: the state of the slot of key, or NULL if it is not in */           \
+/* the set. Elements being inserted are not in the set yet, and */             \
+/* moving ones are found in the table they move to if wait_moving. */          \
+static inline uint8_t *prefix##_set_find_state(prefix##_table *table,          \
+                                               type key, bool wait_moving) {   \
+    size_t hash = (size_t) hash_fn(key);                                       \
+    for (; table; table = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE)) {   \
+        size_t mask = table->capacity - 1;                                     \
+        size_t idx = hash & mask;                                              \
+        for (size_t n = 0; n < table->capacity; n++) {                         \
+            uint8_t state = __atomic_load_n(&table->state[idx],                \
+                                            __ATOMIC_ACQUIRE);                 \
+            if (state == HASHSET_SLOT_EMPTY || state == HASHSET_SLOT_SEALED)   \
+                break;                                                         \
+            if ((state == HASHSET_SLOT_FULL || state == HASHSET_SLOT_MOVING    \
+                 || state == HASHSET_SLOT_MOVED)                               \
+                && eq_fn(table->data[idx], key)) {                             \
+                if (state == HASHSET_SLOT_FULL                                 \
+                    || (state == HASHSET_SLOT_MOVING && !wait_moving))         \
+                    return &table->state[idx];                                 \
+                while (__atomic_load_n(&table->state[idx], __ATOMIC_ACQUIRE)   \
+                       == HASHSET_SLOT_MOVING)                                 \
+                    hashset_cpu_relax();                                       \
+                break; /* moved to a next table */                             \
+            }                                                                  \
+            idx = (idx + 1) & mask;                                            \
+        }                                                                      \
+    }                                                                          \
+    return NULL;                                                               \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_contains(prefix##_set *set, type key) {        \
+    bool found = prefix##_set_find_state(prefix##_set_enter(set), key,         \
+                                         false) != NULL;                       \
+    prefix##_set_leave(set);                                                   \
+    return found;                                                              \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_remove(prefix##_set *set, type key) {          \
+    prefix##_table *head = prefix##_set_enter(set);                            \
+    bool removed = false;                                                      \
+    for (;;) {                                                                 \
+        uint8_t *state = prefix##_set_find_state(head, key, true);             \
+        uint8_t expected = HASHSET_SLOT_FULL;                                  \
+        if (!state) break; /* not in the set */                                \
+        if (__atomic_compare_exchange_n(state, &expected,                      \
+                HASHSET_SLOT_DELETED, false, __ATOMIC_ACQ_REL,                 \
+                __ATOMIC_ACQUIRE)) {                                           \
+            removed = true;                                                    \
+            break;                                                             \
+        }                                                                      \
+        if (expected == HASHSET_SLOT_DELETED)                                  \
+            break; /* removed by another thread */                             \
+        /* moving or moved, look for it again */                               \
+    }                                                                          \
+    if (removed) __atomic_fetch_sub(&set->size, 1, __ATOMIC_RELAXED);          \
+    prefix##_set_leave(set);                                                   \
+    return removed;                                                            \
+}
+
+// A HASHSET_DECLARE set split into shards, each with its own lock, for
+// many threads at once. The top bits of the hash pick the shard and
+// the low ones the slot in its table. The shards are padded to whole
+// cache lines, so that threads on different shards do not share one.
+// Operations on many keys can lock all their shards at once with
+// lock_shards and then use the _locked functions.
+#define HASHSET_SHARDED_DECLARE(type, prefix, hash_fn, eq_fn)                  \
+HASHSET_DECLARE(type, prefix##_shard, hash_fn, eq_fn)                          \
+                                                                               \
+typedef struct {                                                               \
+    pthread_mutex_t lock;                                                      \
+    prefix##_shard_set set;                                                    \
+    char pad[HASHSET_CACHE_LINE - (sizeof(pthread_mutex_t)                     \
+             + sizeof(prefix##_shard_set)) % HASHSET_CACHE_LINE];              \
+} prefix##_shard;                                                              \
+                                                                               \
+typedef struct {                                                               \
+    prefix##_shard *shards; /* aligned to a cache line */                      \
+    void *block; /* allocation of the shards */                                \
+    unsigned int shard_bits;                                                   \
+} prefix##_set;                                                                \
+                                                                               \
+/* Each shard gets the capacity for count / shard_count elements */            \
+static inline void prefix##_set_init_shards(prefix##_set *set,                 \
+                                            size_t shard_count,                \
+                                            size_t count) {                    \
+    unsigned int bits = 0;                                                     \
+    if (shard_count > HASHSET_SHARDED_MAX_SHARDS)                              \
+        shard_count = HASHSET_SHARDED_MAX_SHARDS;                              \
+    while (((size_t) 1 << bits) < shard_count) bits++;                         \
+    shard_count = (size_t) 1 << bits;                                          \
+    set->block = malloc(shard_count * sizeof(prefix##_shard)                   \
+                        + HASHSET_CACHE_LINE);                                 \
+    set->shards = (prefix##_shard *) (((uintptr_t) set->block                  \
+                      + HASHSET_CACHE_LINE - 1)                                \
+                      & ~(uintptr_t) (HASHSET_CACHE_LINE - 1));                \
+    set->shard_bits = bits;                                                    \
+    for (size_t i = 0; i < shard_count; i++) {                                 \
+        pthread_mutex_init(&set->shards[i].lock, NULL);                        \
+        prefix##_shard_set_init_with_capacity(&set->shards[i].set,             \
+            (count + shard_count - 1) / shard_count);                          \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+/* shard_count is rounded up to a power of two, and capped to */               \
+/* HASHSET_SHARDED_MAX_SHARDS */                                               \
+static inline void prefix##_set_init_with_shards(prefix##_set *set,            \
+                                                 size_t shard_count) {         \
+    prefix##_set_init_shards(set, shard_count, 0);                             \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init(prefix##_set *set) {                      \
+    prefix##_set_init_shards(set, HASHSET_SHARDED_SHARDS, 0);                  \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_init_with_capacity(prefix##_set *set,          \
+                                                 size_t count) {               \
+    prefix##_set_init_shards(set, HASHSET_SHARDED_SHARDS, count);              \
+}                                                                              \
+                                                                               \
+static inline size_t prefix##_set_shard_count(prefix##_set *set) {             \
+    return (size_t) 1 << set->shard_bits;                                      \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_free(prefix##_set *set) {                      \
+    for (size_t i = 0; i < prefix##_set_shard_count(set); i++) {               \
+        pthread_mutex_destroy(&set->shards[i].lock);                           \
+        prefix##_shard_set_free(&set->shards[i].set);                          \
+    }                                                                          \
+    free(set->block);                                                          \
+    set->shards = NULL;                                                        \
+    set->block = NULL;                                                         \
+    set->shard_bits = 0;                                                       \
+}                                                                              \
+                                                                               \
+/* Returns: the index of the shard of key */                                   \
+static inline size_t prefix##_set_shard_of(prefix##_set *set, type key) {      \
+    return hashset_shard_index((uint64_t) hash_fn(key),                        \
+                               sizeof(hash_fn(key)) * 8, set->shard_bits);     \
+}                                                                              \
+                                                                               \
+static inline prefix##_shard *prefix##_set_shard_hashed(prefix##_set *set,     \
+                                                       type key,               \
+                                                       uint64_t hash) {        \
+    return &set->shards[hashset_shard_index(hash, sizeof(hash_fn(key)) * 8,    \
+                                            set->shard_bits)];                 \
+}                                                                              \
+                                                                               \
+/* Set the bit of the shard of each key in shards, a zeroed bitmap */          \
+/* of HASHSET_SHARDED_MAX_SHARDS bits, and store the hash of each */           \
+/* key in hashes for the _hashed_locked functions */                           \
+static inline void prefix##_set_mark_shards(prefix##_set *set,                 \
+                                            const type *keys, size_t count,    \
+                                            uint64_t *shards,                  \
+                                            uint64_t *hashes) {                \
+    for (size_t i = 0; i < count; i++) {                                       \
+        hashes[i] = (uint64_t) hash_fn(keys[i]);                               \
+        size_t shard = hashset_shard_index(hashes[i],                          \
+                           sizeof(hash_fn(keys[i])) * 8, set->shard_bits);     \
+        shards[shard / 64] |= (uint64_t) 1 << (shard % 64);                    \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+/* Lock the marked shards in index order, so that threads locking */           \
+/* shards in common do not deadlock */                                         \
+static inline void prefix##_set_lock_shards(prefix##_set *set,                 \
+                                            const uint64_t *shards) {          \
+    for (size_t i = 0; i < prefix##_set_shard_count(set); i++)                 \
+        if ((shards[i / 64] >> (i % 64)) & 1)                                  \
+            pthread_mutex_lock(&set->shards[i].lock);                          \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_unlock_shards(prefix##_set *set,               \
+                                              const uint64_t *shards) {        \
+    for (size_t i = 0; i < prefix##_set_shard_count(set); i++)                 \
+        if ((shards[i / 64] >> (i % 64)) & 1)                                  \
+            pthread_mutex_unlock(&set->shards[i].lock);                        \
+}                                                                              \
+                                                                               \
+/* The _locked functions expect the shard of key locked by the */              \
+/* caller, with prefix##_set_lock_shards */                                    \
+/* hash is hash_fn(key) */                                                     \
+static inline bool prefix##_set_insert_hashed_locked(prefix##_set *set,        \
+                                                     type key,                 \
+                                                     uint64_t hash) {          \
+    return prefix##_shard_set_insert_hashed(                                   \
+        &prefix##_set_shard_hashed(set, key, hash)->set, key, hash);           \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_contains_hashed_locked(prefix##_set *set,      \
+                                                       type key,               \
+                                                       uint64_t hash) {        \
+    return prefix##_shard_set_contains_hashed(                                 \
+        &prefix##_set_shard_hashed(set, key, hash)->set, key, hash);           \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_insert_locked(prefix##_set *set, type key) {   \
+    return prefix##_set_insert_hashed_locked(set, key,                         \
+                                             (uint64_t) hash_fn(key));         \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_contains_locked(prefix##_set *set,             \
+                                                type key) {                    \
+    return prefix##_set_contains_hashed_locked(set, key,                       \
+                                               (uint64_t) hash_fn(key));       \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_remove_locked(prefix##_set *set, type key) {   \
+    uint64_t hash = (uint64_t) hash_fn(key);                                   \
+    return prefix##_shard_set_remove(                                          \
+        &prefix##_set_shard_hashed(set, key, hash)->set, key);                 \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_insert(prefix##_set *set, type key) {          \
+    uint64_t hash = (uint64_t) hash_fn(key);                                   \
+    prefix##_shard *shard = prefix##_set_shard_hashed(set, key, hash);         \
+    pthread_mutex_lock(&shard->lock);                                          \
+    bool inserted = prefix##_shard_set_insert_hashed(&shard->set, key, hash);  \
+    pthread_mutex_unlock(&shard->lock);                                        \
+    return inserted;                                                           \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_contains(prefix##_set *set, type key) {        \
+    uint64_t hash = (uint64_t) hash_fn(key);                                   \
+    prefix##_shard *shard = prefix##_set_shard_hashed(set, key, hash);         \
+    pthread_mutex_lock(&shard->lock);                                          \
+    bool found = prefix##_shard_set_contains_hashed(&shard->set, key, hash);   \
+    pthread_mutex_unlock(&shard->lock);                                        \
+    return found;                                                              \
+}                                                                              \
+                                                                               \
+static inline bool prefix##_set_remove(prefix##_set *set, type key) {          \
+    uint64_t hash = (uint64_t) hash_fn(key);                                   \
+    prefix##_shard *shard = prefix##_set_shard_hashed(set, key, hash);         \
+    pthread_mutex_lock(&shard->lock);                                          \
+    bool removed = prefix##_shard_set_remove(&shard->set, key);                \
+    pthread_mutex_unlock(&shard->lock);                                        \
+    return removed;                                                            \
+}                                                                              \
+                                                                               \
+/* Returns: the number of elements, locking one shard at a time */             \
+static inline size_t prefix##_set_size(prefix##_set *set) {                    \
+    size_t size = 0;                                                           \
+    for (size_t i = 0; i < prefix##_set_shard_count(set); i++) {               \
+        pthread_mutex_lock(&set->shards[i].lock);                              \
+        size += set->shards[i].set.size;                                       \
+        pthread_mutex_unlock(&set->shards[i].lock);                            \
+    }                                                                          \
+    return size;                                                               \
+}                                                                              \
+                                                                               \
+/* Like the bulk operations of HASHSET_DECLARE, locking the shards */          \
+/* of HASHSET_SHARDED_CHUNK keys at a time once, and hashing each */           \
+/* key once. Returns: the number of keys inserted */                           \
+static inline size_t prefix##_set_insert_many(prefix##_set *set,               \
+                                              const type *keys, size_t count,  \
+                                              bool *results) {                 \
+    uint64_t shards[HASHSET_SHARDED_MAX_SHARDS / 64];                          \
+    uint64_t hashes[HASHSET_SHARDED_CHUNK];                                    \
+    size_t inserted = 0;                                                       \
+    for (size_t start = 0; start < count; start += HASHSET_SHARDED_CHUNK) {    \
+        size_t n = count - start;                                              \
+        if (n > HASHSET_SHARDED_CHUNK) n = HASHSET_SHARDED_CHUNK;              \
+        memset(shards, 0, sizeof(shards));                                     \
+        prefix##_set_mark_shards(set, keys + start, n, shards, hashes);        \
+        prefix##_set_lock_shards(set, shards);                                 \
+        for (size_t i = 0; i < n; i++) {                                       \
+            bool ok = prefix##_set_insert_hashed_locked(set, keys[start + i],  \
+                                                        hashes[i]);            \
+            if (results) results[start + i] = ok;                              \
+            inserted += ok;                                                    \
+        }                                                                      \
+        prefix##_set_unlock_shards(set, shards);                               \
+    }                                                                          \
+    return inserted;                                                           \
+}                                                                              \
+                                                                               \
+/* Returns: the number of keys in the set */                                   \
+static inline size_t prefix##_set_contains_many(prefix##_set *set,             \
+                                                const type *keys, size_t count,\
+                                                bool *results) {               \
+    uint64_t shards[HASHSET_SHARDED_MAX_SHARDS / 64];                          \
+    uint64_t hashes[HASHSET_SHARDED_CHUNK];                                    \
+    size_t found = 0;                                                          \
+    for (size_t start = 0; start < count; start += HASHSET_SHARDED_CHUNK) {    \
+        size_t n = count - start;                                              \
+        if (n > HASHSET_SHARDED_CHUNK) n = HASHSET_SHARDED_CHUNK;              \
+        memset(shards, 0, sizeof(shards));                                     \
+        prefix##_set_mark_shards(set, keys + start, n, shards, hashes);        \
+        prefix##_set_lock_shards(set, shards);                                 \
+        for (size_t i = 0; i < n; i++) {                                       \
+            bool ok = prefix##_set_contains_hashed_locked(set, keys[start + i],\
+                                                          hashes[i]);          \
+            if (results) results[start + i] = ok;                              \
+            found += ok;                                                       \
+        }                                                                      \
+        prefix##_set_unlock_shards(set, shards);                               \
+    }                                                                          \
+    return found;                                                              \
+}
+
 //
 // Examples
 //
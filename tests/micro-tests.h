@@ -515,7 +515,7 @@ MicroTest *_micro_tests_get_next_test(MicroTests *micro_tests)
           _micro_tests_strcmp(micro_tests->run_test, current->test_name) != 0)
         continue;
 
-      micro_tests_current++;
+      micro_tests_current = i + 1;
       pthread_mutex_unlock(&micro_tests_current_mutex);
       return current;
     }
@@ -567,6 +567,7 @@ int _micro_tests_run_multithreaded(MicroTests *micro_tests)
     perror("pthread_mutex_init");
     return -1;
   }
+  micro_tests_current = 0;
   
   pthread_t *thread_buff = MICRO_TESTS_CALLOC(sizeof(pthread_t),
                                               micro_tests->thread_number);
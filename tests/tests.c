@@ -5,14 +5,27 @@
 // -----
 //
 // This program calculates the number of collisions and the hash
-// uniformity of the hash functions
+// uniformity of the hash functions, over random integers and over
+// corpora of string keys, runs statistical quality tests on all of
+// them, and measures their speed. Run only one table with
+// --suite, like --suite quality_tests or --suite timing_tests, and
+// print the results as records with --format=json or --format=csv.
 //
 
-// Number of iterations
+// Number of iterations, can be set with -DITERATIONS=n
 //
 // !!!Warning: memory space and execution time scales linearly with
 // the number of iterations!!!
+#ifndef ITERATIONS
 #define ITERATIONS 10000000 // 40 MB
+#endif
+
+// Threads counting the collisions of each hash function, 0 to share
+// the CPUs with the other tests of a multithreaded run, can be set
+// with -DCOLLISION_THREADS=n
+#ifndef COLLISION_THREADS
+#define COLLISION_THREADS 0
+#endif
 
 // Precision of the uniformity estimate (higher is better)
 //
@@ -20,10 +33,59 @@
 // memory required = (2^PRECISION)*8 bytes.
 #define PRECISION 12
 
+// Minimum time spent measuring each throughput row, in seconds
+#define BENCH_MIN_SECONDS 0.05
+
+// Number of keys of the hash set benchmarks, enough for the tables
+// to not fit in the caches
+#define HASHSET_BENCH_KEYS (1 << 22)
+
+// Number of keys in the sets of the churn benchmark, each round
+// removes one and inserts a new one
+#define CHURN_KEYS   (1 << 20)
+#define CHURN_ROUNDS (4 * CHURN_KEYS)
+
+// Number of keys of the string hash set benchmark
+#define HASHSET_STR_KEYS (1 << 19)
+#define HASHSET_STR_KEY_SIZE 48
+
+// Sets created, filled and freed by the short-lived set benchmark,
+// and keys inserted in each
+#define SHORT_LIVED_SETS 4096
+#define SHORT_LIVED_KEYS 1000
+
+// Threads and keys of the concurrent hash set tests
+#define CONCURRENT_THREADS 8
+#define CONCURRENT_KEYS (1 << 18)
+
+// Keys inserted at a time by the sharded hash set test, a divisor of
+// CONCURRENT_KEYS
+#define SHARDED_BATCH 256
+
+// Random keys of the avalanche tests of each hash function, can be
+// set with -DQUALITY_KEYS=n. The bit independence and differential
+// tests hash many more keys for each, and run on fewer.
+#ifndef QUALITY_KEYS
+#define QUALITY_KEYS (1 << 15)
+#endif
+#define QUALITY_BIC_KEYS  (QUALITY_KEYS / 8)
+#define QUALITY_DIFF_KEYS (QUALITY_KEYS / 32)
+
+// Keys of the cyclic and chi-squared tests of each hash function
+#define QUALITY_CYCLIC_KEYS (1 << 18)
+#define QUALITY_CHI_KEYS    (1 << 20)
+
+// Keys of each corpus of the corpus tests, and their maximum size
+#define CORPUS_KEYS (1 << 18)
+#define CORPUS_KEY_SIZE 64
+
 //
 // Program
 //
 
+#define _POSIX_C_SOURCE 199309L // clock_gettime
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS and MAP_HUGETLB
+
 #define MICRO_TESTS_MULTITHREADED
 #define MICRO_TESTS_IMPLEMENTATION
 #include "micro-tests.h"
@@ -34,6 +96,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <x86intrin.h>
+  #define TESTS_TSC
+#endif
+
+#if defined(__linux__)
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #define TESTS_PERF
+#endif
 
 // LCG pseudo random number generator
 #define MAGIC1_32 1664525    // a
@@ -57,30 +135,411 @@ inline double absd(double x)
   return (x > 0.0) ? x : -x;
 }
 
-#define COUNT_COLLISIONS(__hash_func, __hash_unit, __hashset_prefix, __rng_func, __count, __collisions) \
-  do {                                                                  \
-    __collisions = 0;                                                   \
-    __hash_unit random = __rng_func(6969);                              \
-    __hash_unit hash;                                                   \
+// Get the square root of a non negative double, without libm
+static double sqrtd(double x)
+{
+  if (x <= 0.0)
+    return 0.0;
+  double root = (x > 1.0) ? x : 1.0;
+  for (int i = 0; i < 64; ++i)
+  {
+    double next = 0.5 * (root + x / root);
+    if (next >= root)
+      break;
+    root = next;
+  }
+  return root;
+}
+
+//
+// Output
+//
+// The tables are printed as text, or with --format=json or
+// --format=csv as one record for each measurement: the table, the
+// name and the variant of its row, the metric and its value. Names
+// and metrics never contain quotes or commas.
+//
+
+typedef enum {
+  FORMAT_TABLE,
+  FORMAT_JSON,
+  FORMAT_CSV,
+} output_format;
+
+static output_format format = FORMAT_TABLE;
+
+// Records are printed by many threads at once
+static pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool record_first = true;
+
+static void print_record(const char *table, const char *name,
+                         const char *variant, const char *metric,
+                         double value)
+{
+  pthread_mutex_lock(&record_mutex);
+  if (format == FORMAT_JSON)
+    printf("%s\n  {\"table\": \"%s\", \"name\": \"%s\", \"variant\": \"%s\", "
+           "\"metric\": \"%s\", \"value\": %.12g}",
+           record_first ? "" : ",", table, name, variant, metric, value);
+  else
+    printf("\"%s\",\"%s\",\"%s\",\"%s\",%.12g\n",
+           table, name, variant, metric, value);
+  record_first = false;
+  pthread_mutex_unlock(&record_mutex);
+}
+
+static void print_records_start(void)
+{
+  if (format == FORMAT_JSON)
+    printf("[");
+  else if (format == FORMAT_CSV)
+    printf("table,name,variant,metric,value\n");
+}
+
+static void print_records_end(void)
+{
+  if (format == FORMAT_JSON)
+    printf("\n]\n");
+}
+
+// Remove the --format=<format> arguments and set format
+//
+// Returns: -1 if a format is not known, else 0
+static int parse_format(int *argc, char **argv)
+{
+  int out = 0;
+  for (int i = 1; i < *argc; ++i)
+  {
+    if (strncmp(argv[i], "--format=", 9) != 0)
+      continue;
+    const char *name = argv[i] + 9;
+    if (strcmp(name, "table") == 0)
+      format = FORMAT_TABLE;
+    else if (strcmp(name, "json") == 0)
+      format = FORMAT_JSON;
+    else if (strcmp(name, "csv") == 0)
+      format = FORMAT_CSV;
+    else
+    {
+      fprintf(stderr, "Usage: --format=table|json|csv\n");
+      out = -1;
+    }
+    for (int j = i; j < *argc - 1; ++j)
+      argv[j] = argv[j + 1];
+    (*argc)--;
+    i--;
+  }
+  return out;
+}
+
+//
+// Hardware counters
+//
+// Counted with perf_event_open for the calling thread, in user space
+// only. Each counter is opened on its own, so the ones the CPU or the
+// kernel do not have, like in most containers and virtual machines,
+// are just missing. When the kernel multiplexes them, the counts are
+// scaled to the whole time they were enabled.
+//
+
+enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_BRANCH_MISSES,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_DTLB_MISSES,
+  PERF_COUNTERS
+};
+
+typedef struct {
+  int fd[PERF_COUNTERS]; // -1 if not available
+} perf_counters;
+
+typedef struct {
+  uint64_t value[PERF_COUNTERS];
+  bool valid[PERF_COUNTERS];
+} perf_counts;
+
+#ifdef TESTS_PERF
+
+#define PERF_CACHE_READ_MISS(__cache)                                   \
+  ((__cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8)                       \
+   | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static void perf_counters_open(perf_counters *counters)
+{
+  static const struct {
+    uint32_t type;
+    uint64_t config;
+  } events[PERF_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+    { PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+  };
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+  {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                       | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    counters->fd[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+}
+
+static void perf_counters_start(perf_counters *counters)
+{
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+    if (counters->fd[i] >= 0)
+    {
+      ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static void perf_counters_stop(perf_counters *counters, perf_counts *counts)
+{
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+  {
+    uint64_t data[3]; // value, time enabled, time running
+    counts->valid[i] = false;
+    counts->value[i] = 0;
+    if (counters->fd[i] < 0)
+      continue;
+    ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counters->fd[i], data, sizeof(data)) != sizeof(data)
+        || data[2] == 0)
+      continue;
+    counts->value[i] = (uint64_t) ((double) data[0] * data[1] / data[2]);
+    counts->valid[i] = true;
+  }
+}
+
+static void perf_counters_close(perf_counters *counters)
+{
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+    if (counters->fd[i] >= 0)
+      close(counters->fd[i]);
+}
+
+#else
+
+static void perf_counters_open(perf_counters *counters)
+{
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+    counters->fd[i] = -1;
+}
+
+static void perf_counters_start(perf_counters *counters)
+{
+  (void) counters;
+}
+
+static void perf_counters_stop(perf_counters *counters, perf_counts *counts)
+{
+  (void) counters;
+  memset(counts, 0, sizeof(*counts));
+}
+
+static void perf_counters_close(perf_counters *counters)
+{
+  (void) counters;
+}
+
+#endif // TESTS_PERF
+
+// Add the counts of b to a, a counter stays valid only if valid in
+// both
+static void perf_counts_add(perf_counts *a, const perf_counts *b)
+{
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+  {
+    a->value[i] += b->value[i];
+    a->valid[i] = a->valid[i] && b->valid[i];
+  }
+}
+
+// Columns of the counters in the collision table: instructions per
+// cycle, then misses per key of each counter from PERF_BRANCH_MISSES
+#define COUNTER_COLUMNS (1 + PERF_COUNTERS - PERF_BRANCH_MISSES)
+
+static const char *counter_column_names[COUNTER_COLUMNS] = {
+  "IPC", "branch misses/key", "L1D misses/key", "LLC misses/key",
+  "dTLB misses/key",
+};
+
+// Returns: false if the counters of a column are missing, else true
+// with its value in value
+static bool counter_column(const perf_counts *counts, int column,
+                           double keys, double *value)
+{
+  if (column == 0)
+  {
+    if (!counts->valid[PERF_CYCLES] || !counts->valid[PERF_INSTRUCTIONS]
+        || counts->value[PERF_CYCLES] == 0)
+      return false;
+    *value = (double) counts->value[PERF_INSTRUCTIONS]
+             / counts->value[PERF_CYCLES];
+    return true;
+  }
+  int counter = PERF_BRANCH_MISSES + column - 1;
+  if (!counts->valid[counter])
+    return false;
+  *value = counts->value[counter] / keys;
+  return true;
+}
+
+// Format the counter columns into buffer, as the last columns of a
+// table row, with "-" for the missing counters
+static void format_counters(char *buffer, size_t size,
+                            const perf_counts *counts, double keys)
+{
+  char columns[COUNTER_COLUMNS][16];
+  for (int i = 0; i < COUNTER_COLUMNS; ++i)
+  {
+    double value;
+    if (counter_column(counts, i, keys, &value))
+      snprintf(columns[i], sizeof(columns[i]), (i == 0) ? "%.2f" : "%.3f",
+               value);
+    else
+      snprintf(columns[i], sizeof(columns[i]), "-");
+  }
+  snprintf(buffer, size, " %-5s | %-8s | %-8s | %-8s | %-8s |", columns[0],
+           columns[1], columns[2], columns[3], columns[4]);
+}
+
+// Hashes inserted at a time with insert_many by COUNT_COLLISIONS
+#define COLLISION_CHUNK 1024
+
+typedef struct {
+  unsigned int partition;
+  unsigned int partitions;
+  unsigned int *count; // histogram of the hashes of the partition
+  size_t collisions;
+  perf_counts counts; // hardware counters of the thread
+} collision_job;
+
+// Returns: the partition of a hash_bits wide hash among partitions,
+// from its top 16 bits. The hash set and the histogram use the low
+// bits, so they stay as uniform within each partition.
+static inline unsigned int collision_partition(uint64_t hash,
+                                               unsigned int hash_bits,
+                                               unsigned int partitions)
+{
+  return (unsigned int) ((((hash >> (hash_bits - 16)) & 0xffff) * partitions) >> 16);
+}
+
+// Declare __hash_func##_collision_job, that goes over the whole
+// stream of __key_unit keys and counts the collisions of the
+// __hash_unit hashes of its partition.
+// Equal hashes are in the same partition, so the counts of all the
+// partitions add up to the exact count.
+#define COLLISION_JOB_DECLARE(__hash_func, __key_unit, __hash_unit, __hashset_prefix, __rng_func) \
+  static void *__hash_func##_collision_job(void *arg)                   \
+  {                                                                     \
+    collision_job *job = (collision_job *) arg;                         \
+    __key_unit random = __rng_func(6969);                               \
+    __hash_unit hashes[COLLISION_CHUNK];                                \
+    bool inserted[COLLISION_CHUNK];                                     \
+    unsigned int n = 0;                                                 \
     __hashset_prefix##_set s;                                           \
-    __hashset_prefix##_set_init(&s);                                    \
-    for (unsigned int i = 0; i < ITERATIONS; ++i)                       \
+    __hashset_prefix##_set_init_with_capacity(&s,                       \
+        ITERATIONS / job->partitions + ITERATIONS / job->partitions / 16); \
+    perf_counters counters;                                             \
+    perf_counters_open(&counters);                                      \
+    perf_counters_start(&counters);                                     \
+    for (size_t i = 0; i < ITERATIONS; ++i)                             \
     {                                                                   \
-      hash = __hash_func(random);                                       \
+      __hash_unit hash = __hash_func(random);                           \
       random = __rng_func(random);                                      \
-      if (!__hashset_prefix##_set_insert(&s, hash))                     \
+      if (collision_partition(hash, sizeof(hash) * 8, job->partitions)  \
+          == job->partition)                                            \
+        hashes[n++] = hash;                                             \
+      if (n == COLLISION_CHUNK || (i == ITERATIONS - 1 && n > 0))       \
       {                                                                 \
-        __collisions++;                                                 \
-        continue;                                                       \
+        job->collisions += n - __hashset_prefix##_set_insert_many(&s, hashes, n, inserted); \
+        for (unsigned int j = 0; j < n; ++j)                            \
+          if (inserted[j])                                              \
+            job->count[hashes[j] % (1 << PRECISION)]++;                 \
+        n = 0;                                                          \
       }                                                                 \
-      __count[hash % (1 << PRECISION)]++;                               \
     }                                                                   \
-  } while (0)
+    perf_counters_stop(&counters, &job->counts);                        \
+    perf_counters_close(&counters);                                     \
+    __hashset_prefix##_set_free(&s);                                    \
+    return NULL;                                                        \
+  }
+
+// Count the collisions of ITERATIONS hashes with the job of
+// __hash_func, split into one partition for each of
+// COLLISION_THREADS threads, add the histograms of the partitions to
+// __count and store the hardware counters of all the threads in
+// __counts
+#define COUNT_COLLISIONS(__hash_func, __count, __collisions, __counts)  \
+  __collisions = (unsigned int) count_collisions(__hash_func##_collision_job, \
+                                                 __count, &__counts)
+
+// Threads running the tests of the current suite, set by run_table
+static unsigned int suite_threads = 1;
+
+static size_t count_collisions(void *(*job_func)(void *), unsigned int *count,
+                               perf_counts *counts)
+{
+  unsigned int thread_count = COLLISION_THREADS;
+  if (thread_count == 0)
+  {
+    // Each test of the suite gets its share of the CPUs, so that
+    // --threads n does not start n times one thread per CPU
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = (cpus > 0) ? (unsigned int) cpus / suite_threads : 1;
+    if (thread_count == 0)
+      thread_count = 1;
+  }
+  if (thread_count > 0xffff)
+    thread_count = 0xffff;
+
+  pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+  collision_job *jobs = malloc(thread_count * sizeof(collision_job));
+  for (unsigned int i = 0; i < thread_count; ++i)
+  {
+    jobs[i].partition = i;
+    jobs[i].partitions = thread_count;
+    jobs[i].count = calloc(1 << PRECISION, sizeof(unsigned int));
+    jobs[i].collisions = 0;
+    pthread_create(&threads[i], NULL, job_func, &jobs[i]);
+  }
 
-#define UNIFORMITY_DEVIATION(__deviation, __count)              \
+  size_t collisions = 0;
+  memset(counts, 0, sizeof(*counts));
+  for (int i = 0; i < PERF_COUNTERS; ++i)
+    counts->valid[i] = true;
+  for (unsigned int i = 0; i < thread_count; ++i)
+  {
+    pthread_join(threads[i], NULL);
+    collisions += jobs[i].collisions;
+    perf_counts_add(counts, &jobs[i].counts);
+    for (unsigned int b = 0; b < (1 << PRECISION); ++b)
+      count[b] += jobs[i].count[b];
+    free(jobs[i].count);
+  }
+  free(threads);
+  free(jobs);
+  return collisions;
+}
+
+#define UNIFORMITY_DEVIATION(__deviation, __count, __keys)      \
   do {                                                          \
     double total_deviation = 0.0;                               \
-    double expected_count = ITERATIONS / (1ULL << PRECISION);   \
+    double expected_count = (__keys) / (1ULL << PRECISION);     \
     for (unsigned int i = 0; i < (1 << PRECISION); ++i)         \
     {                                                           \
       total_deviation += absd(__count[i] - expected_count);     \
@@ -88,11 +547,380 @@ inline double absd(double x)
     __deviation = total_deviation / (1 << PRECISION);           \
   } while (0)
 
-#define PRINT_RESULT(__hash_name, __collisions, __mean_deviation) \
-    printf("| %-23.23s | %-12d | %-12.12f |\n", #__hash_name, __collisions, __mean_deviation);
+static void print_result(const char *hash_name, unsigned int collisions,
+                         double mean_deviation, const perf_counts *counts)
+{
+  if (format == FORMAT_TABLE)
+  {
+    char counters[128];
+    format_counters(counters, sizeof(counters), counts, ITERATIONS);
+    printf("| %-23.23s | %-12d | %-12.12f |%s\n", hash_name, collisions,
+           mean_deviation, counters);
+    return;
+  }
+  print_record("hash_tests", hash_name, "", "collisions", collisions);
+  print_record("hash_tests", hash_name, "", "non-uniformity", mean_deviation);
+  for (int i = 0; i < COUNTER_COLUMNS; ++i)
+  {
+    double value;
+    if (counter_column(counts, i, ITERATIONS, &value))
+      print_record("hash_tests", hash_name, "", counter_column_names[i], value);
+  }
+}
+
+#define PRINT_RESULT(__hash_name, __collisions, __mean_deviation, __counts) \
+  print_result(#__hash_name, __collisions, __mean_deviation, &__counts)
+
+#define PRINT_THROUGHPUT(__hash_name, __size_name, __gbps)              \
+  do {                                                                  \
+    if (format == FORMAT_TABLE)                                         \
+      printf("| %-34.34s | %-12s | %-15.3f |\n", __hash_name, __size_name, __gbps); \
+    else                                                                \
+      print_record("throughput_tests", __hash_name, __size_name, "GB/s", __gbps); \
+  } while (0)
+
+// Current time in seconds
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Prevent the compiler from hoisting or removing a hash call out of a
+// benchmark loop
+static inline void bench_clobber(void)
+{
+  __asm__ volatile("" : : : "memory");
+}
+
+// Keep x in a register the compiler cannot see through, so that a
+// benchmark loop over independent keys is not vectorized
+#define BENCH_OPAQUE(x) __asm__ volatile("" : "+r"(x))
+
+// Returns: the time stamp counter, or 0 without one. It ticks at a
+// constant rate near the nominal frequency of the CPU, so it counts
+// core cycles only when the CPU runs at that frequency.
+static inline uint64_t read_cycles(void)
+{
+#ifdef TESTS_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Fill a buffer with pseudo random bytes
+static void fill_random(unsigned char *buffer, size_t size)
+{
+  uint32_t random = lcg32(6969);
+  for (size_t i = 0; i < size; ++i)
+  {
+    random = lcg32(random);
+    buffer[i] = random >> 24;
+  }
+}
+
+// Run __statement repeatedly for at least BENCH_MIN_SECONDS and
+// store in __per_second how many times per second it ran
+#define MEASURE_CALLS_PER_SECOND(__statement, __per_second)             \
+  do {                                                                  \
+    size_t reps = 1;                                                    \
+    double elapsed = 0.0;                                               \
+    while (elapsed < BENCH_MIN_SECONDS)                                 \
+    {                                                                   \
+      reps *= 2;                                                        \
+      double start = now_seconds();                                     \
+      for (size_t r = 0; r < reps; ++r)                                 \
+      {                                                                 \
+        bench_clobber();                                                \
+        __statement;                                                    \
+      }                                                                 \
+      elapsed = now_seconds() - start;                                  \
+    }                                                                   \
+    __per_second = (double) reps / elapsed;                             \
+  } while (0)
+
+// Measure the throughput of __hash_func over a buffer of __size bytes,
+// in GB/s
+#define MEASURE_THROUGHPUT(__hash_func, __buffer, __size, __gbps)       \
+  do {                                                                  \
+    volatile size_t sink = 0;                                           \
+    double per_second;                                                  \
+    MEASURE_CALLS_PER_SECOND(sink ^= (size_t) __hash_func(__buffer, __size), \
+                             per_second);                               \
+    (void) sink;                                                        \
+    __gbps = per_second * (__size) / 1e9;                               \
+  } while (0)
+
+// Input sizes of the throughput table
+static const struct {
+  const char *name;
+  size_t size;
+} throughput_sizes[] = {
+  { "8 B",    8 },
+  { "16 B",   16 },
+  { "32 B",   32 },
+  { "64 B",   64 },
+  { "256 B",  256 },
+  { "1 KiB",  1024 },
+  { "4 KiB",  4 * 1024 },
+  { "64 KiB", 64 * 1024 },
+  { "1 MiB",  1024 * 1024 },
+};
+
+#define THROUGHPUT_SIZES (sizeof(throughput_sizes) / sizeof(throughput_sizes[0]))
+#define THROUGHPUT_MAX_SIZE (1024 * 1024)
+
+// Measure and print the throughput of __hash_func for every size in
+// throughput_sizes. __hash_func is called as __hash_func(key, size),
+// __hash_name is printed in the table.
+#define THROUGHPUT_TEST_NAMED(__hash_name, __hash_func)                 \
+  do {                                                                  \
+    unsigned char *buffer = malloc(THROUGHPUT_MAX_SIZE);                \
+    fill_random(buffer, THROUGHPUT_MAX_SIZE);                           \
+    for (size_t s = 0; s < THROUGHPUT_SIZES; ++s)                       \
+    {                                                                   \
+      double gbps;                                                      \
+      MEASURE_THROUGHPUT(__hash_func, buffer,                           \
+                         throughput_sizes[s].size, gbps);               \
+      PRINT_THROUGHPUT(__hash_name, throughput_sizes[s].name, gbps);    \
+    }                                                                   \
+    free(buffer);                                                       \
+  } while (0)
+
+#define THROUGHPUT_TEST(__hash_func) \
+  THROUGHPUT_TEST_NAMED(#__hash_func, __hash_func)
+
+// Number of keys hashed per call in the batch table, small enough
+// for the keys and the hashes to stay in L1
+#define BATCH_SIZE 2048
+
+#define PRINT_TIMING(__hash_name, __mode_name, __ns, __cycles)          \
+  do {                                                                  \
+    if (format == FORMAT_TABLE)                                         \
+      printf("| %-34.34s | %-12s | %-15.2f | %-15.2f |\n", __hash_name, __mode_name, __ns, __cycles); \
+    else                                                                \
+    {                                                                   \
+      print_record("timing_tests", __hash_name, __mode_name, "ns/hash", __ns); \
+      print_record("timing_tests", __hash_name, __mode_name, "cycles/hash", __cycles); \
+    }                                                                   \
+  } while (0)
+
+// Run __statement, that hashes __hashes keys, repeatedly for at least
+// BENCH_MIN_SECONDS and store the nanoseconds and the time stamp
+// counter cycles each hash took
+#define MEASURE_PER_HASH(__statement, __hashes, __ns, __cycles)         \
+  do {                                                                  \
+    size_t reps = 1;                                                    \
+    double elapsed = 0.0;                                               \
+    uint64_t elapsed_cycles = 0;                                        \
+    while (elapsed < BENCH_MIN_SECONDS)                                 \
+    {                                                                   \
+      reps *= 2;                                                        \
+      uint64_t start_cycles = read_cycles();                            \
+      double start = now_seconds();                                     \
+      for (size_t r = 0; r < reps; ++r)                                 \
+      {                                                                 \
+        bench_clobber();                                                \
+        __statement;                                                    \
+      }                                                                 \
+      elapsed = now_seconds() - start;                                  \
+      elapsed_cycles = read_cycles() - start_cycles;                    \
+    }                                                                   \
+    __ns = elapsed * 1e9 / ((double) reps * (__hashes));                \
+    __cycles = (double) elapsed_cycles / ((double) reps * (__hashes));  \
+  } while (0)
+
+// Measure and print the time per hash of __hash_func over
+// BATCH_SIZE keys, twice: as a latency, with each hash being the
+// next key so that a hash cannot start before the previous one ends,
+// and as a throughput, over independent keys that the CPU can hash
+// in parallel
+#define TIMING_TEST(__hash_func, __key_type, __rng_func)                \
+  do {                                                                  \
+    __key_type *keys = malloc(BATCH_SIZE * sizeof(__key_type));         \
+    __key_type random = __rng_func(6969);                               \
+    for (size_t i = 0; i < BATCH_SIZE; ++i)                             \
+    {                                                                   \
+      keys[i] = random;                                                 \
+      random = __rng_func(random);                                      \
+    }                                                                   \
+    volatile uint64_t sink = 0;                                         \
+    double ns, cycles;                                                  \
+                                                                        \
+    __key_type chain = keys[0];                                         \
+    MEASURE_PER_HASH(for (size_t i = 0; i < BATCH_SIZE; ++i)            \
+                       chain = (__key_type) __hash_func(chain),         \
+                     BATCH_SIZE, ns, cycles);                           \
+    sink ^= chain;                                                      \
+    PRINT_TIMING(#__hash_func, "latency", ns, cycles);                  \
+                                                                        \
+    uint64_t acc = 0;                                                   \
+    MEASURE_PER_HASH(for (size_t i = 0; i < BATCH_SIZE; ++i)            \
+                     {                                                  \
+                       acc ^= __hash_func(keys[i]);                     \
+                       BENCH_OPAQUE(acc);                               \
+                     },                                                 \
+                     BATCH_SIZE, ns, cycles);                           \
+    sink ^= acc;                                                        \
+    PRINT_TIMING(#__hash_func, "throughput", ns, cycles);               \
+                                                                        \
+    (void) sink;                                                        \
+    free(keys);                                                         \
+  } while (0)
+
+#define PRINT_BATCH(__hash_name, __kernel_name, __mkeys)                \
+  do {                                                                  \
+    if (format == FORMAT_TABLE)                                         \
+      printf("| %-34.34s | %-12s | %-15.1f |\n", __hash_name, __kernel_name, __mkeys); \
+    else                                                                \
+      print_record("batch_tests", __hash_name, __kernel_name, "Mkeys/s", __mkeys); \
+  } while (0)
+
+// Measure and print how many millions of keys per second
+// __batch_func hashes, called on BATCH_SIZE keys at a time
+#define BATCH_TEST(__batch_func, __hash_name, __kernel_name, __in_type, __out_type, __rng_func) \
+  do {                                                                  \
+    __in_type *in = malloc(BATCH_SIZE * sizeof(__in_type));             \
+    __out_type *out = malloc(BATCH_SIZE * sizeof(__out_type));          \
+    __in_type random = __rng_func(6969);                                \
+    for (size_t i = 0; i < BATCH_SIZE; ++i)                             \
+    {                                                                   \
+      in[i] = random;                                                   \
+      random = __rng_func(random);                                      \
+    }                                                                   \
+    double per_second;                                                  \
+    MEASURE_CALLS_PER_SECOND(__batch_func(in, out, BATCH_SIZE), per_second); \
+    PRINT_BATCH(__hash_name, __kernel_name, per_second * BATCH_SIZE / 1e6); \
+    free(in);                                                           \
+    free(out);                                                          \
+  } while (0)
+
+// Check that __batch_func gives the same results as __hash_func over
+// ITERATIONS random keys, and over every length below 64 so that the
+// tails of the SIMD loops are covered. Sets __ok to false on the first
+// mismatch.
+#define BATCH_CONSISTENCY(__hash_func, __batch_func, __in_type, __out_type, __rng_func, __ok) \
+  do {                                                                  \
+    __ok = true;                                                        \
+    __in_type *in = malloc(ITERATIONS * sizeof(__in_type));             \
+    __out_type *out = malloc(ITERATIONS * sizeof(__out_type));          \
+    __in_type random = __rng_func(6969);                                \
+    for (size_t i = 0; i < ITERATIONS; ++i)                             \
+    {                                                                   \
+      in[i] = random;                                                   \
+      random = __rng_func(random);                                      \
+    }                                                                   \
+    __batch_func(in, out, ITERATIONS);                                  \
+    for (size_t i = 0; __ok && i < ITERATIONS; ++i)                     \
+    {                                                                   \
+      if (out[i] != (__out_type) __hash_func(in[i]))                    \
+      {                                                                 \
+        fprintf(stderr, "error: %s: key %zu differs\n", #__batch_func, i); \
+        __ok = false;                                                   \
+      }                                                                 \
+    }                                                                   \
+    for (size_t n = 0; __ok && n < 64; ++n)                             \
+    {                                                                   \
+      memset(out, 0xAB, 65 * sizeof(__out_type));                       \
+      __batch_func(in + 1, out, n);                                     \
+      for (size_t i = 0; i < n; ++i)                                    \
+        if (out[i] != (__out_type) __hash_func(in[i + 1]))              \
+          __ok = false;                                                 \
+      __out_type untouched;                                             \
+      memset(&untouched, 0xAB, sizeof(untouched));                      \
+      if (out[n] != untouched)                                          \
+        __ok = false;                                                   \
+      if (!__ok)                                                        \
+        fprintf(stderr, "error: %s: length %zu differs\n", #__batch_func, n); \
+    }                                                                   \
+    free(in);                                                           \
+    free(out);                                                          \
+  } while (0)
+
+// Whether the CPU running the tests supports the SIMD kernels
+#define CPU_HAS_SSE42()  micro_hash_backend_supported(MICRO_HASH_BACKEND_SSE42)
+#define CPU_HAS_AVX2()   micro_hash_backend_supported(MICRO_HASH_BACKEND_AVX2)
+#define CPU_HAS_AVX512() micro_hash_backend_supported(MICRO_HASH_BACKEND_AVX512)
+#define CPU_HAS_AESNI()  __builtin_cpu_supports("aes")
+
+// Run BATCH_CONSISTENCY on the default entry point __batch_name and
+// on each of its kernels supported by the CPU
+#ifdef MICRO_HASH_X86
+#define BATCH_CONSISTENCY_ALL(__hash_func, __batch_name, __in_type, __out_type, __rng_func) \
+  do {                                                                  \
+    bool ok;                                                            \
+    BATCH_CONSISTENCY(__hash_func, __batch_name, __in_type, __out_type, __rng_func, ok); \
+    ASSERT(ok);                                                         \
+    BATCH_CONSISTENCY(__hash_func, __batch_name##_scalar, __in_type, __out_type, __rng_func, ok); \
+    ASSERT(ok);                                                         \
+    if (CPU_HAS_AVX2())                                                 \
+    {                                                                   \
+      BATCH_CONSISTENCY(__hash_func, __batch_name##_avx2, __in_type, __out_type, __rng_func, ok); \
+      ASSERT(ok);                                                       \
+    }                                                                   \
+    if (CPU_HAS_AVX512())                                               \
+    {                                                                   \
+      BATCH_CONSISTENCY(__hash_func, __batch_name##_avx512, __in_type, __out_type, __rng_func, ok); \
+      ASSERT(ok);                                                       \
+    }                                                                   \
+  } while (0)
+#else
+#define BATCH_CONSISTENCY_ALL(__hash_func, __batch_name, __in_type, __out_type, __rng_func) \
+  do {                                                                  \
+    bool ok;                                                            \
+    BATCH_CONSISTENCY(__hash_func, __batch_name, __in_type, __out_type, __rng_func, ok); \
+    ASSERT(ok);                                                         \
+    BATCH_CONSISTENCY(__hash_func, __batch_name##_scalar, __in_type, __out_type, __rng_func, ok); \
+    ASSERT(ok);                                                         \
+  } while (0)
+#endif // MICRO_HASH_X86
+
+// Run BATCH_TEST on every kernel of __batch_name supported by the CPU
+#ifdef MICRO_HASH_X86
+#define BATCH_TEST_ALL(__batch_name, __in_type, __out_type, __rng_func) \
+  do {                                                                  \
+    BATCH_TEST(__batch_name, #__batch_name, "dispatch", __in_type, __out_type, __rng_func); \
+    BATCH_TEST(__batch_name##_scalar, #__batch_name, "scalar", __in_type, __out_type, __rng_func); \
+    if (CPU_HAS_AVX2())                                                 \
+      BATCH_TEST(__batch_name##_avx2, #__batch_name, "avx2", __in_type, __out_type, __rng_func); \
+    if (CPU_HAS_AVX512())                                               \
+      BATCH_TEST(__batch_name##_avx512, #__batch_name, "avx512", __in_type, __out_type, __rng_func); \
+  } while (0)
+#else
+#define BATCH_TEST_ALL(__batch_name, __in_type, __out_type, __rng_func) \
+  do {                                                                  \
+    BATCH_TEST(__batch_name, #__batch_name, "dispatch", __in_type, __out_type, __rng_func); \
+    BATCH_TEST(__batch_name##_scalar, #__batch_name, "scalar", __in_type, __out_type, __rng_func); \
+  } while (0)
+#endif // MICRO_HASH_X86
+
+// Hash functions with a seed, adapted to THROUGHPUT_TEST
+static inline uint64_t xxh64_seed0(const void *key, size_t key_length)
+{
+  return micro_hash_bytes_xxh64(key, key_length, 0);
+}
+
+static inline uint64_t aes_seed0(const void *key, size_t key_length)
+{
+  return micro_hash_bytes_aes(key, key_length, 0);
+}
+
+static inline uint64_t aes_scalar_seed0(const void *key, size_t key_length)
+{
+  return micro_hash_bytes_aes_scalar(key, key_length, 0);
+}
+
+static inline size_t str_stb_n_seed0(const void *str, size_t length)
+{
+  return micro_hash_str_stb_n((const char *) str, length, 0);
+}
 
 static inline bool eq_u32(uint32_t a, uint32_t b) { return a == b; }
-HASHSET_DECLARE(uint32_t, u32, micro_hash_int32_wang, eq_u32)
+HASHSET_SWISS_DECLARE(uint32_t, u32, micro_hash_int32_wang, eq_u32)
+
+COLLISION_JOB_DECLARE(micro_hash_int32_wang, uint32_t, uint32_t, u32, lcg32)
 
 TEST(hash_tests, micro_hash_int32_wang)
 {
@@ -102,12 +930,13 @@ TEST(hash_tests, micro_hash_int32_wang)
   u32_set_init(&s);
 
   unsigned int collisions;
-  COUNT_COLLISIONS(micro_hash_int32_wang, uint32_t, u32, lcg32, count, collisions);
+  perf_counts counts;
+  COUNT_COLLISIONS(micro_hash_int32_wang, count, collisions, counts);
   
   double mean_deviation;
-  UNIFORMITY_DEVIATION(mean_deviation, count);
+  UNIFORMITY_DEVIATION(mean_deviation, count, ITERATIONS);
 
-  PRINT_RESULT(micro_hash_int32_wang, collisions, mean_deviation);
+  PRINT_RESULT(micro_hash_int32_wang, collisions, mean_deviation, counts);
   
   free(count);
   u32_set_free(&s);
@@ -115,6 +944,8 @@ TEST(hash_tests, micro_hash_int32_wang)
   TEST_SUCCESS;
 }
 
+COLLISION_JOB_DECLARE(micro_hash_int32_wang2, uint32_t, uint32_t, u32, lcg32)
+
 TEST(hash_tests, micro_hash_int32_wang2)
 {
   unsigned int *count = calloc(sizeof(unsigned int), (1 << PRECISION));
@@ -123,12 +954,13 @@ TEST(hash_tests, micro_hash_int32_wang2)
   u32_set_init(&s);
 
   unsigned int collisions;
-  COUNT_COLLISIONS(micro_hash_int32_wang2, uint32_t, u32, lcg32, count, collisions);
+  perf_counts counts;
+  COUNT_COLLISIONS(micro_hash_int32_wang2, count, collisions, counts);
   
   double mean_deviation;
-  UNIFORMITY_DEVIATION(mean_deviation, count);
+  UNIFORMITY_DEVIATION(mean_deviation, count, ITERATIONS);
 
-  PRINT_RESULT(micro_hash_int32_wang2, collisions, mean_deviation);
+  PRINT_RESULT(micro_hash_int32_wang2, collisions, mean_deviation, counts);
   
   free(count);
   u32_set_free(&s);
@@ -136,6 +968,8 @@ TEST(hash_tests, micro_hash_int32_wang2)
   TEST_SUCCESS;
 }
 
+COLLISION_JOB_DECLARE(micro_hash_int32_rob, uint32_t, uint32_t, u32, lcg32)
+
 TEST(hash_tests, micro_hash_int32_rob)
 {
   unsigned int *count = calloc(sizeof(unsigned int), (1 << PRECISION));
@@ -144,12 +978,13 @@ TEST(hash_tests, micro_hash_int32_rob)
   u32_set_init(&s);
 
   unsigned int collisions;
-  COUNT_COLLISIONS(micro_hash_int32_rob, uint32_t, u32, lcg32, count, collisions);
+  perf_counts counts;
+  COUNT_COLLISIONS(micro_hash_int32_rob, count, collisions, counts);
   
   double mean_deviation;
-  UNIFORMITY_DEVIATION(mean_deviation, count);
+  UNIFORMITY_DEVIATION(mean_deviation, count, ITERATIONS);
 
-  PRINT_RESULT(micro_hash_int32_rob, collisions, mean_deviation);
+  PRINT_RESULT(micro_hash_int32_rob, collisions, mean_deviation, counts);
   
   free(count);
   u32_set_free(&s);
@@ -158,8 +993,10 @@ TEST(hash_tests, micro_hash_int32_rob)
 }
 
 static inline bool eq_u64(uint64_t a, uint64_t b) { return a == b; }
-HASHSET_DECLARE(uint64_t, u64, micro_hash_int64_wang, eq_u64)
+HASHSET_SWISS_DECLARE(uint64_t, u64, micro_hash_int64_wang, eq_u64)
   
+COLLISION_JOB_DECLARE(micro_hash_int64_wang, uint64_t, uint64_t, u64, lcg64)
+
 TEST(hash_tests, micro_hash_int64_wang)
 {
   unsigned int *count = calloc(sizeof(unsigned int), (1 << PRECISION));
@@ -168,12 +1005,13 @@ TEST(hash_tests, micro_hash_int64_wang)
   u64_set_init(&s);
 
   unsigned int collisions;
-  COUNT_COLLISIONS(micro_hash_int64_wang, uint64_t, u64, lcg64, count, collisions);
+  perf_counts counts;
+  COUNT_COLLISIONS(micro_hash_int64_wang, count, collisions, counts);
   
   double mean_deviation;
-  UNIFORMITY_DEVIATION(mean_deviation, count);
+  UNIFORMITY_DEVIATION(mean_deviation, count, ITERATIONS);
 
-  PRINT_RESULT(micro_hash_int64_wang, collisions, mean_deviation);
+  PRINT_RESULT(micro_hash_int64_wang, collisions, mean_deviation, counts);
   
   free(count);
   u64_set_free(&s);
@@ -181,6 +1019,8 @@ TEST(hash_tests, micro_hash_int64_wang)
   TEST_SUCCESS;
 }
 
+COLLISION_JOB_DECLARE(micro_hash_int6432_wang, uint64_t, uint32_t, u32, lcg64)
+
 TEST(hash_tests, micro_hash_int6432_wang)
 {
   unsigned int *count = calloc(sizeof(unsigned int), (1 << PRECISION));
@@ -189,12 +1029,37 @@ TEST(hash_tests, micro_hash_int6432_wang)
   u32_set_init(&s);
 
   unsigned int collisions;
-  COUNT_COLLISIONS(micro_hash_int6432_wang, uint32_t, u64, lcg64, count, collisions);
+  perf_counts counts;
+  COUNT_COLLISIONS(micro_hash_int6432_wang, count, collisions, counts);
+  
+  double mean_deviation;
+  UNIFORMITY_DEVIATION(mean_deviation, count, ITERATIONS);
+
+  PRINT_RESULT(micro_hash_int6432_wang, collisions, mean_deviation, counts);
+  
+  free(count);
+  u32_set_free(&s);
+  
+  TEST_SUCCESS;
+}
+
+COLLISION_JOB_DECLARE(micro_hash_int64_crc32c, uint64_t, uint32_t, u32, lcg64)
+
+TEST(hash_tests, micro_hash_int64_crc32c)
+{
+  unsigned int *count = calloc(sizeof(unsigned int), (1 << PRECISION));
+
+  u32_set s;
+  u32_set_init(&s);
+
+  unsigned int collisions;
+  perf_counts counts;
+  COUNT_COLLISIONS(micro_hash_int64_crc32c, count, collisions, counts);
   
   double mean_deviation;
-  UNIFORMITY_DEVIATION(mean_deviation, count);
+  UNIFORMITY_DEVIATION(mean_deviation, count, ITERATIONS);
 
-  PRINT_RESULT(micro_hash_int6432_wang, collisions, mean_deviation);
+  PRINT_RESULT(micro_hash_int64_crc32c, collisions, mean_deviation, counts);
   
   free(count);
   u32_set_free(&s);
@@ -202,17 +1067,2686 @@ TEST(hash_tests, micro_hash_int6432_wang)
   TEST_SUCCESS;
 }
  
-int main(int argc, char **argv)
+//
+// Consistency
+//
+
+TEST(consistency_tests, micro_hash_bytes_curl_wide)
+{
+  unsigned char *buffer = malloc(1024);
+  fill_random(buffer, 1024);
+
+  // Every length and alignment of the word loop and of the tail
+  for (size_t offset = 0; offset < 8; ++offset)
+  {
+    for (size_t length = 0; length < 1024 - offset; ++length)
+    {
+      size_t expected = micro_hash_bytes_curl(buffer + offset, length);
+      size_t got = micro_hash_bytes_curl_wide(buffer + offset, length);
+      if (expected != got)
+      {
+        fprintf(stderr, "error: offset %zu length %zu: %zx != %zx\n",
+                offset, length, expected, got);
+        free(buffer);
+        TEST_FAILED;
+      }
+    }
+  }
+
+  free(buffer);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, micro_hash_bytes_xxh64)
+{
+  // Reference values from the xxHash library, the key is
+  // (i * 31 + 7) & 255 for i in [0, length)
+  static const struct {
+    size_t length;
+    uint64_t seed;
+    uint64_t hash;
+  } vectors[] = {
+    {    0, 0x0000000000000000ULL, 0xef46db3751d8e999ULL },
+    {    1, 0x0000000000000000ULL, 0xa96c7f0ce858bbb7ULL },
+    {    3, 0x0000000000000000ULL, 0x56e6957632a487f9ULL },
+    {    4, 0x0000000000000000ULL, 0xc60d15b1e3ff8f04ULL },
+    {    7, 0x0000000000000000ULL, 0xafbefc3d6c6f9a8eULL },
+    {    8, 0x0000000000000000ULL, 0x3da5c7aa269683e0ULL },
+    {    9, 0x0000000000000000ULL, 0x4b17a9ba9e215c09ULL },
+    {   15, 0x0000000000000000ULL, 0xae2a37eb9357caa7ULL },
+    {   16, 0x0000000000000000ULL, 0xa19ad429b02bc413ULL },
+    {   31, 0x0000000000000000ULL, 0x4a74f3a1a39ad4a1ULL },
+    {   32, 0x0000000000000000ULL, 0x8d57d6a4671cc43dULL },
+    {   33, 0x0000000000000000ULL, 0x62c9fd21ed857664ULL },
+    {   63, 0x0000000000000000ULL, 0x5c320a0d2707057fULL },
+    {   64, 0x0000000000000000ULL, 0x7bbabbc45729d17eULL },
+    {  100, 0x0000000000000000ULL, 0xefa0ad2d3e70c151ULL },
+    {  257, 0x0000000000000000ULL, 0x6ff15897658784e0ULL },
+    { 1000, 0x0000000000000000ULL, 0x99594f4828043d35ULL },
+    {    0, 0x9e3779b97f4a7c15ULL, 0xc4349fc93c010000ULL },
+    {    1, 0x9e3779b97f4a7c15ULL, 0x585882422a6165e7ULL },
+    {    3, 0x9e3779b97f4a7c15ULL, 0x5acb303e78133c22ULL },
+    {    4, 0x9e3779b97f4a7c15ULL, 0x7d51d5e2461732b3ULL },
+    {    7, 0x9e3779b97f4a7c15ULL, 0x2ce9adec2b2c8104ULL },
+    {    8, 0x9e3779b97f4a7c15ULL, 0x758848f033fa76a2ULL },
+    {    9, 0x9e3779b97f4a7c15ULL, 0xd4576cf554b7d929ULL },
+    {   15, 0x9e3779b97f4a7c15ULL, 0xa18d5c90d722cee3ULL },
+    {   16, 0x9e3779b97f4a7c15ULL, 0xe3594f9058b426e7ULL },
+    {   31, 0x9e3779b97f4a7c15ULL, 0x8137041f5af88413ULL },
+    {   32, 0x9e3779b97f4a7c15ULL, 0x184ebcf3745cd46cULL },
+    {   33, 0x9e3779b97f4a7c15ULL, 0x52fac3c981f3cc2eULL },
+    {   63, 0x9e3779b97f4a7c15ULL, 0x64ef99a2e94cc7bdULL },
+    {   64, 0x9e3779b97f4a7c15ULL, 0xf7f22435fe1ab128ULL },
+    {  100, 0x9e3779b97f4a7c15ULL, 0xbc7ab33be7528c18ULL },
+    {  257, 0x9e3779b97f4a7c15ULL, 0x6d1a60579e75f807ULL },
+    { 1000, 0x9e3779b97f4a7c15ULL, 0xda717f741f399f3fULL },
+  };
+
+  unsigned char key[1000];
+  for (size_t i = 0; i < sizeof(key); ++i)
+    key[i] = (i * 31 + 7) & 255;
+
+  for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i)
+  {
+    uint64_t hash = micro_hash_bytes_xxh64(key, vectors[i].length,
+                                           vectors[i].seed);
+    ASSERT_EQ(hash, vectors[i].hash);
+  }
+
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, micro_hash_bytes_crc32c)
+{
+  // Check value of CRC-32C
+  ASSERT_EQ(micro_hash_bytes_crc32c("123456789", 9), 0xE3069283);
+  ASSERT_EQ(micro_hash_bytes_crc32c_scalar("123456789", 9), 0xE3069283);
+
+  // Lengths around the three stream blocks of the SSE4.2 kernel
+  static const size_t long_lengths[] = {
+    3 * 256 - 1, 3 * 256, 3 * 256 + 1, 3 * 256 * 2 + 17,
+    3 * 8192 - 1, 3 * 8192, 3 * 8192 + 9, 3 * 8192 * 2 + 3 * 256 + 5,
+  };
+  size_t size = 3 * 8192 * 2 + 1024;
+  unsigned char *buffer = malloc(size);
+  fill_random(buffer, size);
+
+  for (size_t offset = 0; offset < 8; ++offset)
+  {
+    for (size_t i = 0; i < 1024 + sizeof(long_lengths) / sizeof(long_lengths[0]); ++i)
+    {
+      size_t length = (i < 1024) ? i : long_lengths[i - 1024];
+      uint32_t expected = micro_hash_bytes_crc32c_scalar(buffer + offset, length);
+      uint32_t got = micro_hash_bytes_crc32c(buffer + offset, length);
+#ifdef MICRO_HASH_X86
+      if (CPU_HAS_SSE42() && got == expected)
+        got = micro_hash_bytes_crc32c_sse42(buffer + offset, length);
+#endif
+      if (expected != got)
+      {
+        fprintf(stderr, "error: offset %zu length %zu: %x != %x\n",
+                offset, length, expected, got);
+        free(buffer);
+        TEST_FAILED;
+      }
+    }
+  }
+
+  free(buffer);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, micro_hash_int64_crc32c)
+{
+  uint64_t key = lcg64(6969);
+  for (unsigned int i = 0; i < 100000; ++i)
+  {
+    unsigned char bytes[8];
+    for (int b = 0; b < 8; ++b)
+      bytes[b] = key >> (8 * b);
+    
+    uint32_t expected = micro_hash_bytes_crc32c_scalar(bytes, 8);
+    ASSERT_EQ(micro_hash_int64_crc32c(key), expected);
+    ASSERT_EQ(micro_hash_int64_crc32c_scalar(key), expected);
+#ifdef MICRO_HASH_X86
+    if (CPU_HAS_SSE42())
+      ASSERT_EQ(micro_hash_int64_crc32c_sse42(key), expected);
+#endif
+    key = lcg64(key);
+  }
+
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, micro_hash_bytes_aes)
 {
-  printf("Iterating over %d random values...\n", ITERATIONS);
-  printf("Precision set to %d\n", PRECISION);
-  printf("/----------------------------------------------------------\\\n");
-  printf("|      hash function      |  collisions  |  non-uniformity |\n");
-  printf("| ----------------------- | ------------ | --------------- |\n");
+  // Reference values of the scalar kernel, which must not change
+  // between hosts. The key is (i * 31 + 7) & 255 for i in
+  // [0, length)
+  static const struct {
+    size_t length;
+    uint64_t seed;
+    uint64_t hash;
+  } vectors[] = {
+    {    0, 0x0000000000000000ULL, 0xa2b516a1208a2112ULL },
+    {    1, 0x0000000000000000ULL, 0x6e7176ad37526283ULL },
+    {   15, 0x0000000000000000ULL, 0xd6fcf7624eab3254ULL },
+    {   16, 0x0000000000000000ULL, 0x55667c0145a13ba0ULL },
+    {   17, 0x0000000000000000ULL, 0x47ef092c51ed8cf9ULL },
+    {   64, 0x0000000000000000ULL, 0x7567c493bdf25ccaULL },
+    {  127, 0x0000000000000000ULL, 0x89a19dcbcff0693dULL },
+    {  128, 0x0000000000000000ULL, 0x8e19e222691c6a21ULL },
+    {  129, 0x0000000000000000ULL, 0x2ae15665e07834bbULL },
+    {  257, 0x0000000000000000ULL, 0x0734da5c9e730e39ULL },
+    { 1000, 0x0000000000000000ULL, 0x8ab5468fc98907f6ULL },
+    {    0, 0x9e3779b97f4a7c15ULL, 0x8b24d154216b50c1ULL },
+    {    1, 0x9e3779b97f4a7c15ULL, 0xb34223ec700bfbfdULL },
+    {   15, 0x9e3779b97f4a7c15ULL, 0x31db39ad969ea590ULL },
+    {   16, 0x9e3779b97f4a7c15ULL, 0x86e927f2a24bdf73ULL },
+    {   17, 0x9e3779b97f4a7c15ULL, 0x05fb39e5b338a43bULL },
+    {   64, 0x9e3779b97f4a7c15ULL, 0x69956baf0b43ae1fULL },
+    {  127, 0x9e3779b97f4a7c15ULL, 0x989c378e1e93d690ULL },
+    {  128, 0x9e3779b97f4a7c15ULL, 0xc328de876ddc9e80ULL },
+    {  129, 0x9e3779b97f4a7c15ULL, 0xef6c6228253391d2ULL },
+    {  257, 0x9e3779b97f4a7c15ULL, 0x4f110749768c1aebULL },
+    { 1000, 0x9e3779b97f4a7c15ULL, 0x23e364be3a986292ULL },
+  };
+
+  unsigned char key[1000];
+  for (size_t i = 0; i < sizeof(key); ++i)
+    key[i] = (i * 31 + 7) & 255;
+
+  for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i)
+  {
+    ASSERT_EQ(micro_hash_bytes_aes(key, vectors[i].length, vectors[i].seed),
+              vectors[i].hash);
+    ASSERT_EQ(micro_hash_bytes_aes_scalar(key, vectors[i].length, vectors[i].seed),
+              vectors[i].hash);
+  }
+
+#ifdef MICRO_HASH_X86
+  // Every length and alignment of the stripe loop and of the tail
+  unsigned char *buffer = malloc(1024);
+  fill_random(buffer, 1024);
+
+  if (CPU_HAS_AESNI())
+  {
+    for (size_t offset = 0; offset < 8; ++offset)
+    {
+      for (size_t length = 0; length < 1024 - offset; ++length)
+      {
+        uint64_t seed = lcg64(length);
+        uint64_t expected = micro_hash_bytes_aes_scalar(buffer + offset, length, seed);
+        uint64_t got = micro_hash_bytes_aes_aesni(buffer + offset, length, seed);
+        if (expected != got)
+        {
+          fprintf(stderr, "error: offset %zu length %zu: %lx != %lx\n",
+                  offset, length, (unsigned long) expected, (unsigned long) got);
+          free(buffer);
+          TEST_FAILED;
+        }
+      }
+    }
+  }
+
+  free(buffer);
+#endif // MICRO_HASH_X86
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, micro_hash_str_n)
+{
+  // A string without NULs, so that the originals hash all of it
+  unsigned char *buffer = malloc(1024);
+  fill_random(buffer, 1024);
+  for (size_t i = 0; i < 1024; ++i)
+    if (buffer[i] == 0)
+      buffer[i] = 1;
+  
+  unsigned char *str = malloc(1024 + 1);
+  for (size_t offset = 0; offset < 8; ++offset)
+  {
+    for (size_t length = 0; length < 1024 - offset; ++length)
+    {
+      unsigned char *key = buffer + offset;
+      memcpy(str, key, length);
+      str[length] = '\0';
+
+      bool ok = micro_hash_str_stb_n((char *) key, length, 6969)
+                == micro_hash_str_stb((char *) str, 6969)
+             && micro_hash_str_djb2_n(key, length) == micro_hash_str_djb2(str)
+             && micro_hash_str_sdbm_n(key, length) == micro_hash_str_sdbm(str);
+      if (!ok)
+      {
+        fprintf(stderr, "error: offset %zu length %zu\n", offset, length);
+        free(buffer);
+        free(str);
+        TEST_FAILED;
+      }
+    }
+  }
+
+  free(buffer);
+  free(str);
+  TEST_SUCCESS;
+}
+
+// Piece sizes to split the keys of the streaming tests, 0 picks a
+// pseudo random size
+static const size_t stream_pieces[] = { 1, 3, 7, 8, 31, 32, 33, 100, 0 };
+
+#define STREAM_PIECES (sizeof(stream_pieces) / sizeof(stream_pieces[0]))
+
+// Check that hashing every prefix of __buffer in pieces with the
+// streaming functions of __prefix gives __expected(key, length).
+// __init is a statement that initializes `state`.
+#define STREAM_CONSISTENCY(__prefix, __state_type, __init, __expected, __buffer, __size, __ok) \
+  do {                                                                  \
+    __ok = true;                                                        \
+    for (size_t piece = 0; piece < STREAM_PIECES && __ok; ++piece)      \
+    {                                                                   \
+      uint32_t random = lcg32(piece);                                   \
+      for (size_t length = 0; length < __size && __ok; ++length)        \
+      {                                                                 \
+        __state_type state;                                             \
+        __init;                                                         \
+        size_t done = 0;                                                \
+        while (done < length)                                           \
+        {                                                               \
+          random = lcg32(random);                                       \
+          size_t n = stream_pieces[piece] ? stream_pieces[piece]        \
+                                          : (random >> 24) % 80;        \
+          if (n > length - done)                                        \
+            n = length - done;                                          \
+          __prefix##_update(&state, __buffer + done, n);                \
+          done += n;                                                    \
+        }                                                               \
+        if (__prefix##_final(&state) != __expected(__buffer, length))   \
+        {                                                               \
+          fprintf(stderr, "error: %s: piece %zu length %zu\n",          \
+                  #__prefix, stream_pieces[piece], length);             \
+          __ok = false;                                                 \
+        }                                                               \
+      }                                                                 \
+    }                                                                   \
+  } while (0)
+
+static inline uint64_t xxh64_seed6969(const void *key, size_t key_length)
+{
+  return micro_hash_bytes_xxh64(key, key_length, 6969);
+}
+
+TEST(consistency_tests, streaming)
+{
+  unsigned char *buffer = malloc(1024);
+  fill_random(buffer, 1024);
+
+  bool ok;
+  STREAM_CONSISTENCY(micro_hash_bytes_curl, MicroHashCurlState,
+                     micro_hash_bytes_curl_init(&state),
+                     micro_hash_bytes_curl, buffer, 1024, ok);
+  if (ok)
+    STREAM_CONSISTENCY(micro_hash_bytes_jenkins, MicroHashJenkinsState,
+                       micro_hash_bytes_jenkins_init(&state),
+                       micro_hash_bytes_jenkins, buffer, 1024, ok);
+  if (ok)
+    STREAM_CONSISTENCY(micro_hash_bytes_xxh64, MicroHashXxh64State,
+                       micro_hash_bytes_xxh64_init(&state, 6969),
+                       xxh64_seed6969, buffer, 1024, ok);
+
+  free(buffer);
+  ASSERT(ok);
+  TEST_SUCCESS;
+}
+
+#ifdef MICRO_HASH_IOV
+
+TEST(consistency_tests, iov)
+{
+  unsigned char *buffer = malloc(1024);
+  fill_random(buffer, 1024);
+
+  // Split every prefix in buffers of the sizes of stream_pieces, the
+  // random sizes also give some empty buffers
+  struct iovec iov[1024 * 2];
+  for (size_t piece = 0; piece < STREAM_PIECES; ++piece)
+  {
+    uint32_t random = lcg32(piece);
+    for (size_t length = 0; length < 1024; ++length)
+    {
+      int iovcnt = 0;
+      size_t done = 0;
+      while (done < length)
+      {
+        random = lcg32(random);
+        size_t n = stream_pieces[piece] ? stream_pieces[piece]
+                                        : (random >> 24) % 80;
+        if (n > length - done)
+          n = length - done;
+        iov[iovcnt].iov_base = buffer + done;
+        iov[iovcnt].iov_len = n;
+        iovcnt++;
+        done += n;
+      }
+
+      if (micro_hash_bytes_curl_iov(iov, iovcnt)
+            != micro_hash_bytes_curl(buffer, length)
+          || micro_hash_bytes_jenkins_iov(iov, iovcnt)
+            != micro_hash_bytes_jenkins(buffer, length)
+          || micro_hash_bytes_xxh64_iov(iov, iovcnt, 6969)
+            != micro_hash_bytes_xxh64(buffer, length, 6969))
+      {
+        fprintf(stderr, "error: piece %zu length %zu\n",
+                stream_pieces[piece], length);
+        free(buffer);
+        TEST_FAILED;
+      }
+    }
+  }
+
+  free(buffer);
+  TEST_SUCCESS;
+}
+
+#endif // MICRO_HASH_IOV
+
+// Hash sets of the hash set tests, one for each variant
+HASHSET_DECLARE(uint64_t, linear64, micro_hash_int64_wang, eq_u64)
+HASHSET_CACHED_DECLARE(uint64_t, cached64, micro_hash_int64_wang, eq_u64)
+HASHSET_INCREMENTAL_DECLARE(uint64_t, incremental64, micro_hash_int64_wang, eq_u64)
+HASHSET_SWISS_DECLARE(uint64_t, swiss64, micro_hash_int64_wang, eq_u64)
+HASHSET_ROBINHOOD_DECLARE(uint64_t, robinhood64, micro_hash_int64_wang, eq_u64)
+HASHSET_CONCURRENT_DECLARE(uint64_t, concurrent64, micro_hash_int64_wang, eq_u64)
+HASHSET_SHARDED_DECLARE(uint64_t, sharded64, micro_hash_int64_wang, eq_u64)
+
+// Run pseudo random inserts, removes and lookups on keys below 4096,
+// and check each result against a table of the keys in the set
+#define HASHSET_CONSISTENCY(__prefix, __ok)                             \
+  HASHSET_CONSISTENCY_INIT(__prefix, __prefix##_set_init(&s), __ok)
+
+// Like HASHSET_CONSISTENCY, initializing the set s with __init
+#define HASHSET_CONSISTENCY_INIT(__prefix, __init, __ok)                \
+  do {                                                                  \
+    __ok = true;                                                        \
+    bool *present = calloc(4096, sizeof(bool));                         \
+    __prefix##_set s;                                                   \
+    __init;                                                             \
+    uint32_t random = lcg32(6969);                                      \
+    for (unsigned int i = 0; i < 1000000 && __ok; ++i)                  \
+    {                                                                   \
+      random = lcg32(random);                                           \
+      uint64_t key = (random >> 8) & 4095;                              \
+      switch (random >> 30)                                             \
+      {                                                                 \
+      case 0:                                                           \
+      case 1:                                                           \
+        __ok = __prefix##_set_insert(&s, key) == !present[key];         \
+        present[key] = true;                                            \
+        break;                                                          \
+      case 2:                                                           \
+        __ok = __prefix##_set_remove(&s, key) == present[key];          \
+        present[key] = false;                                           \
+        break;                                                          \
+      default:                                                          \
+        __ok = __prefix##_set_contains(&s, key) == present[key];        \
+        break;                                                          \
+      }                                                                 \
+    }                                                                   \
+    __prefix##_set_free(&s);                                            \
+    free(present);                                                      \
+  } while (0)
+
+TEST(consistency_tests, hashset_linear)
+{
+  bool ok;
+  HASHSET_CONSISTENCY(linear64, ok);
+  ASSERT(ok);
+  TEST_SUCCESS;
+}
+
+// Check that a set sized with init_with_capacity, and one sized with
+// reserve after some inserts, take 100000 keys without resizing.
+// __capacity is the capacity of the set s.
+#define HASHSET_RESERVE_CONSISTENCY(__prefix, __capacity, __ok)         \
+  do {                                                                  \
+    __ok = true;                                                        \
+    for (int reserve = 0; reserve < 2 && __ok; ++reserve)               \
+    {                                                                   \
+      __prefix##_set s;                                                 \
+      uint64_t random = lcg64(6969);                                    \
+      unsigned int i = 0;                                               \
+      if (reserve)                                                      \
+      {                                                                 \
+        __prefix##_set_init(&s);                                        \
+        for (; i < 1000; ++i, random = lcg64(random))                   \
+          __prefix##_set_insert(&s, random);                            \
+        __prefix##_set_reserve(&s, 100000);                             \
+      }                                                                 \
+      else                                                              \
+        __prefix##_set_init_with_capacity(&s, 100000);                  \
+      size_t capacity = __capacity;                                     \
+      for (; i < 100000; ++i, random = lcg64(random))                   \
+        __ok &= __prefix##_set_insert(&s, random);                      \
+      __ok &= __capacity == capacity;                                   \
+      __prefix##_set_free(&s);                                          \
+    }                                                                   \
+  } while (0)
+
+TEST(consistency_tests, hashset_concurrent)
+{
+  bool ok;
+  HASHSET_CONSISTENCY(concurrent64, ok);
+  ASSERT(ok);
+  TEST_SUCCESS;
+}
+
+typedef struct {
+  concurrent64_set *set;
+  unsigned int thread;
+  size_t count; // successful inserts or removes
+} concurrent_job;
+
+// Every thread inserts all the keys, each starting from a different
+// one, so that they race on the same keys and on the growth
+static void *concurrent_insert_job(void *arg)
+{
+  concurrent_job *job = (concurrent_job *) arg;
+  for (unsigned int i = 0; i < CONCURRENT_KEYS; ++i)
+  {
+    uint64_t key = (i + job->thread * (CONCURRENT_KEYS / CONCURRENT_THREADS))
+                   % CONCURRENT_KEYS;
+    job->count += concurrent64_set_insert(job->set, key);
+  }
+  return NULL;
+}
+
+static void *concurrent_remove_job(void *arg)
+{
+  concurrent_job *job = (concurrent_job *) arg;
+  for (unsigned int i = 0; i < CONCURRENT_KEYS; ++i)
+  {
+    uint64_t key = (i + job->thread * (CONCURRENT_KEYS / CONCURRENT_THREADS))
+                   % CONCURRENT_KEYS;
+    job->count += concurrent64_set_remove(job->set, key);
+  }
+  return NULL;
+}
+
+// Returns: the successful operations of all the jobs
+static size_t concurrent_run(concurrent64_set *set, void *(*job_func)(void *))
+{
+  pthread_t threads[CONCURRENT_THREADS];
+  concurrent_job jobs[CONCURRENT_THREADS];
+  for (unsigned int i = 0; i < CONCURRENT_THREADS; ++i)
+  {
+    jobs[i].set = set;
+    jobs[i].thread = i;
+    jobs[i].count = 0;
+    pthread_create(&threads[i], NULL, job_func, &jobs[i]);
+  }
+  size_t count = 0;
+  for (unsigned int i = 0; i < CONCURRENT_THREADS; ++i)
+  {
+    pthread_join(threads[i], NULL);
+    count += jobs[i].count;
+  }
+  return count;
+}
+
+// Each key must be inserted, and then removed, exactly once
+TEST(consistency_tests, hashset_concurrent_threads)
+{
+  concurrent64_set s;
+  concurrent64_set_init(&s);
+
+  ASSERT(concurrent_run(&s, concurrent_insert_job) == CONCURRENT_KEYS);
+  ASSERT(concurrent64_set_size(&s) == CONCURRENT_KEYS);
+  for (uint64_t key = 0; key < CONCURRENT_KEYS; ++key)
+    ASSERT(concurrent64_set_contains(&s, key));
+
+  ASSERT(concurrent_run(&s, concurrent_remove_job) == CONCURRENT_KEYS);
+  ASSERT(concurrent64_set_size(&s) == 0);
+  for (uint64_t key = 0; key < CONCURRENT_KEYS; ++key)
+    ASSERT(!concurrent64_set_contains(&s, key));
+
+  concurrent64_set_free(&s);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, hashset_sharded)
+{
+  bool ok;
+  HASHSET_CONSISTENCY(sharded64, ok);
+  ASSERT(ok);
+  HASHSET_CONSISTENCY_INIT(sharded64, sharded64_set_init_with_shards(&s, 1), ok);
+  ASSERT(ok);
+  TEST_SUCCESS;
+}
+
+typedef struct {
+  sharded64_set *set;
+  unsigned int thread;
+  size_t count; // successful inserts or removes
+} sharded_job;
+
+// Like concurrent_insert_job, inserting SHARDED_BATCH keys at a time
+// with the shards of the batch locked together
+static void *sharded_insert_job(void *arg)
+{
+  sharded_job *job = (sharded_job *) arg;
+  uint64_t keys[SHARDED_BATCH];
+  for (unsigned int i = 0; i < CONCURRENT_KEYS; i += SHARDED_BATCH)
+  {
+    for (unsigned int j = 0; j < SHARDED_BATCH; ++j)
+      keys[j] = (i + j + job->thread * (CONCURRENT_KEYS / CONCURRENT_THREADS))
+                % CONCURRENT_KEYS;
+    job->count += sharded64_set_insert_many(job->set, keys, SHARDED_BATCH, NULL);
+  }
+  return NULL;
+}
+
+static void *sharded_remove_job(void *arg)
+{
+  sharded_job *job = (sharded_job *) arg;
+  for (unsigned int i = 0; i < CONCURRENT_KEYS; ++i)
+  {
+    uint64_t key = (i + job->thread * (CONCURRENT_KEYS / CONCURRENT_THREADS))
+                   % CONCURRENT_KEYS;
+    job->count += sharded64_set_remove(job->set, key);
+  }
+  return NULL;
+}
+
+// Returns: the successful operations of all the jobs
+static size_t sharded_run(sharded64_set *set, void *(*job_func)(void *))
+{
+  pthread_t threads[CONCURRENT_THREADS];
+  sharded_job jobs[CONCURRENT_THREADS];
+  for (unsigned int i = 0; i < CONCURRENT_THREADS; ++i)
+  {
+    jobs[i].set = set;
+    jobs[i].thread = i;
+    jobs[i].count = 0;
+    pthread_create(&threads[i], NULL, job_func, &jobs[i]);
+  }
+  size_t count = 0;
+  for (unsigned int i = 0; i < CONCURRENT_THREADS; ++i)
+  {
+    pthread_join(threads[i], NULL);
+    count += jobs[i].count;
+  }
+  return count;
+}
+
+TEST(consistency_tests, hashset_sharded_threads)
+{
+  sharded64_set s;
+  sharded64_set_init(&s);
+
+  ASSERT(sharded_run(&s, sharded_insert_job) == CONCURRENT_KEYS);
+  ASSERT(sharded64_set_size(&s) == CONCURRENT_KEYS);
+  for (uint64_t key = 0; key < CONCURRENT_KEYS; ++key)
+    ASSERT(sharded64_set_contains(&s, key));
+
+  // Many chunks of HASHSET_SHARDED_CHUNK keys in one call
+  uint64_t *keys = malloc(2 * CONCURRENT_KEYS * sizeof(uint64_t));
+  bool *results = malloc(2 * CONCURRENT_KEYS * sizeof(bool));
+  for (uint64_t key = 0; key < 2 * CONCURRENT_KEYS; ++key)
+    keys[key] = key;
+  ASSERT(sharded64_set_contains_many(&s, keys, 2 * CONCURRENT_KEYS, results)
+         == CONCURRENT_KEYS);
+  for (uint64_t key = 0; key < 2 * CONCURRENT_KEYS; ++key)
+    ASSERT(results[key] == (key < CONCURRENT_KEYS));
+  free(keys);
+  free(results);
+
+  ASSERT(sharded_run(&s, sharded_remove_job) == CONCURRENT_KEYS);
+  ASSERT(sharded64_set_size(&s) == 0);
+  for (uint64_t key = 0; key < CONCURRENT_KEYS; ++key)
+    ASSERT(!sharded64_set_contains(&s, key));
+
+  sharded64_set_free(&s);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, hashset_reserve)
+{
+  bool ok;
+  HASHSET_RESERVE_CONSISTENCY(linear64, s.capacity, ok);
+  ASSERT(ok);
+  HASHSET_RESERVE_CONSISTENCY(cached64, s.capacity, ok);
+  ASSERT(ok);
+  HASHSET_RESERVE_CONSISTENCY(incremental64, s.table.capacity, ok);
+  ASSERT(ok);
+  HASHSET_RESERVE_CONSISTENCY(swiss64, s.capacity, ok);
+  ASSERT(ok);
+  HASHSET_RESERVE_CONSISTENCY(robinhood64, s.capacity, ok);
+  ASSERT(ok);
+
+  // The smallest swiss table still holds a whole group
+  swiss64_set s;
+  swiss64_set_init_with_capacity(&s, 0);
+  ASSERT(s.capacity >= HASHSET_GROUP_WIDTH);
+  swiss64_set_free(&s);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, hashset_arena)
+{
+  // Small enough for the set to outgrow it
+  static char buffer[16 * 1024];
+  hashset_arena arena;
+  hashset_arena_init(&arena, buffer, sizeof(buffer));
+
+  bool ok;
+  HASHSET_CONSISTENCY_INIT(linear64, linear64_set_init_with_allocator(&s,
+                             hashset_arena_allocator(&arena)), ok);
+  ASSERT(ok);
+  HASHSET_CONSISTENCY_INIT(cached64, cached64_set_init_with_allocator(&s,
+                             hashset_arena_allocator(&arena)), ok);
+  ASSERT(ok);
+  HASHSET_CONSISTENCY_INIT(incremental64,
+                           incremental64_set_init_with_capacity_and_allocator(
+                             &s, 256, hashset_arena_allocator(&arena)), ok);
+  ASSERT(ok);
+
+  // A presized set takes its table from the arena too
+  hashset_arena_reset(&arena);
+  linear64_set s;
+  linear64_set_init_with_capacity_and_allocator(&s, 256,
+                                     hashset_arena_allocator(&arena));
+  ASSERT((char *) s.data == buffer);
+  for (uint64_t i = 0; i < 256; ++i)
+    linear64_set_insert(&s, i);
+  ASSERT((char *) s.data == buffer);
+  linear64_set_free(&s);
+  ASSERT(arena.used == 0);
+  TEST_SUCCESS;
+}
+
+static void *null_alloc(void *context, size_t size)
+{
+  (void) context; (void) size;
+  return NULL;
+}
+
+TEST(consistency_tests, hashset_allocator_fallback)
+{
+  // Like the huge page allocator without huge pages
+  hashset_allocator allocator = { null_alloc, hashset_malloc_free, NULL };
+
+  bool ok;
+  HASHSET_CONSISTENCY_INIT(linear64,
+                           linear64_set_init_with_allocator(&s, allocator), ok);
+  ASSERT(ok);
+  HASHSET_CONSISTENCY_INIT(incremental64,
+                           incremental64_set_init_with_allocator(&s, allocator),
+                           ok);
+  ASSERT(ok);
+
+  linear64_set s;
+  linear64_set_init_with_allocator(&s, allocator);
+  ASSERT(s.data != NULL);
+  ASSERT(s.allocator.alloc == hashset_malloc_alloc);
+  linear64_set_free(&s);
+  TEST_SUCCESS;
+}
+
+#if defined(HASHSET_HUGE_PAGES)
+
+TEST(consistency_tests, hashset_huge_pages)
+{
+  // Enough keys for the tables to go past HASHSET_HUGE_PAGE_SIZE
+  linear64_set s;
+  linear64_set_init_with_allocator(&s, hashset_huge_allocator());
+  uint64_t random = lcg64(6969);
+  for (unsigned int i = 0; i < (1 << 20); ++i)
+  {
+    linear64_set_insert(&s, random);
+    random = lcg64(random);
+  }
+  ASSERT(s.size == (1 << 20));
+
+  random = lcg64(6969);
+  for (unsigned int i = 0; i < (1 << 20); ++i)
+  {
+    ASSERT(linear64_set_contains(&s, random));
+    if (i % 2 == 0)
+      ASSERT(linear64_set_remove(&s, random));
+    random = lcg64(random);
+  }
+  ASSERT(s.size == (1 << 19));
+  linear64_set_free(&s);
+  TEST_SUCCESS;
+}
+
+#endif // HASHSET_HUGE_PAGES
+
+TEST(consistency_tests, hashset_cached)
+{
+  bool ok;
+  HASHSET_CONSISTENCY(cached64, ok);
+  ASSERT(ok);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, hashset_incremental)
+{
+  bool ok;
+  HASHSET_CONSISTENCY(incremental64, ok);
+  ASSERT(ok);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, hashset_swiss)
+{
+  bool ok;
+  HASHSET_CONSISTENCY(swiss64, ok);
+  ASSERT(ok);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, hashset_robinhood)
+{
+  bool ok;
+  HASHSET_CONSISTENCY(robinhood64, ok);
+  ASSERT(ok);
+  TEST_SUCCESS;
+}
+
+// Switches the backend of every thread, so it runs alone in its own
+// suite, before the multithreaded ones
+TEST(dispatch_tests, backends)
+{
+  MicroHashBackend initial = micro_hash_get_backend();
+  ASSERT(micro_hash_backend_supported(initial));
+  ASSERT(micro_hash_backend_supported(MICRO_HASH_BACKEND_SCALAR));
+  
+#ifdef MICRO_HASH_FORCE_BACKEND
+  if (micro_hash_backend_supported(MICRO_HASH_FORCE_BACKEND))
+    ASSERT_EQ(initial, MICRO_HASH_FORCE_BACKEND);
+#endif
+
+  for (int b = 0; b < MICRO_HASH_BACKEND_COUNT; ++b)
+  {
+    MicroHashBackend backend = (MicroHashBackend) b;
+    if (micro_hash_backend_supported(backend))
+    {
+      ASSERT_EQ(micro_hash_set_backend(backend), 0);
+      ASSERT_EQ(micro_hash_get_backend(), backend);
+    }
+    else
+    {
+      ASSERT_EQ(micro_hash_set_backend(backend), -1);
+    }
+  }
+  ASSERT_EQ(micro_hash_set_backend(MICRO_HASH_BACKEND_COUNT), -1);
+
+  ASSERT_EQ(micro_hash_set_backend(initial), 0);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, micro_hash_int32_wang_batch)
+{
+  BATCH_CONSISTENCY_ALL(micro_hash_int32_wang, micro_hash_int32_wang_batch,
+                        uint32_t, uint32_t, lcg32);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, micro_hash_int32_wang2_batch)
+{
+  BATCH_CONSISTENCY_ALL(micro_hash_int32_wang2, micro_hash_int32_wang2_batch,
+                        uint32_t, uint32_t, lcg32);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, micro_hash_int32_rob_batch)
+{
+  BATCH_CONSISTENCY_ALL(micro_hash_int32_rob, micro_hash_int32_rob_batch,
+                        uint32_t, uint32_t, lcg32);
+  TEST_SUCCESS;
+}
+
+// ITERATIONS keys are above MICRO_HASH_STREAM_THRESHOLD, so these
+// also cover the non-temporal stores
+TEST(consistency_tests, micro_hash_int64_wang_batch)
+{
+  BATCH_CONSISTENCY_ALL(micro_hash_int64_wang, micro_hash_int64_wang_batch,
+                        uint64_t, uint64_t, lcg64);
+  TEST_SUCCESS;
+}
+
+TEST(consistency_tests, micro_hash_int6432_wang_batch)
+{
+  BATCH_CONSISTENCY_ALL(micro_hash_int6432_wang, micro_hash_int6432_wang_batch,
+                        uint64_t, uint32_t, lcg64);
+  TEST_SUCCESS;
+}
+
+//
+// Throughput
+//
+
+TEST(throughput_tests, micro_hash_bytes_curl)
+{
+  THROUGHPUT_TEST(micro_hash_bytes_curl);
+  TEST_SUCCESS;
+}
+
+TEST(throughput_tests, micro_hash_bytes_curl_wide)
+{
+  THROUGHPUT_TEST(micro_hash_bytes_curl_wide);
+  TEST_SUCCESS;
+}
+
+TEST(throughput_tests, micro_hash_bytes_jenkins)
+{
+  THROUGHPUT_TEST(micro_hash_bytes_jenkins);
+  TEST_SUCCESS;
+}
+
+TEST(throughput_tests, micro_hash_bytes_xxh64)
+{
+  THROUGHPUT_TEST_NAMED("micro_hash_bytes_xxh64", xxh64_seed0);
+  TEST_SUCCESS;
+}
+
+TEST(throughput_tests, micro_hash_bytes_crc32c)
+{
+  THROUGHPUT_TEST(micro_hash_bytes_crc32c);
+  THROUGHPUT_TEST(micro_hash_bytes_crc32c_scalar);
+  TEST_SUCCESS;
+}
+
+TEST(throughput_tests, micro_hash_str_stb_n)
+{
+  THROUGHPUT_TEST_NAMED("micro_hash_str_stb_n", str_stb_n_seed0);
+  TEST_SUCCESS;
+}
+
+TEST(throughput_tests, micro_hash_str_djb2_n)
+{
+  THROUGHPUT_TEST(micro_hash_str_djb2_n);
+  TEST_SUCCESS;
+}
+
+TEST(throughput_tests, micro_hash_str_sdbm_n)
+{
+  THROUGHPUT_TEST(micro_hash_str_sdbm_n);
+  TEST_SUCCESS;
+}
+
+TEST(throughput_tests, micro_hash_bytes_aes)
+{
+  THROUGHPUT_TEST_NAMED("micro_hash_bytes_aes", aes_seed0);
+  THROUGHPUT_TEST_NAMED("micro_hash_bytes_aes_scalar", aes_scalar_seed0);
+  TEST_SUCCESS;
+}
+
+//
+// Timing
+//
+
+TEST(timing_tests, micro_hash_int32_wang)
+{
+  TIMING_TEST(micro_hash_int32_wang, uint32_t, lcg32);
+  TEST_SUCCESS;
+}
+
+TEST(timing_tests, micro_hash_int32_wang2)
+{
+  TIMING_TEST(micro_hash_int32_wang2, uint32_t, lcg32);
+  TEST_SUCCESS;
+}
+
+TEST(timing_tests, micro_hash_int32_rob)
+{
+  TIMING_TEST(micro_hash_int32_rob, uint32_t, lcg32);
+  TEST_SUCCESS;
+}
+
+TEST(timing_tests, micro_hash_int64_wang)
+{
+  TIMING_TEST(micro_hash_int64_wang, uint64_t, lcg64);
+  TEST_SUCCESS;
+}
+
+TEST(timing_tests, micro_hash_int6432_wang)
+{
+  TIMING_TEST(micro_hash_int6432_wang, uint64_t, lcg64);
+  TEST_SUCCESS;
+}
+
+TEST(timing_tests, micro_hash_int64_crc32c)
+{
+  TIMING_TEST(micro_hash_int64_crc32c, uint64_t, lcg64);
+  TIMING_TEST(micro_hash_int64_crc32c_scalar, uint64_t, lcg64);
+  TEST_SUCCESS;
+}
+
+//
+// Batch
+//
+
+TEST(batch_tests, micro_hash_int32_wang_batch)
+{
+  BATCH_TEST_ALL(micro_hash_int32_wang_batch, uint32_t, uint32_t, lcg32);
+  TEST_SUCCESS;
+}
+
+TEST(batch_tests, micro_hash_int32_wang2_batch)
+{
+  BATCH_TEST_ALL(micro_hash_int32_wang2_batch, uint32_t, uint32_t, lcg32);
+  TEST_SUCCESS;
+}
+
+TEST(batch_tests, micro_hash_int32_rob_batch)
+{
+  BATCH_TEST_ALL(micro_hash_int32_rob_batch, uint32_t, uint32_t, lcg32);
+  TEST_SUCCESS;
+}
+
+TEST(batch_tests, micro_hash_int64_wang_batch)
+{
+  BATCH_TEST_ALL(micro_hash_int64_wang_batch, uint64_t, uint64_t, lcg64);
+  TEST_SUCCESS;
+}
+
+TEST(batch_tests, micro_hash_int6432_wang_batch)
+{
+  BATCH_TEST_ALL(micro_hash_int6432_wang_batch, uint64_t, uint32_t, lcg64);
+  TEST_SUCCESS;
+}
+
+//
+// Quality
+//
+// Statistical tests of every hash function, in the style of SMHasher:
+//
+//  - sac: strict avalanche criterion, flipping a bit of the key flips
+//    each bit of the hash half of the times. The value is the worst
+//    bias over all the pairs of bits, in percent
+//  - bic: bit independence criterion, the bits of the hash flipped by
+//    the same bit of the key are not correlated. The value is the
+//    worst correlation over all the triples of bits
+//  - sparse: every key with at most a few bits set
+//  - cyclic: keys made of a short cycle of bytes, repeated
+//  - diff: random keys against the same keys with 1 or 2 bits flipped
+//  - seed: strict avalanche criterion over the bits of the seed
+//  - chi2: how evenly sequential and random keys fill tables of 2^8,
+//    2^12 and 2^16 buckets indexed by the low bits of the hash, as a
+//    z score of the chi-squared statistic
+//
+// sparse, cyclic and diff count the collisions of the low 32 bits of
+// the hash, which are the bits a table uses. Each limit is a few
+// standard deviations away from what a random function would get, so
+// a good hash fails by chance with negligible probability.
+//
+// A failed check fails the test only for the functions marked as
+// strict, and is reported as weak for the others. The batch,
+// streaming and vectored variants return the same hashes as the
+// functions they are built on, which the consistency tests check,
+// and are not tested again.
+//
+
+// Longest key of the quality tests, in bytes
+#define QUALITY_MAX_KEY 32
+
+// Size of the rows buffered by a quality test
+#define QUALITY_ROWS_SIZE 4096
+
+// A hash function adapted to the quality tests. The keys are key_length
+// bytes long, and the seed is ignored by the functions without one.
+typedef uint64_t (*quality_hash_func)(const void *key, size_t key_length,
+                                      uint64_t seed);
+
+typedef struct {
+  const char *name;
+  quality_hash_func hash;
+  unsigned int bits;  // Width of the hash
+  size_t key_length;  // Length of the keys, 0 for any length
+  bool seeded;
+  bool strict;        // Whether a failed check fails the test
+} quality_hash;
+
+// Declare __hash_func##_quality, that hashes a key of __key_type
+#define QUALITY_INT_DECLARE(__hash_func, __key_type)                    \
+  static uint64_t __hash_func##_quality(const void *key,                \
+                                        size_t key_length, uint64_t seed) \
+  {                                                                     \
+    __key_type k;                                                       \
+    memcpy(&k, key, sizeof(k));                                         \
+    (void) key_length;                                                  \
+    (void) seed;                                                        \
+    return __hash_func(k);                                              \
+  }
+
+QUALITY_INT_DECLARE(micro_hash_int32_wang, uint32_t)
+QUALITY_INT_DECLARE(micro_hash_int32_wang2, uint32_t)
+QUALITY_INT_DECLARE(micro_hash_int32_rob, uint32_t)
+QUALITY_INT_DECLARE(micro_hash_int64_wang, uint64_t)
+QUALITY_INT_DECLARE(micro_hash_int6432_wang, uint64_t)
+QUALITY_INT_DECLARE(micro_hash_int64_crc32c, uint64_t)
+
+static uint64_t micro_hash_bytes_curl_quality(const void *key,
+                                              size_t key_length,
+                                              uint64_t seed)
+{
+  (void) seed;
+  return micro_hash_bytes_curl((void *) key, key_length);
+}
+
+static uint64_t micro_hash_bytes_jenkins_quality(const void *key,
+                                                 size_t key_length,
+                                                 uint64_t seed)
+{
+  (void) seed;
+  return micro_hash_bytes_jenkins((uint8_t *) key, key_length);
+}
+
+static uint64_t micro_hash_bytes_xxh64_quality(const void *key,
+                                               size_t key_length,
+                                               uint64_t seed)
+{
+  return micro_hash_bytes_xxh64(key, key_length, seed);
+}
+
+static uint64_t micro_hash_bytes_crc32c_quality(const void *key,
+                                                size_t key_length,
+                                                uint64_t seed)
+{
+  (void) seed;
+  return micro_hash_bytes_crc32c(key, key_length);
+}
+
+static uint64_t micro_hash_bytes_aes_quality(const void *key,
+                                             size_t key_length,
+                                             uint64_t seed)
+{
+  return micro_hash_bytes_aes(key, key_length, seed);
+}
+
+static uint64_t micro_hash_str_stb_n_quality(const void *key,
+                                             size_t key_length,
+                                             uint64_t seed)
+{
+  return micro_hash_str_stb_n((const char *) key, key_length, seed);
+}
+
+static uint64_t micro_hash_str_djb2_n_quality(const void *key,
+                                              size_t key_length,
+                                              uint64_t seed)
+{
+  (void) seed;
+  return micro_hash_str_djb2_n((const unsigned char *) key, key_length);
+}
+
+static uint64_t micro_hash_str_sdbm_n_quality(const void *key,
+                                              size_t key_length,
+                                              uint64_t seed)
+{
+  (void) seed;
+  return micro_hash_str_sdbm_n((const unsigned char *) key, key_length);
+}
+
+// The checks of a quality test, buffered so that the rows of a
+// function stay together when the tests run on many threads
+typedef struct {
+  const quality_hash *hash;
+  char rows[QUALITY_ROWS_SIZE];
+  size_t length;
+  int failed;
+} quality_report;
+
+// Report a check, that passes if value is at most limit
+static void quality_check(quality_report *report, const char *check,
+                          double value, double limit)
+{
+  bool passed = value <= limit;
+  if (!passed && report->hash->strict)
+    report->failed++;
+
+  if (format != FORMAT_TABLE)
+  {
+    print_record("quality_tests", report->hash->name, check, "value", value);
+    print_record("quality_tests", report->hash->name, check, "limit", limit);
+    return;
+  }
+
+  const char *result = passed ? "ok" : report->hash->strict ? "FAIL" : "weak";
+  size_t space = sizeof(report->rows) - report->length;
+  int n = snprintf(report->rows + report->length, space,
+                   "| %-34.34s | %-14s | %-12.4f | %-12.4f | %-6s |\n",
+                   report->hash->name, check, value, limit, result);
+  if (n > 0)
+    report->length += ((size_t) n < space) ? (size_t) n : space - 1;
+}
+
+// Fill key with length pseudo random bytes
+static void quality_random_key(uint64_t *state, unsigned char *key,
+                               size_t length)
+{
+  for (size_t i = 0; i < length; ++i)
+  {
+    *state = lcg64(*state);
+    key[i] = *state >> 56;
+  }
+}
+
+// Returns: the worst bias of the hash bits flipped by flipping each
+// bit of keys random keys of key_length bytes, or of a random seed if
+// flip_seed, in percent
+static double quality_avalanche(const quality_hash *hash, size_t key_length,
+                                bool flip_seed, unsigned int keys)
+{
+  unsigned int in_bits = flip_seed ? 64 : key_length * 8;
+  unsigned int *flips = calloc(in_bits * 64, sizeof(unsigned int));
+  unsigned char key[QUALITY_MAX_KEY];
+  uint64_t state = 6969;
+
+  for (unsigned int n = 0; n < keys; ++n)
+  {
+    quality_random_key(&state, key, key_length);
+    state = lcg64(state);
+    uint64_t seed = flip_seed ? state : 0;
+    uint64_t h = hash->hash(key, key_length, seed);
+    for (unsigned int i = 0; i < in_bits; ++i)
+    {
+      uint64_t flipped;
+      if (flip_seed)
+        flipped = hash->hash(key, key_length, seed ^ ((uint64_t) 1 << i));
+      else
+      {
+        key[i / 8] ^= 1 << (i % 8);
+        flipped = hash->hash(key, key_length, seed);
+        key[i / 8] ^= 1 << (i % 8);
+      }
+      uint64_t diff = h ^ flipped;
+      unsigned int *row = flips + i * 64;
+      for (unsigned int j = 0; j < hash->bits; ++j)
+        row[j] += (diff >> j) & 1;
+    }
+  }
+
+  double worst = 0.0;
+  for (unsigned int i = 0; i < in_bits; ++i)
+    for (unsigned int j = 0; j < hash->bits; ++j)
+    {
+      double bias = absd(2.0 * flips[i * 64 + j] / keys - 1.0);
+      if (bias > worst)
+        worst = bias;
+    }
+  free(flips);
+  return 100.0 * worst;
+}
+
+// Returns: the worst correlation between the flips of two bits of the
+// hash, caused by flipping the same bit of keys random keys of
+// key_length bytes
+static double quality_bit_independence(const quality_hash *hash,
+                                       size_t key_length, unsigned int keys)
+{
+  unsigned int in_bits = key_length * 8, bits = hash->bits;
+  unsigned int *flips = calloc(in_bits * bits, sizeof(unsigned int));
+  unsigned int *both = calloc(in_bits * bits * bits, sizeof(unsigned int));
+  unsigned char key[QUALITY_MAX_KEY];
+  uint64_t state = 6969;
+
+  for (unsigned int n = 0; n < keys; ++n)
+  {
+    quality_random_key(&state, key, key_length);
+    uint64_t h = hash->hash(key, key_length, 0);
+    for (unsigned int i = 0; i < in_bits; ++i)
+    {
+      key[i / 8] ^= 1 << (i % 8);
+      uint64_t diff = h ^ hash->hash(key, key_length, 0);
+      key[i / 8] ^= 1 << (i % 8);
+
+      unsigned int set[64], count = 0;
+      for (unsigned int j = 0; j < bits; ++j)
+        if ((diff >> j) & 1)
+          set[count++] = j;
+      unsigned int *row = flips + i * bits;
+      unsigned int *pairs = both + i * bits * bits;
+      for (unsigned int a = 0; a < count; ++a)
+      {
+        row[set[a]]++;
+        for (unsigned int b = a + 1; b < count; ++b)
+          pairs[set[a] * bits + set[b]]++;
+      }
+    }
+  }
+
+  // The flips of a bit that never or always flips correlate with
+  // nothing, the avalanche test catches it instead
+  double worst = 0.0;
+  for (unsigned int i = 0; i < in_bits; ++i)
+    for (unsigned int j = 0; j < bits; ++j)
+      for (unsigned int k = j + 1; k < bits; ++k)
+      {
+        double fj = flips[i * bits + j], fk = flips[i * bits + k];
+        double b = both[(i * bits + j) * bits + k];
+        double variance = fj * (keys - fj) * fk * (keys - fk);
+        if (variance == 0.0)
+          continue;
+        double covariance = keys * b - fj * fk;
+        double correlation = covariance * covariance / variance;
+        if (correlation > worst)
+          worst = correlation;
+      }
+  free(flips);
+  free(both);
+  return sqrtd(worst);
+}
+
+static int quality_compare(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+// Returns: the collisions among count hashes, sorting them
+static unsigned int quality_collisions(uint32_t *hashes, size_t count)
+{
+  qsort(hashes, count, sizeof(uint32_t), quality_compare);
+  unsigned int collisions = 0;
+  for (size_t i = 1; i < count; ++i)
+    collisions += hashes[i] == hashes[i - 1];
+  return collisions;
+}
+
+// Check the collisions among the low 32 bits of count hashes against
+// the ones expected of a random function
+static void quality_check_collisions(quality_report *report,
+                                     const char *check, uint32_t *hashes,
+                                     size_t count)
+{
+  double expected = (double) count * (count - 1) / 2.0 / 4294967296.0;
+  quality_check(report, check, quality_collisions(hashes, count),
+                expected + 6.0 * sqrtd(expected) + 1.0);
+}
+
+// Returns: the number of keys of length bits with at most set_bits set
+static size_t quality_sparse_count(unsigned int length, unsigned int set_bits)
+{
+  size_t count = 0, combinations = 1;
+  for (unsigned int k = 0; k <= set_bits; ++k)
+  {
+    count += combinations;
+    combinations = combinations * (length - k) / (k + 1);
+  }
+  return count;
+}
+
+// Hash key, and each key made by setting up to set_bits more of its
+// bits from first on
+static void quality_sparse_keys(const quality_hash *hash, unsigned char *key,
+                                size_t key_length, unsigned int first,
+                                unsigned int set_bits, uint32_t *hashes,
+                                size_t *count)
+{
+  hashes[(*count)++] = (uint32_t) hash->hash(key, key_length, 0);
+  if (set_bits == 0)
+    return;
+  for (unsigned int i = first; i < key_length * 8; ++i)
+  {
+    key[i / 8] ^= 1 << (i % 8);
+    quality_sparse_keys(hash, key, key_length, i + 1, set_bits - 1,
+                        hashes, count);
+    key[i / 8] ^= 1 << (i % 8);
+  }
+}
+
+static void quality_sparse(quality_report *report, size_t key_length,
+                           unsigned int set_bits)
+{
+  unsigned char key[QUALITY_MAX_KEY] = {0};
+  size_t count = 0;
+  uint32_t *hashes = malloc(quality_sparse_count(key_length * 8, set_bits)
+                            * sizeof(uint32_t));
+  quality_sparse_keys(report->hash, key, key_length, 0, set_bits, hashes,
+                      &count);
+
+  char check[32];
+  snprintf(check, sizeof(check), "sparse %zuB/%u", key_length, set_bits);
+  quality_check_collisions(report, check, hashes, count);
+  free(hashes);
+}
+
+// Hash keys made of reps repetitions of a cycle of cycle bytes, up to
+// QUALITY_CYCLIC_KEYS keys with different cycles
+static void quality_cyclic(quality_report *report, size_t cycle, size_t reps)
+{
+  size_t count = QUALITY_CYCLIC_KEYS;
+  if (cycle < 4 && ((size_t) 1 << (8 * cycle)) < count)
+    count = (size_t) 1 << (8 * cycle);
+
+  uint32_t *hashes = malloc(count * sizeof(uint32_t));
+  unsigned char key[QUALITY_MAX_KEY];
+  for (size_t n = 0; n < count; ++n)
+  {
+    // Odd multipliers are invertible, so the cycles are all different
+    uint64_t bytes = (uint64_t) n * 0x9E3779B97F4A7C15;
+    for (size_t i = 0; i < cycle * reps; ++i)
+      key[i] = bytes >> (8 * (i % cycle));
+    hashes[n] = (uint32_t) report->hash->hash(key, cycle * reps, 0);
+  }
+
+  char check[32];
+  snprintf(check, sizeof(check), "cyclic %zux%zu", cycle, reps);
+  quality_check_collisions(report, check, hashes, count);
+  free(hashes);
+}
+
+// Count the random keys of key_length bytes that collide with
+// themselves after flipping 1 or 2 of their bits
+static void quality_differential(quality_report *report, size_t key_length,
+                                 unsigned int keys)
+{
+  const quality_hash *hash = report->hash;
+  unsigned int in_bits = key_length * 8;
+  unsigned char key[QUALITY_MAX_KEY];
+  uint64_t state = 6969;
+  unsigned int collisions = 0;
+
+  for (unsigned int n = 0; n < keys; ++n)
+  {
+    quality_random_key(&state, key, key_length);
+    uint32_t h = (uint32_t) hash->hash(key, key_length, 0);
+    for (unsigned int i = 0; i < in_bits; ++i)
+    {
+      key[i / 8] ^= 1 << (i % 8);
+      collisions += (uint32_t) hash->hash(key, key_length, 0) == h;
+      for (unsigned int j = i + 1; j < in_bits; ++j)
+      {
+        key[j / 8] ^= 1 << (j % 8);
+        collisions += (uint32_t) hash->hash(key, key_length, 0) == h;
+        key[j / 8] ^= 1 << (j % 8);
+      }
+      key[i / 8] ^= 1 << (i % 8);
+    }
+  }
+
+  double pairs = (double) keys * (in_bits + in_bits * (in_bits - 1) / 2);
+  double expected = pairs / 4294967296.0;
+  quality_check(report, "diff", collisions,
+                expected + 6.0 * sqrtd(expected) + 1.0);
+}
+
+// Count QUALITY_CHI_KEYS keys of key_length bytes, sequential or
+// random, into the 2^16 buckets of their low 16 bits
+static void quality_buckets(const quality_hash *hash, size_t key_length,
+                            bool sequential, unsigned int *buckets)
+{
+  unsigned char key[QUALITY_MAX_KEY] = {0};
+  uint64_t state = 6969;
+  memset(buckets, 0, (1 << 16) * sizeof(unsigned int));
+  for (uint64_t n = 0; n < QUALITY_CHI_KEYS; ++n)
+  {
+    if (sequential)
+      for (size_t i = 0; i < key_length && i < 8; ++i)
+        key[i] = n >> (8 * i);
+    else
+      quality_random_key(&state, key, key_length);
+    buckets[hash->hash(key, key_length, 0) & 0xffff]++;
+  }
+}
+
+// Returns: the chi-squared statistic of the buckets, folded into
+// 2^bucket_bits buckets, as a z score
+static double quality_chi_squared(const unsigned int *buckets,
+                                  unsigned int bucket_bits)
+{
+  unsigned int count = 1 << bucket_bits;
+  double expected = (double) QUALITY_CHI_KEYS / count;
+  double chi = 0.0;
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    double observed = 0.0;
+    for (unsigned int j = i; j < (1 << 16); j += count)
+      observed += buckets[j];
+    chi += (observed - expected) * (observed - expected) / expected;
+  }
+  return (chi - (count - 1)) / sqrtd(2.0 * (count - 1));
+}
+
+// Run every check on hash
+//
+// Returns: the number of failed checks, always 0 if not strict
+static int quality_test(const quality_hash *hash)
+{
+  quality_report *report = calloc(1, sizeof(quality_report));
+  report->hash = hash;
+  char check[32];
+
+  // Fixed length keys get the checks of that length only
+  size_t length = (hash->key_length != 0) ? hash->key_length : 8;
+  static const size_t lengths[] = {4, 8, 16};
+  static const unsigned int sparse_bits[] = {5, 4, 3};
+  const double noise = 1.0 / sqrtd(QUALITY_KEYS);
+  for (unsigned int i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+  {
+    if (hash->key_length != 0 && lengths[i] != hash->key_length)
+      continue;
+    snprintf(check, sizeof(check), "sac %zuB", lengths[i]);
+    quality_check(report, check,
+                  quality_avalanche(hash, lengths[i], false, QUALITY_KEYS),
+                  600.0 * noise);
+  }
+
+  snprintf(check, sizeof(check), "bic %zuB", length);
+  quality_check(report, check,
+                quality_bit_independence(hash, length, QUALITY_BIC_KEYS),
+                6.0 / sqrtd(QUALITY_BIC_KEYS));
+
+  for (unsigned int i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+    if (hash->key_length == 0 || lengths[i] == hash->key_length)
+      quality_sparse(report, lengths[i], sparse_bits[i]);
+
+  if (hash->key_length == 0)
+  {
+    quality_cyclic(report, 3, 8);
+    quality_cyclic(report, 4, 8);
+    quality_cyclic(report, 8, 4);
+  }
+  else
+  {
+    quality_cyclic(report, hash->key_length / 2, 2);
+    if (hash->key_length >= 8)
+      quality_cyclic(report, hash->key_length / 4, 4);
+  }
+
+  quality_differential(report, length, QUALITY_DIFF_KEYS);
+
+  if (hash->seeded)
+    quality_check(report, "seed",
+                  quality_avalanche(hash, length, true, QUALITY_KEYS),
+                  600.0 * noise);
+
+  unsigned int *buckets = malloc((1 << 16) * sizeof(unsigned int));
+  for (int sequential = 1; sequential >= 0; --sequential)
+  {
+    quality_buckets(hash, length, sequential, buckets);
+    for (unsigned int bucket_bits = 8; bucket_bits <= 16; bucket_bits += 4)
+    {
+      snprintf(check, sizeof(check), "chi2 %s 2^%u",
+               sequential ? "seq" : "rnd", bucket_bits);
+      quality_check(report, check, quality_chi_squared(buckets, bucket_bits),
+                    6.0);
+    }
+  }
+  free(buckets);
+
+  if (format == FORMAT_TABLE)
+    printf("%s", report->rows);
+  int failed = report->failed;
+  free(report);
+  return failed;
+}
+
+// Run the quality checks on __hash_func, through
+// __hash_func##_quality, and fail the test if a strict check fails
+#define QUALITY_TEST(__hash_func, __bits, __key_length, __seeded, __strict) \
+  do {                                                                  \
+    quality_hash hash = {                                               \
+      #__hash_func, __hash_func##_quality, __bits, __key_length,        \
+      __seeded, __strict                                                \
+    };                                                                  \
+    if (quality_test(&hash) > 0)                                        \
+      TEST_FAILED;                                                      \
+  } while (0)
+
+TEST(quality_tests, micro_hash_int32_wang)
+{
+  QUALITY_TEST(micro_hash_int32_wang, 32, 4, false, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_int32_wang2)
+{
+  QUALITY_TEST(micro_hash_int32_wang2, 32, 4, false, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_int32_rob)
+{
+  QUALITY_TEST(micro_hash_int32_rob, 32, 4, false, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_int64_wang)
+{
+  QUALITY_TEST(micro_hash_int64_wang, 64, 8, false, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_int6432_wang)
+{
+  QUALITY_TEST(micro_hash_int6432_wang, 32, 8, false, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_int64_crc32c)
+{
+  QUALITY_TEST(micro_hash_int64_crc32c, 32, 8, false, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_bytes_curl)
+{
+  QUALITY_TEST(micro_hash_bytes_curl, 8 * sizeof(size_t), 0, false, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_bytes_jenkins)
+{
+  QUALITY_TEST(micro_hash_bytes_jenkins, 32, 0, false, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_bytes_xxh64)
+{
+  QUALITY_TEST(micro_hash_bytes_xxh64, 64, 0, true, true);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_bytes_crc32c)
+{
+  QUALITY_TEST(micro_hash_bytes_crc32c, 32, 0, false, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_bytes_aes)
+{
+  QUALITY_TEST(micro_hash_bytes_aes, 64, 0, true, true);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_str_stb_n)
+{
+  QUALITY_TEST(micro_hash_str_stb_n, 8 * sizeof(size_t), 0, true, false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_str_djb2_n)
+{
+  QUALITY_TEST(micro_hash_str_djb2_n, 8 * sizeof(unsigned long), 0, false,
+               false);
+  TEST_SUCCESS;
+}
+
+TEST(quality_tests, micro_hash_str_sdbm_n)
+{
+  QUALITY_TEST(micro_hash_str_sdbm_n, 8 * sizeof(unsigned long), 0, false,
+               false);
+  TEST_SUCCESS;
+}
+
+//
+// Hash sets
+//
+
+#define PRINT_HASHSET(__set_name, __op_name, __mops)                    \
+  do {                                                                  \
+    if (format == FORMAT_TABLE)                                         \
+      printf("| %-34.34s | %-12s | %-15.1f |\n", __set_name, __op_name, __mops); \
+    else                                                                \
+      print_record("hashset_tests", __set_name, __op_name, "Mops/s", __mops); \
+  } while (0)
+
+// Measure how many millions of operations per second a hash set
+// does: inserting HASHSET_BENCH_KEYS random keys, then looking each
+// of them up, then looking up as many keys that are not in the set
+#define HASHSET_BENCH(__prefix, __set_name)                             \
+  HASHSET_BENCH_INIT(__prefix, __set_name, __prefix##_set_init(&s))
+
+// Like HASHSET_BENCH, initializing the set s with __init
+#define HASHSET_BENCH_INIT(__prefix, __set_name, __init)                \
+  do {                                                                  \
+    __prefix##_set s;                                                   \
+    __init;                                                             \
+    volatile size_t sink = 0;                                           \
+    uint64_t random = lcg64(6969);                                      \
+    double start = now_seconds();                                       \
+    for (unsigned int i = 0; i < HASHSET_BENCH_KEYS; ++i)               \
+    {                                                                   \
+      __prefix##_set_insert(&s, random);                                \
+      random = lcg64(random);                                           \
+    }                                                                   \
+    double elapsed = now_seconds() - start;                             \
+    PRINT_HASHSET(__set_name, "insert", HASHSET_BENCH_KEYS / elapsed / 1e6); \
+                                                                        \
+    uint64_t miss = random;                                             \
+    random = lcg64(6969);                                               \
+    start = now_seconds();                                              \
+    for (unsigned int i = 0; i < HASHSET_BENCH_KEYS; ++i)               \
+    {                                                                   \
+      sink += __prefix##_set_contains(&s, random);                      \
+      random = lcg64(random);                                           \
+    }                                                                   \
+    elapsed = now_seconds() - start;                                    \
+    PRINT_HASHSET(__set_name, "lookup hit", HASHSET_BENCH_KEYS / elapsed / 1e6); \
+                                                                        \
+    start = now_seconds();                                              \
+    for (unsigned int i = 0; i < HASHSET_BENCH_KEYS; ++i)               \
+    {                                                                   \
+      sink += __prefix##_set_contains(&s, miss);                        \
+      miss = lcg64(miss);                                               \
+    }                                                                   \
+    elapsed = now_seconds() - start;                                    \
+    PRINT_HASHSET(__set_name, "lookup miss", HASHSET_BENCH_KEYS / elapsed / 1e6); \
+                                                                        \
+    (void) sink;                                                        \
+    __prefix##_set_free(&s);                                            \
+  } while (0)
+
+// Fill a set with CHURN_KEYS keys, then run CHURN_ROUNDS rounds
+// that remove the oldest key and insert a new one. Stores the number
+// of operations per second in __mops.
+#define HASHSET_CHURN(__prefix, __set, __mops)                          \
+  do {                                                                  \
+    uint64_t oldest = lcg64(6969);                                      \
+    uint64_t newest = oldest;                                           \
+    for (unsigned int i = 0; i < CHURN_KEYS; ++i)                       \
+    {                                                                   \
+      __prefix##_set_insert(__set, newest);                             \
+      newest = lcg64(newest);                                           \
+    }                                                                   \
+    double start = now_seconds();                                       \
+    for (unsigned int i = 0; i < CHURN_ROUNDS; ++i)                     \
+    {                                                                   \
+      __prefix##_set_remove(__set, oldest);                             \
+      __prefix##_set_insert(__set, newest);                             \
+      oldest = lcg64(oldest);                                           \
+      newest = lcg64(newest);                                           \
+    }                                                                   \
+    __mops = 2.0 * CHURN_ROUNDS / (now_seconds() - start) / 1e6;        \
+  } while (0)
+
+// Like HASHSET_BENCH, with insert_many and contains_many over arrays
+// of the same keys
+#define HASHSET_BULK_BENCH(__prefix, __set_name)                        \
+  do {                                                                  \
+    uint64_t *keys = malloc(2 * HASHSET_BENCH_KEYS * sizeof(uint64_t)); \
+    uint64_t *misses = keys + HASHSET_BENCH_KEYS;                       \
+    keys[0] = lcg64(6969);                                              \
+    for (unsigned int i = 1; i < 2 * HASHSET_BENCH_KEYS; ++i)           \
+      keys[i] = lcg64(keys[i - 1]);                                     \
+    __prefix##_set s;                                                   \
+    __prefix##_set_init(&s);                                            \
+    volatile size_t sink = 0;                                           \
+    double start = now_seconds();                                       \
+    sink += __prefix##_set_insert_many(&s, keys, HASHSET_BENCH_KEYS, NULL); \
+    double elapsed = now_seconds() - start;                             \
+    PRINT_HASHSET(__set_name, "insert bulk", HASHSET_BENCH_KEYS / elapsed / 1e6); \
+                                                                        \
+    start = now_seconds();                                              \
+    sink += __prefix##_set_contains_many(&s, keys, HASHSET_BENCH_KEYS, NULL); \
+    elapsed = now_seconds() - start;                                    \
+    PRINT_HASHSET(__set_name, "hit bulk", HASHSET_BENCH_KEYS / elapsed / 1e6); \
+                                                                        \
+    start = now_seconds();                                              \
+    sink += __prefix##_set_contains_many(&s, misses, HASHSET_BENCH_KEYS, NULL); \
+    elapsed = now_seconds() - start;                                    \
+    PRINT_HASHSET(__set_name, "miss bulk", HASHSET_BENCH_KEYS / elapsed / 1e6); \
+                                                                        \
+    (void) sink;                                                        \
+    __prefix##_set_free(&s);                                            \
+    free(keys);                                                         \
+  } while (0)
+
+#define HASHSET_CHURN_BENCH(__prefix, __set_name)                       \
+  do {                                                                  \
+    __prefix##_set s;                                                   \
+    __prefix##_set_init(&s);                                            \
+    double mops;                                                        \
+    HASHSET_CHURN(__prefix, &s, mops);                                  \
+    PRINT_HASHSET(__set_name, "churn", mops);                           \
+    __prefix##_set_free(&s);                                            \
+  } while (0)
+
+TEST(hashset_tests, linear)
+{
+  HASHSET_BENCH(linear64, "HASHSET_DECLARE");
+  HASHSET_BULK_BENCH(linear64, "HASHSET_DECLARE");
+  HASHSET_BENCH_INIT(linear64, "HASHSET_DECLARE (reserved)",
+                     linear64_set_init_with_capacity(&s, HASHSET_BENCH_KEYS));
+  HASHSET_CHURN_BENCH(linear64, "HASHSET_DECLARE");
+  TEST_SUCCESS;
+}
+
+// Create SHORT_LIVED_SETS sets, each getting SHORT_LIVED_KEYS inserts
+// before being freed and __reset running
+#define HASHSET_SHORT_LIVED_BENCH(__prefix, __set_name, __init, __reset) \
+  do {                                                                  \
+    uint64_t random = lcg64(6969);                                      \
+    double start = now_seconds();                                       \
+    for (unsigned int i = 0; i < SHORT_LIVED_SETS; ++i)                 \
+    {                                                                   \
+      __prefix##_set s;                                                 \
+      __init;                                                           \
+      for (unsigned int j = 0; j < SHORT_LIVED_KEYS; ++j)               \
+      {                                                                 \
+        __prefix##_set_insert(&s, random);                              \
+        random = lcg64(random);                                         \
+      }                                                                 \
+      __prefix##_set_free(&s);                                          \
+      __reset;                                                          \
+    }                                                                   \
+    double elapsed = now_seconds() - start;                             \
+    PRINT_HASHSET(__set_name, "short-lived",                            \
+                  (double) SHORT_LIVED_SETS * SHORT_LIVED_KEYS / elapsed / 1e6); \
+  } while (0)
+
+TEST(hashset_tests, allocators)
+{
+  HASHSET_SHORT_LIVED_BENCH(linear64, "HASHSET_DECLARE (malloc)",
+                            linear64_set_init(&s), (void) 0);
+
+  // Fits every table a set of SHORT_LIVED_KEYS keys grows through
+  char *buffer = malloc(64 * 1024);
+  hashset_arena arena;
+  hashset_arena_init(&arena, buffer, 64 * 1024);
+  HASHSET_SHORT_LIVED_BENCH(linear64, "HASHSET_DECLARE (arena)",
+                            linear64_set_init_with_allocator(&s,
+                              hashset_arena_allocator(&arena)),
+                            hashset_arena_reset(&arena));
+  free(buffer);
+
+#if defined(HASHSET_HUGE_PAGES)
+  HASHSET_BENCH_INIT(linear64, "HASHSET_DECLARE (huge pages)",
+                     linear64_set_init_with_allocator(&s,
+                       hashset_huge_allocator()));
+#endif
+  TEST_SUCCESS;
+}
+
+TEST(hashset_tests, incremental)
+{
+  HASHSET_BENCH(incremental64, "HASHSET_INCREMENTAL_DECLARE");
+  HASHSET_CHURN_BENCH(incremental64, "HASHSET_INCREMENTAL_DECLARE");
+  TEST_SUCCESS;
+}
+
+TEST(hashset_tests, swiss)
+{
+  HASHSET_BENCH(swiss64, "HASHSET_SWISS_DECLARE");
+  HASHSET_BULK_BENCH(swiss64, "HASHSET_SWISS_DECLARE");
+  HASHSET_BENCH_INIT(swiss64, "HASHSET_SWISS_DECLARE (reserved)",
+                     swiss64_set_init_with_capacity(&s, HASHSET_BENCH_KEYS));
+  HASHSET_CHURN_BENCH(swiss64, "HASHSET_SWISS_DECLARE");
+  TEST_SUCCESS;
+}
+
+TEST(hashset_tests, robinhood)
+{
+  HASHSET_BENCH(robinhood64, "HASHSET_ROBINHOOD_DECLARE");
+  HASHSET_CHURN_BENCH(robinhood64, "HASHSET_ROBINHOOD_DECLARE");
+  TEST_SUCCESS;
+}
+
+typedef struct {
+  void *set;
+  uint64_t first; // lcg64 seed of the keys of the thread
+  unsigned int count;
+  size_t found;
+} scaling_job;
+
+// Declare __prefix##_scaling_bench, that inserts HASHSET_BENCH_KEYS
+// keys into one growing set and then looks them up, from 1, 2, 4...
+// up to one thread for each CPU, each thread with its own part of
+// the keys
+#define HASHSET_SCALING_DECLARE(__prefix)                               \
+  static void *__prefix##_scaling_insert(void *arg)                     \
+  {                                                                     \
+    scaling_job *job = (scaling_job *) arg;                             \
+    uint64_t random = job->first;                                       \
+    for (unsigned int i = 0; i < job->count; ++i)                       \
+    {                                                                   \
+      __prefix##_set_insert((__prefix##_set *) job->set, random);       \
+      random = lcg64(random);                                           \
+    }                                                                   \
+    return NULL;                                                        \
+  }                                                                     \
+                                                                        \
+  static void *__prefix##_scaling_lookup(void *arg)                     \
+  {                                                                     \
+    scaling_job *job = (scaling_job *) arg;                             \
+    uint64_t random = job->first;                                       \
+    for (unsigned int i = 0; i < job->count; ++i)                       \
+    {                                                                   \
+      job->found += __prefix##_set_contains((__prefix##_set *) job->set, \
+                                            random);                    \
+      random = lcg64(random);                                           \
+    }                                                                   \
+    return NULL;                                                        \
+  }                                                                     \
+                                                                        \
+  static void __prefix##_scaling_bench(const char *set_name)            \
+  {                                                                     \
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);                          \
+    unsigned int max_threads = (cpus > 0) ? (unsigned int) cpus : 1;    \
+    pthread_t *threads = malloc(max_threads * sizeof(pthread_t));       \
+    scaling_job *jobs = malloc(max_threads * sizeof(scaling_job));      \
+    for (unsigned int thread_count = 1; thread_count <= max_threads;    \
+         thread_count = (thread_count * 2 > max_threads                 \
+                         && thread_count < max_threads)                 \
+                        ? max_threads : thread_count * 2)               \
+    {                                                                   \
+      __prefix##_set s;                                                 \
+      __prefix##_set_init(&s);                                          \
+      uint64_t random = lcg64(6969);                                    \
+      for (unsigned int i = 0; i < thread_count; ++i)                   \
+      {                                                                 \
+        jobs[i].set = &s;                                               \
+        jobs[i].first = random;                                         \
+        jobs[i].count = HASHSET_BENCH_KEYS / thread_count;              \
+        jobs[i].found = 0;                                              \
+        for (unsigned int j = 0; j < jobs[i].count; ++j)                \
+          random = lcg64(random);                                       \
+      }                                                                 \
+                                                                        \
+      void *(*funcs[2])(void *) = { __prefix##_scaling_insert,          \
+                                    __prefix##_scaling_lookup };        \
+      const char *op_names[2] = { "insert", "lookup" };                 \
+      for (int op = 0; op < 2; ++op)                                    \
+      {                                                                 \
+        double start = now_seconds();                                   \
+        for (unsigned int i = 0; i < thread_count; ++i)                 \
+          pthread_create(&threads[i], NULL, funcs[op], &jobs[i]);       \
+        for (unsigned int i = 0; i < thread_count; ++i)                 \
+          pthread_join(threads[i], NULL);                               \
+        double elapsed = now_seconds() - start;                         \
+                                                                        \
+        char op_name[16];                                               \
+        snprintf(op_name, sizeof(op_name), "%s %ut", op_names[op],      \
+                 thread_count);                                         \
+        PRINT_HASHSET(set_name, op_name,                                \
+                      (double) (jobs[0].count * thread_count)           \
+                      / elapsed / 1e6);                                 \
+      }                                                                 \
+      __prefix##_set_free(&s);                                          \
+    }                                                                   \
+    free(threads);                                                      \
+    free(jobs);                                                         \
+  }
+
+HASHSET_SCALING_DECLARE(concurrent64)
+HASHSET_SCALING_DECLARE(sharded64)
+
+TEST(hashset_tests, concurrent)
+{
+  HASHSET_BENCH(concurrent64, "HASHSET_CONCURRENT_DECLARE");
+  concurrent64_scaling_bench("HASHSET_CONCURRENT_DECLARE");
+  TEST_SUCCESS;
+}
+
+TEST(hashset_tests, sharded)
+{
+  HASHSET_BENCH(sharded64, "HASHSET_SHARDED_DECLARE");
+  sharded64_scaling_bench("HASHSET_SHARDED_DECLARE");
+  TEST_SUCCESS;
+}
+
+static inline size_t str_stb_seed0(const char *str)
+{
+  return micro_hash_str_stb((char *) str, 0);
+}
+
+static inline bool eq_str(const char *a, const char *b)
+{
+  return strcmp(a, b) == 0;
+}
+
+HASHSET_DECLARE(const char *, linear_str, str_stb_seed0, eq_str)
+HASHSET_CACHED_DECLARE(const char *, cached_str, str_stb_seed0, eq_str)
+
+// Writes count URL-like keys, that share a long prefix, starting from
+// the random seed. Returns: an array of pointers to them, the strings
+// are stored after the pointers and freed with it.
+static const char **str_keys(unsigned int count, uint64_t seed)
+{
+  char *buffer = malloc(count * (sizeof(char *) + HASHSET_STR_KEY_SIZE));
+  const char **keys = (const char **) buffer;
+  char *str = buffer + count * sizeof(char *);
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    seed = lcg64(seed);
+    snprintf(str, HASHSET_STR_KEY_SIZE, "https://example.com/items/%016llx",
+             (unsigned long long) seed);
+    keys[i] = str;
+    str += HASHSET_STR_KEY_SIZE;
+  }
+  return keys;
+}
+
+// Like HASHSET_BENCH, with HASHSET_STR_KEYS string keys
+#define HASHSET_STR_BENCH(__prefix, __set_name)                         \
+  do {                                                                  \
+    const char **keys = str_keys(HASHSET_STR_KEYS, 6969);               \
+    const char **misses = str_keys(HASHSET_STR_KEYS, 1337);             \
+    __prefix##_set s;                                                   \
+    __prefix##_set_init(&s);                                            \
+    volatile size_t sink = 0;                                           \
+    double start = now_seconds();                                       \
+    for (unsigned int i = 0; i < HASHSET_STR_KEYS; ++i)                 \
+      __prefix##_set_insert(&s, keys[i]);                               \
+    double elapsed = now_seconds() - start;                             \
+    PRINT_HASHSET(__set_name, "insert", HASHSET_STR_KEYS / elapsed / 1e6); \
+                                                                        \
+    start = now_seconds();                                              \
+    for (unsigned int i = 0; i < HASHSET_STR_KEYS; ++i)                 \
+      sink += __prefix##_set_contains(&s, keys[i]);                     \
+    elapsed = now_seconds() - start;                                    \
+    PRINT_HASHSET(__set_name, "lookup hit", HASHSET_STR_KEYS / elapsed / 1e6); \
+                                                                        \
+    start = now_seconds();                                              \
+    for (unsigned int i = 0; i < HASHSET_STR_KEYS; ++i)                 \
+      sink += __prefix##_set_contains(&s, misses[i]);                   \
+    elapsed = now_seconds() - start;                                    \
+    PRINT_HASHSET(__set_name, "lookup miss", HASHSET_STR_KEYS / elapsed / 1e6); \
+                                                                        \
+    (void) sink;                                                        \
+    __prefix##_set_free(&s);                                            \
+    free(keys);                                                         \
+    free(misses);                                                       \
+  } while (0)
+
+TEST(hashset_tests, linear_str)
+{
+  HASHSET_STR_BENCH(linear_str, "HASHSET_DECLARE (str)");
+  TEST_SUCCESS;
+}
+
+TEST(hashset_tests, cached_str)
+{
+  HASHSET_STR_BENCH(cached_str, "HASHSET_CACHED_DECLARE (str)");
+  TEST_SUCCESS;
+}
+
+//
+// Corpora
+//
+// Collisions, uniformity and speed of the bytes and string hash
+// functions over corpora of realistic keys: random bytes, English
+// words, URLs, UUIDs and sequential numbers. The keys of a corpus are
+// all different, and are NUL terminated strings so that the string
+// functions hash them whole, the random bytes are never 0.
+//
+
+#define PRINT_CORPUS(__hash_name, __corpus_name, __collisions, __deviation) \
+  do {                                                                  \
+    if (format == FORMAT_TABLE)                                         \
+      printf("| %-34.34s | %-12s | %-12u | %-15.3f |\n", __hash_name, __corpus_name, __collisions, __deviation); \
+    else                                                                \
+    {                                                                   \
+      print_record("corpus_tests", __hash_name, __corpus_name, "collisions", __collisions); \
+      print_record("corpus_tests", __hash_name, __corpus_name, "non-uniformity", __deviation); \
+    }                                                                   \
+  } while (0)
+
+#define PRINT_CORPUS_SPEED(__hash_name, __corpus_name, __mkeys, __mops) \
+  do {                                                                  \
+    if (format == FORMAT_TABLE)                                         \
+      printf("| %-34.34s | %-12s | %-15.1f | %-15.1f |\n", __hash_name, __corpus_name, __mkeys, __mops); \
+    else                                                                \
+    {                                                                   \
+      print_record("corpus_speed_tests", __hash_name, __corpus_name, "Mkeys/s", __mkeys); \
+      print_record("corpus_speed_tests", __hash_name, __corpus_name, "Mops/s", __mops); \
+    }                                                                   \
+  } while (0)
+
+typedef enum {
+  CORPUS_RANDOM,
+  CORPUS_WORDS,
+  CORPUS_URLS,
+  CORPUS_UUIDS,
+  CORPUS_NUMBERS,
+  CORPORA,
+} corpus_kind;
+
+static const char *corpus_names[CORPORA] = {
+  "random", "words", "urls", "uuids", "numbers",
+};
+
+typedef struct {
+  const char **keys;
+  size_t *lengths;
+} corpus;
+
+static corpus corpora[CORPORA];
+static pthread_once_t corpora_once = PTHREAD_ONCE_INIT;
+
+// Words of the words and URLs corpora
+static const char *corpus_words[] = {
+  "the", "be", "to", "of", "and", "in", "that", "have", "it", "for",
+  "not", "on", "with", "he", "as", "you", "do", "at", "this", "but",
+  "his", "by", "from", "they", "we", "say", "her", "she", "or", "an",
+  "will", "my", "one", "all", "would", "there", "their", "what", "so",
+  "up", "out", "if", "about", "who", "get", "which", "go", "me", "when",
+  "make", "can", "like", "time", "no", "just", "him", "know", "take",
+  "people", "into", "year", "your", "good", "some", "could", "them",
+  "see", "other", "than", "then", "now", "look", "only", "come", "its",
+  "over", "think", "also", "back", "after", "use", "two", "how", "our",
+  "work", "first", "well", "way", "even", "new", "want", "because",
+  "any", "these", "give", "day", "most", "us", "house", "water",
+  "world", "school", "country", "family", "system", "program", "number",
+  "night", "point", "home", "money", "story", "month", "right", "study",
+  "book", "word", "business", "issue", "side", "kind", "head", "service",
+  "friend", "father", "power", "hour", "game", "line", "member", "city",
+};
+
+#define CORPUS_WORDS_COUNT (sizeof(corpus_words) / sizeof(corpus_words[0]))
+
+// Write the n-th key of a corpus kind into key, drawing from random
+static void corpus_key(corpus_kind kind, unsigned int n, uint64_t *random,
+                       char *key)
+{
+  switch (kind)
+  {
+  case CORPUS_RANDOM:
+  {
+    *random = lcg64(*random);
+    size_t length = 4 + (*random >> 58) % (CORPUS_KEY_SIZE - 4);
+    for (size_t i = 0; i < length; ++i)
+    {
+      *random = lcg64(*random);
+      key[i] = (char) (1 + (*random >> 56) % 255);
+    }
+    key[length] = '\0';
+    break;
+  }
+  case CORPUS_WORDS:
+  {
+    *random = lcg64(*random);
+    unsigned int words = 1 + (*random >> 62) % 3;
+    key[0] = '\0';
+    for (unsigned int i = 0; i < words; ++i)
+    {
+      *random = lcg64(*random);
+      strcat(key, corpus_words[(*random >> 33) % CORPUS_WORDS_COUNT]);
+    }
+    break;
+  }
+  case CORPUS_URLS:
+  {
+    const char *w[3];
+    for (int i = 0; i < 3; ++i)
+    {
+      *random = lcg64(*random);
+      w[i] = corpus_words[(*random >> 33) % CORPUS_WORDS_COUNT];
+    }
+    *random = lcg64(*random);
+    snprintf(key, CORPUS_KEY_SIZE, "https://www.%s.com/%s/%s?id=%u",
+             w[0], w[1], w[2], (unsigned int) (*random >> 47));
+    break;
+  }
+  case CORPUS_UUIDS:
+  {
+    uint64_t high = lcg64(*random), low = lcg64(high);
+    *random = low;
+    // Version 4, variant 1
+    high = (high & ~(uint64_t) 0xf000) | 0x4000;
+    low = (low & ~((uint64_t) 0xc << 60)) | ((uint64_t) 0x8 << 60);
+    snprintf(key, CORPUS_KEY_SIZE, "%08x-%04x-%04x-%04x-%012llx",
+             (unsigned int) (high >> 32), (unsigned int) (high >> 16) & 0xffff,
+             (unsigned int) high & 0xffff, (unsigned int) (low >> 48),
+             (unsigned long long) (low & 0xffffffffffffULL));
+    break;
+  }
+  default:
+    snprintf(key, CORPUS_KEY_SIZE, "%u", n);
+    break;
+  }
+}
+
+// Generate CORPUS_KEYS different keys of a corpus kind, dropping the
+// repeated ones with a string hash set
+static void corpus_generate(corpus_kind kind, corpus *c)
+{
+  char *buffer = malloc(CORPUS_KEYS * (sizeof(char *) + sizeof(size_t)
+                                       + CORPUS_KEY_SIZE));
+  c->keys = (const char **) buffer;
+  c->lengths = (size_t *) (buffer + CORPUS_KEYS * sizeof(char *));
+  char *key = buffer + CORPUS_KEYS * (sizeof(char *) + sizeof(size_t));
+
+  linear_str_set seen;
+  linear_str_set_init_with_capacity(&seen, CORPUS_KEYS);
+  uint64_t random = lcg64(6969 + kind);
+  unsigned int count = 0;
+  for (unsigned int n = 0; count < CORPUS_KEYS; ++n)
+  {
+    corpus_key(kind, n, &random, key);
+    if (!linear_str_set_insert(&seen, key))
+      continue;
+    c->keys[count] = key;
+    c->lengths[count] = strlen(key);
+    key += CORPUS_KEY_SIZE;
+    count++;
+  }
+  linear_str_set_free(&seen);
+}
+
+static void corpora_generate(void)
+{
+  for (int kind = 0; kind < CORPORA; ++kind)
+    corpus_generate((corpus_kind) kind, &corpora[kind]);
+}
+
+// Returns: the corpora, generated by the first caller
+static const corpus *corpora_get(void)
+{
+  pthread_once(&corpora_once, corpora_generate);
+  return corpora;
+}
+
+// Free the corpora, if they were generated
+static void corpora_free(void)
+{
+  for (int kind = 0; kind < CORPORA; ++kind)
+    free(corpora[kind].keys);
+}
+
+// Declare __hash_name##_corpus, that hashes a key of a corpus with
+// __expression over key and length, and a string hash set using it
+#define CORPUS_DECLARE(__hash_name, __expression)                       \
+  static inline uint64_t __hash_name##_corpus(const char *key,          \
+                                              size_t length)            \
+  {                                                                     \
+    (void) length;                                                      \
+    return (uint64_t) (__expression);                                   \
+  }                                                                     \
+  static inline size_t __hash_name##_corpus_str(const char *key)        \
+  {                                                                     \
+    return (size_t) __hash_name##_corpus(key, strlen(key));             \
+  }                                                                     \
+  HASHSET_DECLARE(const char *, __hash_name##_str, __hash_name##_corpus_str, eq_str)
+
+CORPUS_DECLARE(micro_hash_bytes_curl,
+               micro_hash_bytes_curl((void *) key, length))
+CORPUS_DECLARE(micro_hash_bytes_curl_wide,
+               micro_hash_bytes_curl_wide(key, length))
+CORPUS_DECLARE(micro_hash_bytes_jenkins,
+               micro_hash_bytes_jenkins((uint8_t *) key, length))
+CORPUS_DECLARE(micro_hash_bytes_xxh64,
+               micro_hash_bytes_xxh64(key, length, 0))
+CORPUS_DECLARE(micro_hash_bytes_crc32c,
+               micro_hash_bytes_crc32c(key, length))
+CORPUS_DECLARE(micro_hash_bytes_aes,
+               micro_hash_bytes_aes(key, length, 0))
+CORPUS_DECLARE(micro_hash_str_stb,
+               micro_hash_str_stb((char *) key, 0))
+CORPUS_DECLARE(micro_hash_str_stb_n,
+               micro_hash_str_stb_n(key, length, 0))
+CORPUS_DECLARE(micro_hash_str_djb2,
+               micro_hash_str_djb2((unsigned char *) key))
+CORPUS_DECLARE(micro_hash_str_djb2_n,
+               micro_hash_str_djb2_n((const unsigned char *) key, length))
+CORPUS_DECLARE(micro_hash_str_sdbm,
+               micro_hash_str_sdbm((unsigned char *) key))
+CORPUS_DECLARE(micro_hash_str_sdbm_n,
+               micro_hash_str_sdbm_n((const unsigned char *) key, length))
+
+// Count the collisions of the full hashes of each corpus, and the
+// non-uniformity of the low PRECISION bits of the different ones
+#define CORPUS_TEST(__hash_name)                                        \
+  do {                                                                  \
+    const corpus *c = corpora_get();                                    \
+    unsigned int *count = malloc(sizeof(unsigned int) * (1 << PRECISION)); \
+    for (int kind = 0; kind < CORPORA; ++kind)                          \
+    {                                                                   \
+      memset(count, 0, sizeof(unsigned int) * (1 << PRECISION));        \
+      u64_set s;                                                        \
+      u64_set_init_with_capacity(&s, CORPUS_KEYS);                      \
+      unsigned int collisions = 0;                                      \
+      for (unsigned int i = 0; i < CORPUS_KEYS; ++i)                    \
+      {                                                                 \
+        uint64_t hash = __hash_name##_corpus(c[kind].keys[i],           \
+                                             c[kind].lengths[i]);       \
+        if (u64_set_insert(&s, hash))                                   \
+          count[hash % (1 << PRECISION)]++;                             \
+        else                                                            \
+          collisions++;                                                 \
+      }                                                                 \
+      double mean_deviation;                                            \
+      UNIFORMITY_DEVIATION(mean_deviation, count, CORPUS_KEYS);         \
+      PRINT_CORPUS(#__hash_name, corpus_names[kind], collisions, mean_deviation); \
+      u64_set_free(&s);                                                 \
+    }                                                                   \
+    free(count);                                                        \
+  } while (0)
+
+// Measure how many millions of keys of each corpus __hash_name hashes
+// per second, and how many millions of inserts and lookups per second
+// a string hash set using it does
+#define CORPUS_SPEED_TEST(__hash_name)                                  \
+  do {                                                                  \
+    const corpus *c = corpora_get();                                    \
+    for (int kind = 0; kind < CORPORA; ++kind)                          \
+    {                                                                   \
+      volatile uint64_t sink = 0;                                       \
+      double per_second;                                                \
+      MEASURE_CALLS_PER_SECOND(                                         \
+        for (unsigned int i = 0; i < CORPUS_KEYS; ++i)                  \
+          sink ^= __hash_name##_corpus(c[kind].keys[i], c[kind].lengths[i]), \
+        per_second);                                                    \
+                                                                        \
+      __hash_name##_str_set s;                                          \
+      __hash_name##_str_set_init(&s);                                   \
+      double start = now_seconds();                                     \
+      for (unsigned int i = 0; i < CORPUS_KEYS; ++i)                    \
+        __hash_name##_str_set_insert(&s, c[kind].keys[i]);              \
+      for (unsigned int i = 0; i < CORPUS_KEYS; ++i)                    \
+        sink ^= __hash_name##_str_set_contains(&s, c[kind].keys[i]);    \
+      double elapsed = now_seconds() - start;                           \
+      __hash_name##_str_set_free(&s);                                   \
+      (void) sink;                                                      \
+                                                                        \
+      PRINT_CORPUS_SPEED(#__hash_name, corpus_names[kind],              \
+                         per_second * CORPUS_KEYS / 1e6,                \
+                         2.0 * CORPUS_KEYS / elapsed / 1e6);            \
+    }                                                                   \
+  } while (0)
+
+// The _n and _wide variants return the same hashes as the functions
+// they come from, so they only get the speed rows
+TEST(corpus_tests, micro_hash_bytes_curl)
+{
+  CORPUS_TEST(micro_hash_bytes_curl);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_tests, micro_hash_bytes_jenkins)
+{
+  CORPUS_TEST(micro_hash_bytes_jenkins);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_tests, micro_hash_bytes_xxh64)
+{
+  CORPUS_TEST(micro_hash_bytes_xxh64);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_tests, micro_hash_bytes_crc32c)
+{
+  CORPUS_TEST(micro_hash_bytes_crc32c);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_tests, micro_hash_bytes_aes)
+{
+  CORPUS_TEST(micro_hash_bytes_aes);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_tests, micro_hash_str_stb)
+{
+  CORPUS_TEST(micro_hash_str_stb);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_tests, micro_hash_str_djb2)
+{
+  CORPUS_TEST(micro_hash_str_djb2);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_tests, micro_hash_str_sdbm)
+{
+  CORPUS_TEST(micro_hash_str_sdbm);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_bytes_curl)
+{
+  CORPUS_SPEED_TEST(micro_hash_bytes_curl);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_bytes_curl_wide)
+{
+  CORPUS_SPEED_TEST(micro_hash_bytes_curl_wide);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_bytes_jenkins)
+{
+  CORPUS_SPEED_TEST(micro_hash_bytes_jenkins);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_bytes_xxh64)
+{
+  CORPUS_SPEED_TEST(micro_hash_bytes_xxh64);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_bytes_crc32c)
+{
+  CORPUS_SPEED_TEST(micro_hash_bytes_crc32c);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_bytes_aes)
+{
+  CORPUS_SPEED_TEST(micro_hash_bytes_aes);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_str_stb)
+{
+  CORPUS_SPEED_TEST(micro_hash_str_stb);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_str_stb_n)
+{
+  CORPUS_SPEED_TEST(micro_hash_str_stb_n);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_str_djb2)
+{
+  CORPUS_SPEED_TEST(micro_hash_str_djb2);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_str_djb2_n)
+{
+  CORPUS_SPEED_TEST(micro_hash_str_djb2_n);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_str_sdbm)
+{
+  CORPUS_SPEED_TEST(micro_hash_str_sdbm);
+  TEST_SUCCESS;
+}
+
+TEST(corpus_speed_tests, micro_hash_str_sdbm_n)
+{
+  CORPUS_SPEED_TEST(micro_hash_str_sdbm_n);
+  TEST_SUCCESS;
+}
+
+#define PRINT_LATENCY(__set_name, __op_name, __usec)                    \
+  do {                                                                  \
+    if (format == FORMAT_TABLE)                                         \
+      printf("| %-34.34s | %-12s | %-15.3f |\n", __set_name, __op_name, __usec); \
+    else                                                                \
+      print_record("latency_tests", __set_name, __op_name, "usec", __usec); \
+  } while (0)
+
+// Time each of HASHSET_BENCH_KEYS inserts into a growing set, and
+// print the slowest and the mean one in microseconds
+#define HASHSET_LATENCY(__prefix, __set_name)                           \
+  do {                                                                  \
+    __prefix##_set s;                                                   \
+    __prefix##_set_init(&s);                                            \
+    uint64_t random = lcg64(6969);                                      \
+    double max = 0;                                                     \
+    double total_start = now_seconds();                                 \
+    for (unsigned int i = 0; i < HASHSET_BENCH_KEYS; ++i)               \
+    {                                                                   \
+      double start = now_seconds();                                     \
+      __prefix##_set_insert(&s, random);                                \
+      double elapsed = now_seconds() - start;                           \
+      if (elapsed > max) max = elapsed;                                 \
+      random = lcg64(random);                                           \
+    }                                                                   \
+    double total = now_seconds() - total_start;                         \
+    PRINT_LATENCY(__set_name, "insert max", max * 1e6);                 \
+    PRINT_LATENCY(__set_name, "insert mean", total / HASHSET_BENCH_KEYS * 1e6); \
+    __prefix##_set_free(&s);                                            \
+  } while (0)
+
+TEST(latency_tests, linear)
+{
+  HASHSET_LATENCY(linear64, "HASHSET_DECLARE");
+  TEST_SUCCESS;
+}
+
+TEST(latency_tests, incremental)
+{
+  HASHSET_LATENCY(incremental64, "HASHSET_INCREMENTAL_DECLARE");
+  TEST_SUCCESS;
+}
+
+// Probe length histogram: 1, 2, 3-4, 5-8, 9-16, 17-32 and 33+ slots
+#define PROBE_BUCKETS 7
+
+static const char *probe_bucket_names[PROBE_BUCKETS] = {
+  "1", "2", "3-4", "5-8", "9-16", "17-32", "33+",
+};
+
+static void probe_histogram_add(size_t *histogram, size_t length)
+{
+  size_t bucket = 0;
+  while (bucket < PROBE_BUCKETS - 1 && ((size_t) 1 << bucket) < length)
+    bucket++;
+  histogram[bucket]++;
+}
+
+static void probe_histogram_print(const char *set_name, size_t *histogram)
+{
+  size_t total = 0;
+  for (int i = 0; i < PROBE_BUCKETS; ++i)
+    total += histogram[i];
+  for (int i = 0; i < PROBE_BUCKETS; ++i)
+  {
+    double percent = 100.0 * histogram[i] / total;
+    if (format == FORMAT_TABLE)
+      printf("| %-34.34s | %-12s | %-15.3f |\n", set_name,
+             probe_bucket_names[i], percent);
+    else
+      print_record("probe_tests", set_name, probe_bucket_names[i],
+                   "% of keys", percent);
+  }
+}
+
+// The probe length of a key is the number of slots a lookup of it
+// reads: the distance of its slot from the start of its probe, plus
+// one. The histograms are taken after the churn benchmark.
+
+TEST(probe_tests, linear)
+{
+  linear64_set s;
+  linear64_set_init(&s);
+  double mops;
+  HASHSET_CHURN(linear64, &s, mops);
+  (void) mops;
+
+  size_t histogram[PROBE_BUCKETS] = {0};
+  size_t mask = s.capacity - 1;
+  for (size_t i = 0; i < s.capacity; ++i)
+    if (s.state[i] == 1)
+      probe_histogram_add(histogram,
+                          ((i - micro_hash_int64_wang(s.data[i])) & mask) + 1);
+  probe_histogram_print("HASHSET_DECLARE", histogram);
+
+  linear64_set_free(&s);
+  TEST_SUCCESS;
+}
+
+TEST(probe_tests, robinhood)
+{
+  robinhood64_set s;
+  robinhood64_set_init(&s);
+  double mops;
+  HASHSET_CHURN(robinhood64, &s, mops);
+  (void) mops;
+
+  size_t histogram[PROBE_BUCKETS] = {0};
+  for (size_t i = 0; i < s.capacity; ++i)
+    if (s.dist[i] != 0)
+      probe_histogram_add(histogram, s.dist[i]);
+  probe_histogram_print("HASHSET_ROBINHOOD_DECLARE", histogram);
+
+  robinhood64_set_free(&s);
+  TEST_SUCCESS;
+}
+
+// Returns: whether suite runs, all of them run without --suite
+static bool suite_selected(MicroTests *settings, const char *suite)
+{
+  return settings->run_suite == NULL
+    || _micro_tests_strcmp(settings->run_suite, suite) == 0;
+}
+
+// Run the tests of a single suite, inside their own table
+//
+// Args:
+//  - settings: the settings parsed from the command line
+//  - suite: name of the suite to run
+//  - multithreaded: whether the suite may run on multiple threads,
+//    benchmarks must not so that they do not compete for the CPU
+//  - header: lines printed before the rows, or NULL for no table
+//  - footer: line printed after the rows
+//
+// Returns: the number of failed tests
+static int run_table(MicroTests *settings, const char *suite,
+                     bool multithreaded, const char *header,
+                     const char *footer)
+{
+  if (!suite_selected(settings, suite))
+    return 0;
+
+  MicroTests table_settings = *settings;
+  table_settings.run_suite = suite;
+  table_settings.print_banner = false;
+  
+  if (header != NULL && format == FORMAT_TABLE)
+    printf("%s", header);
+
+  int out;
+  if (multithreaded && table_settings.run_multithreaded
+      && table_settings.thread_number > 0)
+  {
+    suite_threads = (unsigned int) table_settings.thread_number;
+    out = _micro_tests_run_multithreaded(&table_settings);
+  }
+  else
+  {
+    suite_threads = 1;
+    out = _micro_tests_run(&table_settings);
+  }
+
+  if (header != NULL && format == FORMAT_TABLE)
+    printf("%s", footer);
+  
+  return out;
+}
+
+int main(int argc, char **argv)
+{
+  MicroTests settings;
+  if (parse_format(&argc, argv) < 0
+      || micro_tests_parse_args(&settings, argc, argv) < 0)
+    return 1;
+
+  if (settings.print_help)
+  {
+    micro_tests_print_help();
+    printf("  --format=<format>     print the tables as table, json or csv\n");
+    return 0;
+  }
+
+  // Only the records go to stdout
+  if (format != FORMAT_TABLE)
+  {
+    settings.print_banner = false;
+    settings.quiet = true;
+  }
+
+  if (settings.show_list)
+  {
+    micro_tests_show_list(&settings);
+    return 0;
+  }
+
+  if (settings.print_banner)
+    micro_tests_print_banner();
+  
+  int out = 0;
+
+  // Bind the backend before any thread hashes, binding is not
+  // synchronized
+  micro_hash_get_backend();
+
+  print_records_start();
+
+  out += run_table(&settings, "dispatch_tests", false, NULL, NULL);
+  out += run_table(&settings, "consistency_tests", true, NULL, NULL);
+
+  if (suite_selected(&settings, "hash_tests") && format == FORMAT_TABLE)
+  {
+    printf("Iterating over %d random values...\n", ITERATIONS);
+    printf("Precision set to %d\n", PRECISION);
+    printf("Hardware counters: misses per key, - if not available\n");
+  }
+  out += run_table(&settings, "hash_tests", true,
+                   "/--------------------------------------------------------------------------------------------------------------\\\n"
+                   "|      hash function      |  collisions  | non-uniformity  |  IPC  |  br/key  | L1D/key  | LLC/key  | dTLB/key |\n"
+                   "| ----------------------- | ------------ | --------------- | ----- | -------- | -------- | -------- | -------- |\n",
+                   "\\--------------------------------------------------------------------------------------------------------------/\n");
+
+  out += run_table(&settings, "quality_tests", true,
+                   "/--------------------------------------------------------------------------------------------------\\\n"
+                   "|           hash function            |     check      |    value     |    limit     | result |\n"
+                   "| ---------------------------------- | -------------- | ------------ | ------------ | ------ |\n",
+                   "\\--------------------------------------------------------------------------------------------------/\n");
+
+  out += run_table(&settings, "corpus_tests", true,
+                   "/------------------------------------------------------------------------------------\\\n"
+                   "|           hash function            |    corpus    |  collisions  | non-uniformity  |\n"
+                   "| ---------------------------------- | ------------ | ------------ | --------------- |\n",
+                   "\\------------------------------------------------------------------------------------/\n");
+
+  out += run_table(&settings, "timing_tests", false,
+                   "/---------------------------------------------------------------------------------------\\\n"
+                   "|           hash function            |     mode     |     ns/hash     |   cycles/hash   |\n"
+                   "| ---------------------------------- | ------------ | --------------- | --------------- |\n",
+                   "\\---------------------------------------------------------------------------------------/\n");
+
+  out += run_table(&settings, "throughput_tests", false,
+                   "/---------------------------------------------------------------------\\\n"
+                   "|           hash function            |  input size  |      GB/s       |\n"
+                   "| ---------------------------------- | ------------ | --------------- |\n",
+                   "\\---------------------------------------------------------------------/\n");
+
+  out += run_table(&settings, "corpus_speed_tests", false,
+                   "/---------------------------------------------------------------------------------------\\\n"
+                   "|           hash function            |    corpus    |     Mkeys/s     |  set Mops/s     |\n"
+                   "| ---------------------------------- | ------------ | --------------- | --------------- |\n",
+                   "\\---------------------------------------------------------------------------------------/\n");
+
+  out += run_table(&settings, "batch_tests", false,
+                   "/---------------------------------------------------------------------\\\n"
+                   "|           hash function            |    kernel    |     Mkeys/s     |\n"
+                   "| ---------------------------------- | ------------ | --------------- |\n",
+                   "\\---------------------------------------------------------------------/\n");
+
+  out += run_table(&settings, "hashset_tests", false,
+                   "/---------------------------------------------------------------------\\\n"
+                   "|              hash set              |  operation   |     Mops/s      |\n"
+                   "| ---------------------------------- | ------------ | --------------- |\n",
+                   "\\---------------------------------------------------------------------/\n");
+
+  out += run_table(&settings, "latency_tests", false,
+                   "/---------------------------------------------------------------------\\\n"
+                   "|              hash set              |  operation   |      usec       |\n"
+                   "| ---------------------------------- | ------------ | --------------- |\n",
+                   "\\---------------------------------------------------------------------/\n");
 
-  int out = micro_tests_run(argc, argv);
+  out += run_table(&settings, "probe_tests", false,
+                   "/---------------------------------------------------------------------\\\n"
+                   "|              hash set              | probe length |    % of keys    |\n"
+                   "| ---------------------------------- | ------------ | --------------- |\n",
+                   "\\---------------------------------------------------------------------/\n");
 
-  printf("\\----------------------------------------------------------/\n");
+  print_records_end();
+  corpora_free();
   
   return out;
 }